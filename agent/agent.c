@@ -0,0 +1,411 @@
+/*
+ * ramfuck-agent serves a target to remote ramfuck instances (see remote.h).
+ *
+ * The agent attaches to the target given on the command line and serves one
+ * client at a time. Searches and filters run in the agent so that only the
+ * hits go over the network.
+ */
+#define _DEFAULT_SOURCE /* for getaddrinfo(3) */
+#include "ramfuck.h"
+#include "cli.h"
+#include "config.h"
+#include "hits.h"
+#include "remote.h"
+#include "search.h"
+#include "target.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/* Maximum bytes of a single read request */
+#define AGENT_READ_MAX (64 * 1024 * 1024)
+
+struct agent {
+    struct ramfuck ctx;
+    struct remote_buf in, out;
+    uint32_t status;
+};
+
+/*
+ * Copy a string of the protocol to a NUL-terminated string (freed by caller).
+ */
+static char *agent_get_string(struct remote_msg *msg)
+{
+    const char *p;
+    size_t len;
+    char *s;
+    if (!(p = remote_get_bytes(msg, &len)) || !(s = malloc(len + 1)))
+        return NULL;
+    memcpy(s, p, len);
+    s[len] = '\0';
+    return s;
+}
+
+static void agent_regions(struct agent *agent)
+{
+    struct target *target = agent->ctx.target;
+    struct remote_buf regions;
+    struct region *mr;
+    uint64_t n = 0;
+
+    remote_buf_init(&regions);
+    for (mr = target->region_first(target); mr; mr = target->region_next(mr)) {
+        remote_put_u64(&regions, mr->start);
+        remote_put_u64(&regions, mr->size);
+        remote_put_u32(&regions, mr->prot);
+        remote_put_bytes(&regions, mr->path, mr->path ? strlen(mr->path) : 0);
+        n++;
+    }
+    remote_put_u64(&agent->out, n);
+    remote_put(&agent->out, regions.data, regions.size);
+    remote_buf_destroy(&regions);
+}
+
+static void agent_read(struct agent *agent, struct remote_msg *msg)
+{
+    struct target *target = agent->ctx.target;
+    struct target_read *reads;
+    uint64_t i, n, total;
+    char *buf;
+
+    n = remote_get_u64(msg);
+    if (msg->error || n > (uint64_t)(msg->end - msg->p) / 16
+            || !(reads = malloc(sizeof(struct target_read) * (size_t)n + 1))) {
+        agent->status = 0;
+        return;
+    }
+    for (i = total = 0; i < n; i++) {
+        uint64_t len;
+        reads[i].addr = (addr_t)remote_get_u64(msg);
+        if ((len = remote_get_u64(msg)) > AGENT_READ_MAX - total)
+            break;
+        reads[i].len = (size_t)len;
+        total += len;
+    }
+    if (i < n || !(buf = malloc((size_t)total + 1))) {
+        free(reads);
+        agent->status = 0;
+        return;
+    }
+    for (i = total = 0; i < n; i++) {
+        reads[i].buf = buf + total;
+        reads[i].ok = 0;
+        total += reads[i].len;
+    }
+    target->read_batch(target, reads, (size_t)n);
+    for (i = 0; i < n; i++) {
+        if (reads[i].ok) {
+            remote_put_data(&agent->out, reads[i].buf, reads[i].len);
+        } else remote_put_u8(&agent->out, REMOTE_DATA_NONE);
+    }
+    free(buf);
+    free(reads);
+}
+
+static void agent_read_prefix(struct agent *agent, struct remote_msg *msg)
+{
+    struct target *target = agent->ctx.target;
+    addr_t addr = (addr_t)remote_get_u64(msg);
+    uint64_t len = remote_get_u64(msg);
+    char *buf;
+
+    if (msg->error || len > AGENT_READ_MAX || !(buf = malloc(len + 1))) {
+        agent->status = 0;
+        return;
+    }
+    len = target->read_prefix(target, addr, buf, (size_t)len);
+    remote_put_data(&agent->out, buf, (size_t)len);
+    free(buf);
+}
+
+static void agent_write(struct agent *agent, struct remote_msg *msg)
+{
+    struct target *target = agent->ctx.target;
+    struct target_read *writes;
+    uint64_t i, n;
+
+    n = remote_get_u64(msg);
+    if (msg->error || n > (uint64_t)(msg->end - msg->p) / 16
+            || !(writes = malloc(sizeof(struct target_read) * (size_t)n + 1))) {
+        agent->status = 0;
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        writes[i].addr = (addr_t)remote_get_u64(msg);
+        writes[i].buf = (void *)remote_get_bytes(msg, &writes[i].len);
+        writes[i].ok = 0;
+    }
+    if (!msg->error) {
+        target->write_batch(target, writes, (size_t)n);
+        for (i = 0; i < n; i++)
+            remote_put_u8(&agent->out, writes[i].ok);
+    } else agent->status = 0;
+    free(writes);
+}
+
+static void agent_page_flags(struct agent *agent, struct remote_msg *msg)
+{
+    struct target *target = agent->ctx.target;
+    size_t page_size = target_page_size();
+    addr_t addr = (addr_t)remote_get_u64(msg);
+    uint64_t len = remote_get_u64(msg);
+    unsigned char *flags;
+    size_t pages;
+
+    if (msg->error || !len || len > (addr_t)-1 - addr + 1) {
+        agent->status = 0;
+        return;
+    }
+    pages = (addr + (addr_t)len - 1) / page_size - addr / page_size + 1;
+    if (!(flags = malloc(pages))) {
+        agent->status = 0;
+        return;
+    }
+    if (target->page_flags(target, addr, (size_t)len, flags)) {
+        remote_put_bytes(&agent->out, flags, pages);
+    } else agent->status = 0;
+    free(flags);
+}
+
+static void agent_put_hits(struct agent *agent, struct hits *hits)
+{
+    if (hits) {
+        remote_put_hits(&agent->out, hits);
+        hits_delete(hits);
+    } else agent->status = 0;
+}
+
+static void agent_search(struct agent *agent, struct remote_msg *msg)
+{
+    enum value_type types[SEARCH_TYPES_MAX];
+    uint64_t i, n;
+    char *expression;
+
+    remote_get_config(msg, agent->ctx.config);
+    n = remote_get_u64(msg);
+    for (i = 0; i < n && i < SEARCH_TYPES_MAX; i++)
+        types[i] = (enum value_type)remote_get_u32(msg);
+    if (msg->error || n > SEARCH_TYPES_MAX
+            || !(expression = agent_get_string(msg))) {
+        agent->status = 0;
+        return;
+    }
+    agent_put_hits(agent, search_types(&agent->ctx, types, (size_t)n,
+                                       expression));
+    free(expression);
+}
+
+static void agent_search_bytes(struct agent *agent, struct remote_msg *msg)
+{
+    char *pattern;
+    remote_get_config(msg, agent->ctx.config);
+    if (msg->error || !(pattern = agent_get_string(msg))) {
+        agent->status = 0;
+        return;
+    }
+    agent_put_hits(agent, search_bytes(&agent->ctx, pattern));
+    free(pattern);
+}
+
+static void agent_filter(struct agent *agent, struct remote_msg *msg)
+{
+    struct hits *hits, *filtered;
+    char *expression;
+
+    remote_get_config(msg, agent->ctx.config);
+    if (msg->error || !(expression = agent_get_string(msg))) {
+        agent->status = 0;
+        return;
+    }
+    if ((hits = remote_get_hits(msg))) {
+        filtered = filter(&agent->ctx, hits, expression);
+        agent_put_hits(agent, filtered != hits ? filtered : NULL);
+        hits_delete(hits);
+    } else agent->status = 0;
+    free(expression);
+}
+
+/*
+ * Handle one request of `op` in agent->in to agent->out and agent->status.
+ */
+static void agent_handle(struct agent *agent, uint32_t op)
+{
+    struct target *target = agent->ctx.target;
+    struct remote_msg msg;
+
+    msg.p = agent->in.data;
+    msg.end = agent->in.data + agent->in.size;
+    msg.error = 0;
+    agent->out.size = 0;
+    agent->out.error = 0;
+    agent->status = 1;
+
+    switch (op) {
+    case REMOTE_HELLO:
+        remote_put_u32(&agent->out, REMOTE_VERSION);
+        break;
+    case REMOTE_STOP:
+        agent->status = ramfuck_break(&agent->ctx);
+        break;
+    case REMOTE_RUN:
+        agent->status = ramfuck_continue(&agent->ctx);
+        break;
+    case REMOTE_STOP_MODE:
+        {
+            uint32_t mode = remote_get_u32(&msg);
+            if (!msg.error && mode <= 2) {
+                agent->ctx.config->target.stop = mode;
+            } else agent->status = 0;
+        }
+        break;
+    case REMOTE_REGIONS: agent_regions(agent); break;
+    case REMOTE_READ: agent_read(agent, &msg); break;
+    case REMOTE_READ_PREFIX: agent_read_prefix(agent, &msg); break;
+    case REMOTE_WRITE: agent_write(agent, &msg); break;
+    case REMOTE_PAGE_FLAGS: agent_page_flags(agent, &msg); break;
+    case REMOTE_CLEAR_SOFT_DIRTY:
+        agent->status = ramfuck_clear_soft_dirty(&agent->ctx);
+        break;
+    case REMOTE_REFRESH:
+        agent->status = target->refresh(target);
+        break;
+    case REMOTE_SEARCH: agent_search(agent, &msg); break;
+    case REMOTE_SEARCH_BYTES: agent_search_bytes(agent, &msg); break;
+    case REMOTE_FILTER: agent_filter(agent, &msg); break;
+    default:
+        errf("agent: unknown operation %lu", (unsigned long)op);
+        agent->status = 0;
+    }
+    if (agent->out.error) {
+        errf("agent: out-of-memory for reply");
+        agent->out.size = 0;
+        agent->out.error = 0;
+        agent->status = 0;
+    } else if (!agent->status) {
+        agent->out.size = 0;
+    }
+}
+
+static void agent_serve(struct agent *agent, int fd)
+{
+    uint32_t op;
+    for (;;) {
+        ramfuck_wait_input(&agent->ctx, fd);
+        if (!remote_recv(fd, &op, &agent->in))
+            break;
+        agent_handle(agent, op);
+        if (!remote_send(fd, agent->status, &agent->out))
+            break;
+    }
+
+    /* Resume the target left stopped by the client */
+    while (agent->ctx.breaks)
+        ramfuck_continue(&agent->ctx);
+}
+
+/*
+ * Listen on `[host:]port` (host defaults to 127.0.0.1).
+ */
+static int agent_listen(const char *hostport)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port;
+    size_t len;
+    int fd = -1, one = 1;
+
+    if (*hostport == '[' && (port = strstr(hostport, "]:"))) {
+        len = port - ++hostport;
+        port += 2;
+    } else if ((port = strrchr(hostport, ':'))) {
+        len = port++ - hostport;
+    } else {
+        len = 0;
+        port = hostport;
+    }
+    if (!*port || len >= sizeof(host)) {
+        errf("agent: expected [host:]port (%s)", hostport);
+        return -1;
+    }
+    if (len) {
+        memcpy(host, hostport, len);
+        host[len] = '\0';
+    } else strcpy(host, "127.0.0.1");
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        errf("agent: cannot resolve %s", host);
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 1))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1)
+        errf("agent: cannot listen on %s:%s", host, port);
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    struct agent agent;
+    int fd, rc = 1;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s [host:]port <target-uri>\n", argv[0]);
+        return 1;
+    }
+
+    memset(&agent, 0, sizeof(struct agent));
+    if (!ramfuck_init(&agent.ctx)) {
+        errf("agent: out-of-memory for ramfuck context");
+        return 1;
+    }
+    remote_buf_init(&agent.in);
+    remote_buf_init(&agent.out);
+    if (cli_execute_format(&agent.ctx, "attach %s", argv[2])
+            || !agent.ctx.target) {
+        errf("agent: cannot attach to %s", argv[2]);
+        goto destroy;
+    }
+    agent.ctx.config->cli.quiet = 1;
+
+    if ((fd = agent_listen(argv[1])) == -1)
+        goto destroy;
+    infof("agent: serving %s on %s", argv[2], argv[1]);
+    while (agent.ctx.target) {
+        int client, one = 1;
+        ramfuck_wait_input(&agent.ctx, fd);
+        if ((client = accept(fd, NULL, NULL)) == -1)
+            continue;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        agent_serve(&agent, client);
+        close(client);
+    }
+    close(fd);
+    rc = 0;
+
+destroy:
+    remote_buf_destroy(&agent.in);
+    remote_buf_destroy(&agent.out);
+    ramfuck_destroy(&agent.ctx);
+    return rc;
+}
@@ -0,0 +1,357 @@
+/*
+ * Benchmarks of the search & filter pipeline on synthetic file:// targets.
+ *
+ * A file of random data with needles planted at a given density is searched
+ * and filtered for every value type and alignment. Results are printed as
+ * tab-separated lines (lines starting with '#' are comments).
+ */
+#define _POSIX_C_SOURCE 199309L /* for clock_gettime(2) and getopt(3) */
+#include "ramfuck.h"
+#include "ast.h"
+#include "config.h"
+#include "eval.h"
+#include "hits.h"
+#include "opt.h"
+#include "parse.h"
+#include "search.h"
+#include "symbol.h"
+#include "target.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bench {
+    struct ramfuck ctx;
+    const char *path;
+    unsigned long size;    /* bytes of the synthetic target */
+    unsigned long density; /* needles per MiB */
+    unsigned long evals;   /* evaluations per eval benchmark */
+    unsigned int rounds;   /* best of rounds */
+    uint32_t seed;
+    char *data;
+    uint32_t rng;
+};
+
+static const enum value_type bench_types[] = {
+    S8, U8, S16, U16, S32, U32,
+#ifndef NO_64BIT_VALUES
+    S64, U64,
+#endif
+#ifndef NO_FLOAT_VALUES
+    F32, F64,
+#endif
+};
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t bench_random(struct bench *b)
+{
+    /* xorshift32 */
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 17;
+    b->rng ^= b->rng << 5;
+    return b->rng;
+}
+
+/*
+ * Needle searched for values of `type`.
+ */
+static const char *bench_needle(enum value_type type, union value_data *out)
+{
+    switch (type) {
+    case S8:  out->s8 = 90;  break;
+    case U8:  out->u8 = 90;  break;
+    case S16: out->s16 = 90; break;
+    case U16: out->u16 = 90; break;
+    case S32: out->s32 = 90; break;
+    case U32: out->u32 = 90; break;
+#ifndef NO_64BIT_VALUES
+    case S64: out->s64 = 90; break;
+    case U64: out->u64 = 90; break;
+#endif
+#ifndef NO_FLOAT_VALUES
+    case F32: out->f32 = 1234.5f; return "value == 1234.5";
+    case F64: out->f64 = 1234.5;  return "value == 1234.5";
+#endif
+    default: break;
+    }
+    return "value == 90";
+}
+
+/*
+ * Write random data with needles of `type` to the target file.
+ */
+static int bench_generate(struct bench *b, enum value_type type)
+{
+    union value_data needle;
+    size_t size = value_type_sizeof(type);
+    unsigned long i, needles;
+    FILE *fp;
+    int ok;
+
+    bench_needle(type, &needle);
+    b->rng = b->seed ? b->seed : 1;
+    for (i = 0; i + 4 <= b->size; i += 4) {
+        uint32_t r = bench_random(b);
+        memcpy(b->data + i, &r, 4);
+    }
+    for (; i < b->size; i++)
+        b->data[i] = (char)bench_random(b);
+
+    needles = (unsigned long)((double)b->size / (1024 * 1024) * b->density);
+    for (i = 0; i < needles && b->size >= size; i++) {
+        unsigned long off = bench_random(b) % (b->size / size) * size;
+        memcpy(b->data + off, &needle, size);
+    }
+
+    if (!(fp = fopen(b->path, "wb"))) {
+        errf("bench: cannot open %s for writing", b->path);
+        return 0;
+    }
+    ok = fwrite(b->data, 1, b->size, fp) == b->size;
+    ok = !fclose(fp) && ok;
+    if (!ok)
+        errf("bench: error writing %s", b->path);
+    return ok;
+}
+
+static void bench_print(const char *name, enum value_type type,
+                        unsigned int align, double bytes, size_t hits,
+                        double seconds, double evals)
+{
+    fprintf(stdout, "%s\t%s\t%u\t%.0f\t%lu\t%.6f", name,
+            value_type_to_string(type), align, bytes, (unsigned long)hits,
+            seconds);
+    if (bytes > 0)
+        fprintf(stdout, "\t%.3f", bytes / seconds / 1e9);
+    else fputs("\t-", stdout);
+    fprintf(stdout, "\t%.0f", hits / seconds);
+    if (evals > 0)
+        fprintf(stdout, "\t%.2f", seconds * 1e9 / evals);
+    else fputs("\t-", stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+/*
+ * Benchmark search() and filter() of the target with `align`.
+ */
+static int bench_search(struct bench *b, enum value_type type,
+                        unsigned int align)
+{
+    union value_data needle;
+    const char *expression = bench_needle(type, &needle);
+    struct hits *hits = NULL;
+    double best_search = 0, best_filter = 0;
+    size_t filtered = 0;
+    unsigned int i;
+
+    b->ctx.config->search.align = align;
+    for (i = 0; i < b->rounds; i++) {
+        struct hits *new;
+        double t = bench_now();
+        if (!(new = search(&b->ctx, type, expression))) {
+            errf("bench: search %s %s failed", value_type_to_string(type),
+                 expression);
+            if (hits) hits_delete(hits);
+            return 0;
+        }
+        t = bench_now() - t;
+        if (!i || t < best_search)
+            best_search = t;
+        if (hits) hits_delete(hits);
+        hits = new;
+    }
+    bench_print("search", type, align, b->size, hits->size, best_search, 0);
+
+    for (i = 0; i < b->rounds; i++) {
+        struct hits *new;
+        double t = bench_now();
+        if (!(new = filter(&b->ctx, hits, "value == prev"))) {
+            errf("bench: filter %s failed", value_type_to_string(type));
+            hits_delete(hits);
+            return 0;
+        }
+        t = bench_now() - t;
+        if (!i || t < best_filter)
+            best_filter = t;
+        filtered = new->size;
+        hits_delete(new);
+    }
+    bench_print("filter", type, align, 0, filtered, best_filter, 0);
+
+    hits_delete(hits);
+    return 1;
+}
+
+/*
+ * Benchmark ast_evaluate() and vm_execute() of the needle expression over
+ * the values of the synthetic data.
+ */
+static int bench_eval(struct bench *b, enum value_type type)
+{
+    union value_data needle, value;
+    const char *expression = bench_needle(type, &needle);
+    size_t size = value_type_sizeof(type);
+    size_t count = b->size / size;
+    struct symbol_table *symtab;
+    struct parser parser;
+    struct vm_program *prog = NULL;
+    struct ast *ast = NULL, *opt;
+    union value_data **ppdata;
+    size_t sym;
+    int pass, ok = 0;
+
+    if (!count || !(symtab = symbol_table_new(&b->ctx)))
+        return 0;
+    sym = symbol_table_add(symtab, "value", type, &value);
+    ppdata = &symtab->symbols[sym]->pdata;
+
+    parser_init(&parser);
+    parser.symtab = symtab;
+    parser.addr_type = U32;
+    if (!(ast = parse_expression(&parser, expression))) {
+        errf("bench: parsing '%s' failed", expression);
+        goto fail;
+    }
+    if ((opt = ast_optimize(ast))) {
+        ast_delete(ast);
+        ast = opt;
+    }
+    if (!(prog = vm_compile(ast))) {
+        errf("bench: compiling '%s' failed", expression);
+        goto fail;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        double best = 0;
+        size_t hits = 0;
+        unsigned int i;
+        for (i = 0; i < b->rounds; i++) {
+            struct value result;
+            unsigned long j;
+            size_t k = 0;
+            double t = bench_now();
+            hits = 0;
+            for (j = 0; j < b->evals; j++) {
+                *ppdata = (union value_data *)(b->data + k * size);
+                if (++k == count)
+                    k = 0;
+                if (pass ? vm_execute(prog, &result)
+                         : ast_evaluate(ast, &result)) {
+                    hits += value_is_nonzero(&result);
+                }
+            }
+            t = bench_now() - t;
+            if (!i || t < best)
+                best = t;
+        }
+        bench_print(pass ? "vm" : "eval", type, (unsigned int)size, 0, hits,
+                    best, b->evals);
+    }
+    ok = 1;
+
+fail:
+    if (prog) vm_program_delete(prog);
+    if (ast) ast_delete(ast);
+    symbol_table_delete(symtab);
+    return ok;
+}
+
+static int bench_run(struct bench *b)
+{
+    size_t i;
+    char *uri;
+    int ok = 1;
+
+    if (!(uri = malloc(strlen(b->path) + sizeof("file://")))) {
+        errf("bench: out-of-memory for target URI");
+        return 0;
+    }
+    sprintf(uri, "file://%s", b->path);
+
+    fprintf(stdout, "# size=%lu density=%lu evals=%lu rounds=%u seed=%lu\n",
+            b->size, b->density, b->evals, b->rounds, (unsigned long)b->seed);
+    fputs("# bench\ttype\talign\tbytes\thits\tseconds\tGB/s\thits/s\t"
+          "ns/eval\n", stdout);
+    for (i = 0; ok && i < sizeof(bench_types)/sizeof(*bench_types); i++) {
+        enum value_type type = bench_types[i];
+        unsigned int size = value_type_sizeof(type);
+        if (!bench_generate(b, type) || !(b->ctx.target = target_attach(uri))) {
+            ok = 0;
+            break;
+        }
+        ok = bench_search(b, type, 1) && (size == 1
+                                          || bench_search(b, type, size))
+          && bench_eval(b, type);
+        target_detach(b->ctx.target);
+        b->ctx.target = NULL;
+    }
+
+    free(uri);
+    return ok;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-s size] [-d density] [-n evals] "
+            "[-r rounds] [-S seed] [-f path]\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench b;
+    int opt, rc;
+
+    memset(&b, 0, sizeof(struct bench));
+    b.path = "/tmp/ramfuck-bench.bin";
+    b.size = 64 * 1024 * 1024;
+    b.density = 1024;
+    b.evals = 1 << 22;
+    b.rounds = 3;
+    b.seed = 1;
+    while ((opt = getopt(argc, argv, "s:d:n:r:S:f:h")) != -1) {
+        switch (opt) {
+        case 's': b.size = strtoul(optarg, NULL, 0); break;
+        case 'd': b.density = strtoul(optarg, NULL, 0); break;
+        case 'n': b.evals = strtoul(optarg, NULL, 0); break;
+        case 'r': b.rounds = strtoul(optarg, NULL, 0); break;
+        case 'S': b.seed = strtoul(optarg, NULL, 0); break;
+        case 'f': b.path = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt != 'h';
+        }
+    }
+    if (optind < argc || !b.size || !b.rounds) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!ramfuck_init(&b.ctx)) {
+        errf("bench: out-of-memory for ramfuck context");
+        return 1;
+    }
+    b.ctx.config->cli.quiet = 1;
+    if ((b.data = malloc(b.size))) {
+        rc = !bench_run(&b);
+        free(b.data);
+        unlink(b.path);
+    } else {
+        errf("bench: out-of-memory for %lu bytes of data", b.size);
+        rc = 1;
+    }
+    ramfuck_destroy(&b.ctx);
+    return rc;
+}
@@ -5,15 +5,22 @@
 
 #include "config.h"
 #include "eval.h"
+#include "freeze.h"
+#include "group.h"
 #include "hits.h"
 #include "lex.h"
 #include "line.h"
 #include "opt.h"
 #include "parse.h"
+#include "pointer.h"
 #include "ptrace.h"
 #include "search.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "symbol.h"
 #include "target.h"
+#include "vm.h"
+#include "watch.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -100,6 +107,51 @@ static enum value_type accept_type(const char **pin)
     return 0;
 }
 
+/*
+ * Accept a comma-separated list of types, or `any` for the signed integer and
+ * floating-point types. Returns the number of (distinct) types or zero.
+ */
+static size_t accept_types(const char **pin, enum value_type *types)
+{
+    static const enum value_type any[] = {
+        S8, S16, S32,
+#ifndef NO_64BIT_VALUES
+        S64,
+#endif
+#ifndef NO_FLOAT_VALUES
+        F32, F64,
+#endif
+    };
+    const char *l, *r, *in0 = *pin;
+    size_t i, n = 0;
+
+    if (accept(pin, "any")) {
+        memcpy(types, any, sizeof(any));
+        return sizeof(any) / sizeof(*any);
+    }
+    if (!eat_item(pin, &l, &r)) {
+        *pin = in0;
+        return 0;
+    }
+    while (l < r) {
+        const char *comma;
+        enum value_type type;
+        for (comma = l; comma < r && *comma != ','; comma++);
+        if (!(type = value_type_from_substring(l, comma - l))
+                || n == SEARCH_TYPES_MAX) {
+            *pin = in0;
+            return 0;
+        }
+        for (i = 0; i < n && types[i] != type; i++);
+        if (i == n)
+            types[n++] = type;
+        l = comma + (comma < r);
+    }
+    if (!n)
+        *pin = in0;
+    return n;
+}
+
 static int accept_value(const char **pin, enum value_type value_type,
                         enum value_type addr_type, int positional,
                         struct value *out)
@@ -175,6 +227,50 @@ static int accept_sint(const char **pin, int positional, intmax_t *out)
     return 1;
 }
 
+/*
+ * Accept a range <first>..<last> of (1-based, inclusive) hit indices where
+ * negative indices count from the end and omitted ones default to the first
+ * and the last hit. Returns 1 and the [*pfirst, *plast) index range on
+ * success, -1 if an index is not in 1..size, or 0 if the input is no range.
+ */
+static int accept_range(const char **pin, size_t size, size_t *pfirst,
+                        size_t *plast)
+{
+    const char *l, *r, *dots, *in0 = *pin;
+    long index[2];
+    int i;
+
+    if (!eat_item(pin, &l, &r))
+        return 0;
+    for (dots = l; dots + 1 < r && !(dots[0] == '.' && dots[1] == '.'); dots++);
+    if (dots + 1 >= r) {
+        *pin = in0;
+        return 0;
+    }
+    index[0] = 1;
+    index[1] = (long)size;
+    for (i = 0; i < 2; i++) {
+        const char *start = i ? dots + 2 : l, *end = i ? r : dots;
+        char *last;
+        if (start == end)
+            continue;
+        index[i] = strtol(start, &last, 0);
+        if (last != end) {
+            *pin = in0;
+            return 0;
+        }
+        if (index[i] < 0)
+            index[i] += (long)size + 1;
+        if (!(1 <= index[i] && index[i] <= (long)size))
+            return -1;
+    }
+    if (index[0] > index[1])
+        return -1;
+    *pfirst = index[0] - 1;
+    *plast = index[1];
+    return 1;
+}
+
 static size_t fput_value(struct ramfuck *ctx, const struct value *value,
                          int typed, FILE *stream)
 {
@@ -267,6 +363,8 @@ static int do_attach(struct ramfuck *ctx, const char *in)
 
     if (ctx->target) {
         infof("detaching from previous target");
+        ramfuck_set_watch(ctx, NULL);
+        ramfuck_set_freezer(ctx, NULL);
         if (ctx->breaks) {
             if (!ctx->target->run(ctx->target))
                 warnf("attach: continuing execution of detach target  failed");
@@ -275,6 +373,7 @@ static int do_attach(struct ramfuck *ctx, const char *in)
         target_detach(ctx->target);
     }
     ctx->target = target;
+    ramfuck_set_pointer_map(ctx, NULL);
 
     ctx->breaks = 0;
     ramfuck_break(ctx);
@@ -349,6 +448,7 @@ static int do_clear(struct ramfuck *ctx, const char *in)
     }
 
     ramfuck_set_hits(ctx, NULL);
+    ramfuck_set_snapshot(ctx, NULL);
     return 0;
 }
 
@@ -414,8 +514,11 @@ static int do_detach(struct ramfuck *ctx, const char *in)
         ctx->breaks = 0;
     }
 
+    ramfuck_set_watch(ctx, NULL);
+    ramfuck_set_freezer(ctx, NULL);
     target_detach(ctx->target);
     ctx->target = NULL;
+    ramfuck_set_pointer_map(ctx, NULL);
     infof("detached");
     return 0;
 }
@@ -519,11 +622,16 @@ static int do_eval(struct ramfuck *ctx, const char *in)
     parser.quiet = 1;
     parser.addr_type = ctx_addr_type(ctx);
     parser.target = ctx->target;
+    ok = 0;
     if ((ast = parse_expression(&parser, in))) {
         struct value out = {0};
-        if (parser.has_deref) ramfuck_break(ctx);
-        ok = ast_evaluate(ast, &out);
-        if (parser.has_deref) ramfuck_continue(ctx);
+        struct vm_program *prog;
+        if ((prog = vm_compile(ast))) {
+            if (parser.has_deref) ramfuck_break(ctx);
+            ok = vm_execute(prog, &out);
+            if (parser.has_deref) ramfuck_continue(ctx);
+            vm_program_delete(prog);
+        }
         ast_delete(ast);
         if (ok) {
             fput_value(ctx, &out, 0, stdout);
@@ -651,6 +759,18 @@ static int do_filter(struct ramfuck *ctx, const char *in)
         return 1;
     }
 
+    if (ctx->snapshot) {
+        if (!ctx->target) {
+            errf("filter: attach to target first");
+            return 2;
+        }
+        if (!(hits = filter_snapshot(ctx, ctx->snapshot, in)))
+            return 3;
+        ramfuck_set_snapshot(ctx, NULL);
+        ramfuck_set_hits(ctx, hits);
+        return 0;
+    }
+
     if (!ctx->hits || !ctx->hits->size) {
         infof("filter: zero hits");
         return 2;
@@ -665,62 +785,295 @@ static int do_filter(struct ramfuck *ctx, const char *in)
 }
 
 /*
- * List current hits.
+ * Freeze values by re-writing them on a scheduler thread.
+ * Usage: freeze
+ *        freeze <type> <addr> <expression>
+ *        freeze <hit_index> <expression>
+ *        freeze remove <index>
+ *        freeze clear
+ */
+static int do_freeze(struct ramfuck *ctx, const char *in)
+{
+    enum value_type type;
+    addr_t addr;
+
+    if (eol(in)) {
+        if (!ctx->freezer || !ctx->freezer->size) {
+            infof("freeze: no frozen values");
+            return 0;
+        }
+        freezer_print(ctx->freezer, stdout);
+        return 0;
+    }
+    if (accept(&in, "clear")) {
+        if (!eol(in)) {
+            errf("freeze: trailing characters");
+            return 1;
+        }
+        ramfuck_set_freezer(ctx, NULL);
+        return 0;
+    }
+    if (accept(&in, "remove")) {
+        intmax_t index;
+        if (!accept_sint(&in, 1, &index) || !eol(in)) {
+            errf("freeze: frozen value index expected");
+            return 1;
+        }
+        if (!ctx->freezer || index < 1
+                || !freezer_remove(ctx->freezer, (size_t)(index - 1))) {
+            errf("freeze: bad index %" PRIdMAX " not in 1..%lu", index,
+                 (unsigned long)(ctx->freezer ? ctx->freezer->size : 0));
+            return 2;
+        }
+        return 0;
+    }
+
+    if (!ctx->target) {
+        errf("freeze: attach to target first");
+        return 2;
+    }
+
+    if ((type = accept_type(&in))) {
+        if (eol(in)) {
+            errf("freeze: address expected after type");
+            return 3;
+        }
+        if (!accept_addr(&in, ctx_addr_type(ctx), 1, &addr)) {
+            errf("freeze: evaluating address value failed");
+            return 4;
+        }
+    } else {
+        intmax_t index0, index;
+        if (!accept_sint(&in, 1, &index0)) {
+            errf("freeze: evaluating hit index failed");
+            return 5;
+        }
+        if (!ctx->hits || !ctx->hits->size) {
+            errf("freeze: bad index %" PRIdMAX " (0 hits)", index0);
+            return 6;
+        }
+        index = (index0 < 0) ? index0 + ctx->hits->size : index0 - 1;
+        if (!(0 <= index && index < ctx->hits->size)) {
+            errf("freeze: bad index %" PRIdMAX " not in 1..%lu",
+                 index0, (unsigned long)ctx->hits->size);
+            return 7;
+        }
+        addr = hits_addr(ctx->hits, index);
+        type = hits_type(ctx->hits, index);
+    }
+
+    if (eol(in)) {
+        errf("freeze: value expression expected");
+        return 8;
+    }
+
+    if (!ctx->freezer) {
+        struct freezer *freezer;
+        if (!(freezer = freezer_new(ctx)))
+            return 9;
+        ramfuck_set_freezer(ctx, freezer);
+    }
+    if (!freezer_add(ctx->freezer, addr, type, in))
+        return 10;
+    return 0;
+}
+
+/*
+ * Show the members of a target group or the hits found at the same offset of
+ * the same module in every member.
+ * Usage: group
+ *        group common
+ */
+static int do_group(struct ramfuck *ctx, const char *in)
+{
+    long common;
+    if (!target_group_size(ctx->target)) {
+        errf("group: attach to a group:// target first");
+        return 1;
+    }
+    if (eol(in)) {
+        group_print(ctx->target, stdout);
+        return 0;
+    }
+    if (!accept(&in, "common") || !eol(in)) {
+        errf("group: unknown subcommand");
+        return 2;
+    }
+    if (!ctx->hits || !ctx->hits->size) {
+        infof("group: zero hits");
+        return 0;
+    }
+    if ((common = group_common(ctx->target, ctx->hits, stdout)) < 0)
+        return 3;
+    infof("group: %ld hits in all %lu targets", common,
+          (unsigned long)target_group_size(ctx->target));
+    return 0;
+}
+
+/* Size of the buffer list output is formatted to */
+#define LIST_BUFFER_SIZE (64 * 1024)
+
+/* Maximum length of a formatted list line */
+#define LIST_LINE_MAX 256
+
+/*
+ * List current hits (count hits starting from the start'th).
  * Usage: list
+ *        list <start>
+ *        list <start> <count>
  */
 static int do_list(struct ramfuck *ctx, const char *in)
 {
-    size_t i;
+    size_t (*to_string)(const struct value *, char *, size_t)
+        = (ctx->config->cli.base == 16) ? value_to_hexstring : value_to_string;
+    size_t i, first, last;
     struct target *target;
+    struct value *values;
+    struct target_read *reads;
+    char *out;
+    size_t len;
+    int quiet;
 
+    if (!ctx->hits || !ctx->hits->size) {
+        if (!eol(in))
+            errf("list: bad start index (0 hits)");
+        else infof("list: zero hits");
+        return eol(in) ? 0 : 1;
+    }
+
+    first = 0;
+    last = ctx->hits->size;
     if (!eol(in)) {
-        errf("list: trailing characters");
-        return 1;
+        intmax_t start, count;
+        if (!accept_sint(&in, 1, &start)) {
+            errf("list: evaluating start index failed");
+            return 1;
+        }
+        if (start < 0)
+            start += ctx->hits->size + 1;
+        if (!(1 <= start && start <= ctx->hits->size)) {
+            errf("list: bad start index not in 1..%lu",
+                 (unsigned long)ctx->hits->size);
+            return 1;
+        }
+        first = start - 1;
+        if (!eol(in)) {
+            if (!accept_sint(&in, 1, &count) || count < 0) {
+                errf("list: bad count");
+                return 1;
+            }
+            if (count < last - first)
+                last = first + count;
+        }
+        if (!eol(in)) {
+            errf("list: trailing characters");
+            return 1;
+        }
     }
 
-    if (!ctx->hits || !ctx->hits->size) {
-        infof("list: zero hits");
-        return 0;
+    values = malloc(TARGET_READ_BATCH * sizeof(struct value));
+    reads = malloc(TARGET_READ_BATCH * sizeof(struct target_read));
+    out = malloc(LIST_BUFFER_SIZE);
+    if (!values || !reads || !out) {
+        errf("list: out-of-memory for list buffers");
+        free(out);
+        free(reads);
+        free(values);
+        return 2;
     }
 
+    /* The target is stopped only while reading each batch of hits */
     target = ctx->target;
-    ramfuck_break(ctx);
-    for (i = 0; i < ctx->hits->size; i++) {
-        struct hit *hit = &ctx->hits->items[i];
-        if (!ctx->config->cli.quiet) {
-            fprintf(stdout, "%lu. *(%s *)",
-                    (unsigned long)i+1, value_type_to_string(hit->type));
-        } else {
-            fprintf(stdout, "%s ", value_type_to_string(hit->type));
-        }
-        fprintf(stdout, "0x%08" PRIaddr, hit->addr);
-        fputs(ctx->config->cli.quiet ? " " : " = ", stdout);
-        if (target) {
-            size_t size;
-            struct value value;
-            value.type = hit->type;
-            if (hit->type & PTR) {
-                value.data.addr = 0;
-                size = ctx->addr_size;
-            } else {
-                size = value_sizeof(&value);
-            }
-            if (target->read(target, hit->addr, &value.data, size)) {
-                fput_value(ctx, &value, 0, stdout);
-                fputc('\n', stdout);
-                continue;
+    quiet = ctx->config->cli.quiet;
+    len = 0;
+    for (i = first; i < last; i++) {
+        size_t k = (i - first) % TARGET_READ_BATCH;
+        struct value *value = &values[k];
+        addr_t addr = hits_addr(ctx->hits, i);
+        enum value_type type = hits_type(ctx->hits, i);
+        if (target && k == 0) {
+            /* Read values of the next batch of hits */
+            size_t j, n = last - i;
+            if (n > TARGET_READ_BATCH)
+                n = TARGET_READ_BATCH;
+            for (j = 0; j < n; j++) {
+                values[j].type = hits_type(ctx->hits, i + j);
+                reads[j].addr = hits_addr(ctx->hits, i + j);
+                reads[j].buf = &values[j].data;
+                if (values[j].type & PTR) {
+                    values[j].data.addr = 0;
+                    reads[j].len = ctx->addr_size;
+                } else {
+                    reads[j].len = value_sizeof(&values[j]);
+                }
+                reads[j].ok = 0;
             }
+            ramfuck_break(ctx);
+            target_read_spans(target, reads, n, ctx->config->read.gap);
+            ramfuck_continue(ctx);
+        }
+
+        if (LIST_BUFFER_SIZE - len < LIST_LINE_MAX) {
+            fwrite(out, 1, len, stdout);
+            len = 0;
+        }
+        if (!quiet) {
+            len += sprintf(out + len, "%lu. *(%s *)", (unsigned long)i+1,
+                           value_type_to_string(type));
+        } else {
+            len += sprintf(out + len, "%s ", value_type_to_string(type));
+        }
+        len += sprintf(out + len, "0x%08" PRIaddr "%s", addr,
+                       quiet ? " " : " = ");
+        if (target && reads[k].ok) {
+            size_t size = LIST_BUFFER_SIZE - len - 1;
+            size_t value_len = to_string(value, out + len, size);
+            if (value_len >= size) {
+                /* Too long to buffer (never for numeric values) */
+                fwrite(out, 1, len, stdout);
+                fput_value(ctx, value, 0, stdout);
+                len = 0;
+            } else len += value_len;
+            out[len++] = '\n';
+        } else {
+            memcpy(out + len, "???\n", 4);
+            len += 4;
         }
-        fprintf(stdout, "???\n");
     }
-    ramfuck_continue(ctx);
+    fwrite(out, 1, len, stdout);
+
+    free(out);
+    free(reads);
+    free(values);
+    return 0;
+}
+
+/*
+ * Load hits saved with save.
+ * Usage: load <path>
+ */
+static int do_load(struct ramfuck *ctx, const char *in)
+{
+    struct hits *hits;
+
+    if (eol(in)) {
+        errf("load: missing path");
+        return 1;
+    }
+
+    if (!(hits = hits_load(in))) {
+        errf("load: loading hits from %s failed", in);
+        return 2;
+    }
 
+    ramfuck_set_snapshot(ctx, NULL);
+    ramfuck_set_hits(ctx, hits);
     return 0;
 }
 
 /*
- * Show memory maps of target.
- * Usage: maps
+ * Show memory maps of target. With "refresh", cached maps are read again.
+ * Usage: maps [refresh]
  */
 static int do_maps(struct ramfuck *ctx, const char *in)
 {
@@ -728,7 +1081,9 @@ static int do_maps(struct ramfuck *ctx, const char *in)
     size_t size;
     struct target *target;
     struct region *mr;
+    int refresh;
 
+    refresh = accept(&in, "refresh");
     if (!eol(in)) {
         errf("maps: trailing characters");
         return 1;
@@ -739,6 +1094,11 @@ static int do_maps(struct ramfuck *ctx, const char *in)
         return 2;
     }
 
+    if (refresh && !ctx->target->refresh(ctx->target)) {
+        errf("maps: refreshing memory regions failed");
+        return 4;
+    }
+
     if (!(buf = malloc((size = 128)))) {
         errf("maps: cannot allocate line buffer");
         return 3;
@@ -811,8 +1171,8 @@ static int do_peek(struct ramfuck *ctx, const char *in)
                  index0, (unsigned long)ctx->hits->size);
             return 6;
         }
-        addr = ctx->hits->items[index].addr;
-        type = ctx->hits->items[index].type;
+        addr = hits_addr(ctx->hits, index);
+        type = hits_type(ctx->hits, index);
     }
 
     if (!eol(in)) {
@@ -837,10 +1197,129 @@ static int do_peek(struct ramfuck *ctx, const char *in)
     return 0;
 }
 
+struct pointerscan_output {
+    struct ramfuck *ctx;
+    unsigned long chains;
+};
+
+static int pointerscan_print(const struct pointer_chain *chain, void *arg)
+{
+    struct pointerscan_output *out = arg;
+    size_t i;
+    if (!out->ctx->config->cli.quiet)
+        fprintf(stdout, "%lu. ", out->chains + 1);
+    fprintf(stdout, "0x%08" PRIaddr " (%s+0x%" PRIaddr ")", chain->base,
+            chain->region->path, chain->base - chain->module);
+    for (i = 0; i < chain->depth; i++)
+        fprintf(stdout, " -> +0x%" PRIaddr, chain->offsets[i]);
+    fputc('\n', stdout);
+    out->chains++;
+    return 1;
+}
+
+/*
+ * Find pointer chains from module memory to an address or a hit. The pointer
+ * map of the target memory is built on first use and rebuilt with `index`.
+ * Usage: pointerscan index
+ *        pointerscan <hit_index> [depth] [offset]
+ *        pointerscan addr <addr> [depth] [offset]
+ */
+static int do_pointerscan(struct ramfuck *ctx, const char *in)
+{
+    struct pointerscan_output out;
+    intmax_t depth;
+    addr_t addr, offset;
+    int rebuild, size;
+    char suffix;
+
+    if (!ctx->target) {
+        errf("pointerscan: attach to target first");
+        return 1;
+    }
+
+    if (eol(in)) {
+        errf("pointerscan: hit index or address expected");
+        return 2;
+    }
+
+    depth = 4;
+    offset = 1024;
+    if ((rebuild = accept(&in, "index"))) {
+        addr = 0;
+    } else if (accept(&in, "addr")) {
+        if (!accept_addr(&in, ctx_addr_type(ctx), 1, &addr)) {
+            errf("pointerscan: evaluating address value failed");
+            return 3;
+        }
+    } else {
+        intmax_t index0, index;
+        if (!accept_sint(&in, 1, &index0)) {
+            errf("pointerscan: evaluating hit index failed");
+            return 4;
+        }
+        if (!ctx->hits || !ctx->hits->size) {
+            errf("pointerscan: bad index %" PRIdMAX " (0 hits)", index0);
+            return 5;
+        }
+        index = (index0 < 0) ? index0 + ctx->hits->size : index0 - 1;
+        if (!(0 <= index && index < ctx->hits->size)) {
+            errf("pointerscan: bad index %" PRIdMAX " not in 1..%lu",
+                 index0, (unsigned long)ctx->hits->size);
+            return 6;
+        }
+        addr = hits_addr(ctx->hits, index);
+    }
+
+    if (!rebuild && !eol(in)) {
+        if (!accept_sint(&in, 1, &depth)) {
+            errf("pointerscan: evaluating depth failed");
+            return 7;
+        }
+        if (!eol(in) && !accept_addr(&in, ctx_addr_type(ctx), 1, &offset)) {
+            errf("pointerscan: evaluating offset failed");
+            return 8;
+        }
+    }
+    if (!eol(in)) {
+        errf("pointerscan: trailing characters");
+        return 9;
+    }
+    if (depth < 1 || depth > POINTER_DEPTH_MAX) {
+        errf("pointerscan: bad depth %" PRIdMAX " not in 1..%d",
+             depth, POINTER_DEPTH_MAX);
+        return 10;
+    }
+
+    if (rebuild || !ctx->pointers) {
+        struct pointer_map *map;
+        ramfuck_set_pointer_map(ctx, NULL);
+        if (!(map = pointer_map_new(ctx)))
+            return 11;
+        ramfuck_set_pointer_map(ctx, map);
+        human_readable_size(map->bytes, &size, &suffix);
+        infof("pointerscan: %lu pointers in %d%c of %lu regions",
+              (unsigned long)map->pointers_size, size, suffix,
+              (unsigned long)map->regions_size);
+        if (rebuild)
+            return 0;
+    }
+
+    out.ctx = ctx;
+    out.chains = 0;
+    if (!pointer_map_scan(ctx->pointers, addr, depth, offset,
+                          pointerscan_print, &out))
+        return 12;
+    if (!out.chains)
+        infof("pointerscan: no pointer chains to 0x%08" PRIaddr, addr);
+    return 0;
+}
+
 /*
  * Poke value.
  * Usage: poke <type> <addr> <value>
  *        poke <hit_index> <value>
+ *        poke all <value>
+ *        poke <first>..<last> <value>
  */
 static int do_poke(struct ramfuck *ctx, const char *in)
 {
@@ -850,8 +1329,9 @@ static int do_poke(struct ramfuck *ctx, const char *in)
     struct symbol_table *symtab;
     struct parser parser;
     struct ast *ast, *cast;
+    struct vm_program *prog;
     struct value value, out;
-    size_t size;
+    size_t size, first, last;
     int ok;
 
     if (eol(in)) {
@@ -864,6 +1344,39 @@ static int do_poke(struct ramfuck *ctx, const char *in)
         return 2;
     }
 
+    /* Poke many hits evaluating the value as in filter */
+    size = ctx->hits ? ctx->hits->size : 0;
+    if (accept(&in, "all")) {
+        first = 0;
+        last = size;
+        ok = 1;
+    } else ok = accept_range(&in, size, &first, &last);
+    if (ok) {
+        size_t written;
+        if (ok == -1) {
+            errf("poke: bad range of hit indices (%lu hits)",
+                 (unsigned long)size);
+            return 7;
+        }
+        if (!size) {
+            infof("poke: zero hits");
+            return 6;
+        }
+        if (eol(in)) {
+            errf("poke: value expression expected after hits");
+            return 8;
+        }
+        if (!poke_hits(ctx, ctx->hits, first, last, in, &written))
+            return 13;
+        if (written < last - first) {
+            errf("poke: wrote %lu of %lu values", (unsigned long)written,
+                 (unsigned long)(last - first));
+            return 14;
+        }
+        infof("poke: wrote %lu values", (unsigned long)written);
+        return 0;
+    }
+
     if ((type = accept_type(&in))) {
         if (eol(in)) {
             errf("poke: address expected after type");
@@ -890,8 +1403,8 @@ static int do_poke(struct ramfuck *ctx, const char *in)
                  index0, (unsigned long)ctx->hits->size);
             return 7;
         }
-        addr = ctx->hits->items[index].addr;
-        type = ctx->hits->items[index].type;
+        addr = hits_addr(ctx->hits, index);
+        type = hits_type(ctx->hits, index);
     }
 
     if (eol(in)) {
@@ -948,9 +1461,13 @@ static int do_poke(struct ramfuck *ctx, const char *in)
     }
     ast = cast;
 
-    if (parser.has_deref) ramfuck_break(ctx);
-    ok = ast_evaluate(ast, &out);
-    if (parser.has_deref) ramfuck_continue(ctx);
+    ok = 0;
+    if ((prog = vm_compile(ast))) {
+        if (parser.has_deref) ramfuck_break(ctx);
+        ok = vm_execute(prog, &out);
+        if (parser.has_deref) ramfuck_continue(ctx);
+        vm_program_delete(prog);
+    }
     if (symtab) symbol_table_delete(symtab);
     ast_delete(ast);
     if (!ok) {
@@ -992,6 +1509,8 @@ static int do_quit(struct ramfuck *ctx, const char *in) {
                 warnf("quit: continuing execution of target");
             ctx->breaks = 0;
         }
+        ramfuck_set_watch(ctx, NULL);
+        ramfuck_set_freezer(ctx, NULL);
         target_detach(ctx->target);
         ctx->target = NULL;
     }
@@ -1115,15 +1634,41 @@ static int do_redo(struct ramfuck *ctx, const char *in)
     return 0;
 }
 
+/*
+ * Save hits to a file.
+ * Usage: save <path>
+ */
+static int do_save(struct ramfuck *ctx, const char *in)
+{
+    if (eol(in)) {
+        errf("save: missing path");
+        return 1;
+    }
+
+    if (!ctx->hits) {
+        errf("save: no hits");
+        return 2;
+    }
+
+    if (!hits_save(ctx->hits, in)) {
+        errf("save: saving hits to %s failed", in);
+        return 3;
+    }
+    return 0;
+}
+
 /*
  * Initial search.
  * Usage: search <expression>
- *        search <type> <expression>
- * where 'type' is one of: s8, u8, s16, u16, s32, u32, s64, u64, f32, f64.
+ *        search <type>[,<type>...] <expression>
+ *        search any <expression>
+ *        search bytes <pattern>
+ * where 'type' is one of: s8, u8, s16, u16, s32, u32, s64, u64, f32, f64,
+ * 'any' searches s8, s16, s32, s64, f32 and f64 in one pass and 'pattern'
+ * is hex bytes with '?' wildcard nibbles (e.g., 48 8b ?? ?? 8?).
  */
 static int do_search(struct ramfuck *ctx, const char *in)
 {
-    enum value_type type;
     struct hits *hits;
 
     if (eol(in)) {
@@ -1136,14 +1681,97 @@ static int do_search(struct ramfuck *ctx, const char *in)
         return 2;
     }
 
+    if (accept(&in, "bytes")) {
+        hits = search_bytes(ctx, in);
+    } else {
+        enum value_type types[SEARCH_TYPES_MAX];
+        size_t types_size;
+        if (!(types_size = accept_types(&in, types))) {
+            types[0] = S32;
+            types_size = 1;
+        }
+        hits = search_types(ctx, types, types_size, in);
+    }
+    if (!hits)
+        return 3;
+
+    ramfuck_set_snapshot(ctx, NULL);
+    ramfuck_set_hits(ctx, hits);
+    return 0;
+}
+
+/*
+ * Repeat the last search reading only pages written since (target.dirty).
+ * Usage: rescan
+ */
+static int do_rescan(struct ramfuck *ctx, const char *in)
+{
+    struct hits *hits;
+
+    if (!eol(in)) {
+        errf("rescan: trailing characters");
+        return 1;
+    }
+
+    if (!ctx->target) {
+        errf("rescan: attach to target first");
+        return 2;
+    }
+
+    if (!(hits = rescan(ctx)))
+        return 3;
+
+    ramfuck_set_snapshot(ctx, NULL);
+    ramfuck_set_hits(ctx, hits);
+    return 0;
+}
+
+/*
+ * Snapshot target memory for filtering values with unknown initial value.
+ * Usage: snapshot [type]
+ */
+static int do_snapshot(struct ramfuck *ctx, const char *in)
+{
+    enum value_type type;
+    struct snapshot *snapshot;
+    int size;
+    char suffix;
+
+    if (!ctx->target) {
+        errf("snapshot: attach to target first");
+        return 1;
+    }
+
     if (!(type = accept_type(&in)))
         type = S32;
+    if (!eol(in)) {
+        errf("snapshot: trailing characters");
+        return 2;
+    }
 
-    hits = search(ctx, type, in);
-    if (!hits)
+    if (!(snapshot = snapshot_new(ctx, type)))
         return 3;
 
-    ramfuck_set_hits(ctx, hits);
+    ramfuck_set_snapshot(ctx, snapshot);
+    ramfuck_set_hits(ctx, NULL);
+    human_readable_size(snapshot->bytes, &size, &suffix);
+    infof("snapshot: %d%c in %lu spans (filter to compare against it)",
+          size, suffix, (unsigned long)snapshot->spans_size);
+    return 0;
+}
+
+/*
+ * Show statistics of the last search or filter ("raw" for key-value lines).
+ * Usage: stats [raw]
+ */
+static int do_stats(struct ramfuck *ctx, const char *in)
+{
+    int raw = accept(&in, "raw");
+    if (!eol(in)) {
+        errf("stats: trailing characters");
+        return 1;
+    }
+    stats_print(ctx->stats, raw, stdout);
     return 0;
 }
 
@@ -1185,6 +1813,103 @@ static int do_undo(struct ramfuck *ctx, const char *in)
     return 0;
 }
 
+/*
+ * Sample hits in the background without stopping the target.
+ * Usage: watch
+ *        watch <expression> [interval]
+ *        watch list
+ *        watch filter <expression>
+ *        watch stop
+ *
+ * The expression (of addr, value and prev, the previous sample) is counted
+ * for every sample; parenthesize it to give an interval in milliseconds.
+ * Watch filter expressions use samples, changes and matches of the hits.
+ */
+static int do_watch(struct ramfuck *ctx, const char *in)
+{
+    const char *start, *end, *p;
+    struct watch *watch;
+    unsigned long interval;
+    struct hits *hits;
+    char *expression;
+    int all = 0;
+
+    if (eol(in) || (all = accept(&in, "list"))) {
+        if (!eol(in)) {
+            errf("watch: trailing characters");
+            return 1;
+        }
+        if (!ctx->watch) {
+            infof("watch: not watching");
+            return 0;
+        }
+        watch_print(ctx->watch, all, stdout);
+        return 0;
+    }
+    if (accept(&in, "stop")) {
+        if (!eol(in)) {
+            errf("watch: trailing characters");
+            return 1;
+        }
+        ramfuck_set_watch(ctx, NULL);
+        return 0;
+    }
+    if (accept(&in, "filter")) {
+        if (eol(in)) {
+            errf("watch: filter expression expected");
+            return 1;
+        }
+        if (!ctx->watch) {
+            errf("watch: not watching");
+            return 2;
+        }
+        if (!(hits = watch_filter(ctx->watch, in)))
+            return 3;
+        ramfuck_set_hits(ctx, hits);
+        return 0;
+    }
+
+    if (!ctx->target) {
+        errf("watch: attach to target first");
+        return 2;
+    }
+    if (!ctx->hits || !ctx->hits->size) {
+        infof("watch: zero hits");
+        return 2;
+    }
+
+    /* Expression item followed by an interval, or the whole input */
+    interval = WATCH_INTERVAL;
+    p = in;
+    if (eat_item(&p, &start, &end) && !eol(p) && isdigit(*p)) {
+        char *last;
+        errno = 0;
+        interval = strtoul(p, &last, 10);
+        if (errno || !interval || !eol(last)) {
+            interval = WATCH_INTERVAL;
+            end = in + strlen(in);
+            start = in;
+        }
+    } else {
+        start = in;
+        end = in + strlen(in);
+    }
+    if (!(expression = malloc(end - start + 1))) {
+        errf("watch: out-of-memory for expression");
+        return 3;
+    }
+    memcpy(expression, start, end - start);
+    expression[end - start] = '\0';
+
+    ramfuck_set_watch(ctx, NULL);
+    watch = watch_start(ctx, ctx->hits, expression, interval);
+    free(expression);
+    if (!watch)
+        return 3;
+    ramfuck_set_watch(ctx, watch);
+    return 0;
+}
+
 /*
  * Write memory from a file (or stdin if path is -) to target memory.
  * Usage: write <addr> <len> <path>
@@ -1307,14 +2032,22 @@ int cli_execute_line(struct ramfuck *ctx, const char *in)
         rc = do_explain(ctx, in);
     } else if (accept(&in, "filter") || accept(&in, "next")) {
         rc = do_filter(ctx, in);
+    } else if (accept(&in, "freeze")) {
+        rc = do_freeze(ctx, in);
+    } else if (accept(&in, "group")) {
+        rc = do_group(ctx, in);
     } else if (accept(&in, "ls") || accept(&in, "list")) {
         rc = do_list(ctx, in);
+    } else if (accept(&in, "load")) {
+        rc = do_load(ctx, in);
     } else if (accept(&in, "m") || accept(&in, "maps") || accept(&in, "mem")) {
         rc = do_maps(ctx, in);
     } else if (accept(&in, "or")) {
         rc = ctx->rc ? cli_execute_line(ctx, in) : ctx->rc;
     } else if (accept(&in, "peek")) {
         rc = do_peek(ctx, in);
+    } else if (accept(&in, "pointerscan")) {
+        rc = do_pointerscan(ctx, in);
     } else if (accept(&in, "poke")) {
         rc = do_poke(ctx, in);
     } else if (accept(&in, "quit") || accept(&in, "q") || accept(&in, "exit")) {
@@ -1323,14 +2056,24 @@ int cli_execute_line(struct ramfuck *ctx, const char *in)
         rc = do_read(ctx, in);
     } else if (accept(&in, "redo")) {
         rc = do_redo(ctx, in);
+    } else if (accept(&in, "rescan")) {
+        rc = do_rescan(ctx, in);
+    } else if (accept(&in, "save")) {
+        rc = do_save(ctx, in);
     } else if (accept(&in, "search")) {
         rc = do_search(ctx, in);
+    } else if (accept(&in, "snapshot")) {
+        rc = do_snapshot(ctx, in);
+    } else if (accept(&in, "stats")) {
+        rc = do_stats(ctx, in);
 #ifndef NO_FLOAT_VALUES
     } else if (accept(&in, "time")) {
         rc = do_time(ctx, in);
 #endif
     } else if (accept(&in, "undo")) {
         rc = do_undo(ctx, in);
+    } else if (accept(&in, "watch")) {
+        rc = do_watch(ctx, in);
     } else if (accept(&in, "write")) {
         rc = do_write(ctx, in);
     } else if (!eol(in) && (rc = do_eval(ctx, in)) == 1) {
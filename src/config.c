@@ -1,4 +1,6 @@
 #include "config.h"
+#include "freeze.h"
+#include "hits.h"
 #include "ramfuck.h"
 
 #include <ctype.h>
@@ -31,8 +33,17 @@ struct config *config_new()
         cfg->block.size = 256;
         cfg->cli.base = 10;
         cfg->cli.quiet = 0;
+        cfg->freeze.rate = 100;
+        cfg->history.size = 256 * 1024 * 1024;
+        cfg->hits.memory = HITS_MEMORY_DEFAULT;
+        hits_set_memory(cfg->hits.memory);
+        cfg->read.gap = 4096;
         cfg->search.align = 0;
         cfg->search.prot = 6; /* MEM_READ | MEM_WRITE */
+        cfg->search.threads = 1;
+        cfg->search.chunk = 1024 * 1024;
+        cfg->target.stop = 0;
+        cfg->target.dirty = 0;
     }
     return cfg;
 }
@@ -51,8 +62,16 @@ int config_process_line(struct config *cfg, const char *in)
         config_process_line(cfg, "block.size");
         config_process_line(cfg, "cli.base");
         fprintf(stdout, "cli.quiet = %d\n", quiet);
+        config_process_line(cfg, "freeze.rate");
+        config_process_line(cfg, "history.size");
+        config_process_line(cfg, "hits.memory");
+        config_process_line(cfg, "read.gap");
         config_process_line(cfg, "search.align");
         config_process_line(cfg, "search.prot");
+        config_process_line(cfg, "search.threads");
+        config_process_line(cfg, "search.chunk");
+        config_process_line(cfg, "target.stop");
+        config_process_line(cfg, "target.dirty");
         if (quiet)
             cfg->cli.quiet = 1;
         return 1;
@@ -107,6 +126,71 @@ int config_process_line(struct config *cfg, const char *in)
         if (!cfg->cli.quiet)
             fputs("cli.quiet = ", stdout);
         fprintf(stdout, "%d", cfg->cli.quiet);
+    } else if (accept(&in, "freeze.rate")) {
+        if (!eol(in)) {
+            char *end;
+            long value = strtol(in, &end, 0);
+            while (isspace(*end)) end++;
+            if (*end || value <= 0 || value > FREEZE_RATE_MAX) {
+                errf("config: bad freeze.rate value");
+                return 0;
+            }
+            cfg->freeze.rate = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("freeze.rate = ", stdout);
+        fprintf(stdout, "%lu", cfg->freeze.rate);
+    } else if (accept(&in, "history.size")) {
+        if (!eol(in)) {
+            char *end;
+            long value = strtol(in, &end, 0);
+            while (isspace(*end)) end++;
+            if (*end || value < 0) {
+                errf("config: bad history.size value");
+                return 0;
+            }
+            cfg->history.size = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("history.size = ", stdout);
+        fprintf(stdout, "%lu", cfg->history.size);
+    } else if (accept(&in, "hits.memory")) {
+        if (!eol(in)) {
+            char *end;
+            long value = strtol(in, &end, 0);
+            while (isspace(*end)) end++;
+            if (*end || value < 0) {
+                errf("config: bad hits.memory value");
+                return 0;
+            }
+            cfg->hits.memory = value;
+            hits_set_memory(cfg->hits.memory);
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("hits.memory = ", stdout);
+        fprintf(stdout, "%lu", cfg->hits.memory);
+    } else if (accept(&in, "read.gap")) {
+        if (!eol(in)) {
+            char *end;
+            long value = strtol(in, &end, 0);
+            while (isspace(*end)) end++;
+            if (*end || value < 0) {
+                errf("config: bad read.gap value");
+                return 0;
+            }
+            cfg->read.gap = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("read.gap = ", stdout);
+        fprintf(stdout, "%lu", cfg->read.gap);
     } else if (accept(&in, "search.align")) {
         if (!eol(in)) {
             char *end;
@@ -139,6 +223,71 @@ int config_process_line(struct config *cfg, const char *in)
         if (!cfg->cli.quiet)
             fputs("search.prot = ", stdout);
         fprintf(stdout, "%u", cfg->search.prot);
+    } else if (accept(&in, "search.threads")) {
+        if (!eol(in)) {
+            char *end;
+            unsigned long value = strtoul(in, &end, 10);
+            while (isspace(*end)) end++;
+            if (*end || value > 1024) {
+                errf("config: bad search.threads value");
+                return 0;
+            }
+            cfg->search.threads = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("search.threads = ", stdout);
+        fprintf(stdout, "%u", cfg->search.threads);
+    } else if (accept(&in, "search.chunk")) {
+        if (!eol(in)) {
+            char *end;
+            long value = strtol(in, &end, 0);
+            while (isspace(*end)) end++;
+            if (*end || value < 4096) {
+                errf("config: bad search.chunk value");
+                return 0;
+            }
+            cfg->search.chunk = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("search.chunk = ", stdout);
+        fprintf(stdout, "%lu", cfg->search.chunk);
+    } else if (accept(&in, "target.stop")) {
+        if (!eol(in)) {
+            char *end;
+            unsigned long value = strtoul(in, &end, 10);
+            while (isspace(*end)) end++;
+            if (*end || value > 2) {
+                errf("config: bad target.stop value");
+                return 0;
+            }
+            cfg->target.stop = value;
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("target.stop = ", stdout);
+        fprintf(stdout, "%u", cfg->target.stop);
+    } else if (accept(&in, "target.dirty")) {
+        if (!eol(in)) {
+            int dirty = accept(&in, "1");
+            if (!dirty && accept(&in, "0") && eol(in)) {
+                cfg->target.dirty = 0;
+            } else if (dirty && eol(in)) {
+                cfg->target.dirty = 1;
+            } else {
+                errf("config: bad target.dirty value");
+                return 0;
+            }
+            if (cfg->cli.quiet)
+                return 1;
+        }
+        if (!cfg->cli.quiet)
+            fputs("target.dirty = ", stdout);
+        fprintf(stdout, "%d", cfg->target.dirty);
     } else {
         size_t i;
         for (i = 0; in[i] && in[i] != '=' && !isspace(in[i]); i++);
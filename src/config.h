@@ -25,6 +25,38 @@ struct config {
         int quiet;
     } cli;
 
+    struct {
+        /*
+         * Rate of re-writing frozen values (ticks per second).
+         */
+        unsigned long rate;
+    } freeze;
+
+    struct {
+        /*
+         * Memory budget of the undo/redo history (in bytes).
+         */
+        unsigned long size;
+    } history;
+
+    struct {
+        /*
+         * Memory budget shared by all hits containers (in bytes), including
+         * those of search workers and history, before the arrays of growing
+         * containers are spilled to temporary files in $TMPDIR (0 never
+         * spills).
+         */
+        unsigned long memory;
+    } hits;
+
+    struct {
+        /*
+         * Maximum gap (in bytes) between values that are fetched with a
+         * single read when reading many hits (0 disables coalescing).
+         */
+        unsigned long gap;
+    } read;
+
     struct {
         /*
          * Alignment to use when searching a value.
@@ -40,7 +72,37 @@ struct config {
          * 4 -> READ
          */
         unsigned int prot;
+
+        /*
+         * Number of threads scanning memory regions.
+         * 0 -> number of online processors
+         * n -> n threads
+         */
+        unsigned int threads;
+
+        /*
+         * Size of the chunks regions are read and scanned in (in bytes).
+         */
+        unsigned long chunk;
     } search;
+
+    struct {
+        /*
+         * How the target is stopped while accessing its memory.
+         * 0 -> attach on break, detach on continue
+         * 1 -> stay attached and stop with signals (session)
+         * 2 -> do not stop the target at all (reads may be torn)
+         */
+        unsigned int stop;
+
+        /*
+         * Track pages written since search and snapshot (soft-dirty bits) so
+         * that rescan and snapshot filters read only the modified pages.
+         * 0 -> disabled
+         * 1 -> enabled
+         */
+        int dirty;
+    } target;
 };
 
 /* Allocate a new config with default settings */
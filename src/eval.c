@@ -262,8 +262,8 @@ int (*ast_evaluate_funcs[AST_TYPES])(struct ast *, struct value *) = {
     /* AST_MOD */ ast_mod_evaluate,
 
     /* AST_AND */ ast_and_evaluate,
-    /* AST_OR  */ ast_or_evaluate,
     /* AST_XOR */ ast_xor_evaluate,
+    /* AST_OR  */ ast_or_evaluate,
     /* AST_SHL */ ast_shl_evaluate,
     /* AST_SHR */ ast_shr_evaluate,
 
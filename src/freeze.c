@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE /* for clock_gettime(2) */
+#include "freeze.h"
+
+#include "ast.h"
+#include "config.h"
+#include "eval.h"
+#include "opt.h"
+#include "parse.h"
+#include "stats.h"
+#include "symbol.h"
+#include "target.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void freeze_value_delete(struct freeze_value *fv)
+{
+    if (fv->prog) vm_program_delete(fv->prog);
+    if (fv->ast) ast_delete(fv->ast);
+    if (fv->symtab) symbol_table_delete(fv->symtab);
+    free(fv->expression);
+    free(fv);
+}
+
+static struct freeze_value *freeze_value_new(struct ramfuck *ctx, addr_t addr,
+                                             enum value_type type,
+                                             const char *expression)
+{
+    struct freeze_value *fv;
+    struct parser parser;
+    struct ast *cast, *opt;
+    enum value_type addr_type, value_type;
+    size_t len = strlen(expression) + 1;
+
+    if (!(fv = calloc(1, sizeof(struct freeze_value)))
+            || !(fv->expression = malloc(len))) {
+        errf("freeze: out-of-memory for frozen value");
+        free(fv);
+        return NULL;
+    }
+    memcpy(fv->expression, expression, len);
+
+#if ADDR_BITS == 64
+    addr_type = (ctx->addr_size == sizeof(uint64_t)) ? U64 : U32;
+    if (addr_type == U64) {
+        fv->addr_data.u64 = addr;
+    } else fv->addr_data.u32 = (uint32_t)addr;
+#else
+    addr_type = U32;
+    fv->addr_data.u32 = addr;
+#endif
+    value_type = (type & PTR) ? addr_type : type;
+    fv->addr = addr;
+    fv->type = type;
+    fv->size = value_type_sizeof(value_type);
+    fv->value.type = value_type;
+
+    if (!(fv->symtab = symbol_table_new(ctx))) {
+        errf("freeze: error creating new symbol table");
+        goto fail;
+    }
+    symbol_table_add(fv->symtab, "addr", addr_type, &fv->addr_data);
+
+    parser_init(&parser);
+    parser.symtab = fv->symtab;
+    parser.addr_type = addr_type;
+    parser.target = ctx->target;
+    if (!(fv->ast = parse_expression(&parser, expression))) {
+        errf("freeze: %d parse errors", parser.errors);
+        goto fail;
+    }
+    if (!(cast = ast_cast_new(value_type, fv->ast))) {
+        errf("freeze: out-of-memory for typecast AST");
+        goto fail;
+    }
+    fv->ast = cast;
+    if ((opt = ast_optimize(fv->ast))) {
+        ast_delete(fv->ast);
+        fv->ast = opt;
+    }
+
+    /* Constant values are evaluated once, others on every tick */
+    if (ast_is_constant(fv->ast)) {
+        if (!ast_evaluate(fv->ast, &fv->value)) {
+            errf("freeze: evaluating value expression failed");
+            goto fail;
+        }
+    } else if (!(fv->prog = vm_compile(fv->ast))) {
+        errf("freeze: error compiling expression");
+        goto fail;
+    } else if (!vm_execute(fv->prog, &fv->value)) {
+        errf("freeze: evaluating value expression failed");
+        goto fail;
+    }
+    return fv;
+
+fail:
+    freeze_value_delete(fv);
+    return NULL;
+}
+
+/*
+ * Write every frozen value once.
+ */
+static void freezer_tick(struct freezer *freezer)
+{
+    struct target *target = freezer->ctx->target;
+    size_t i, j, n;
+
+    for (i = n = 0; i < freezer->size; i++) {
+        struct freeze_value *fv = freezer->values[i];
+        if (fv->prog && !vm_execute(fv->prog, &fv->value)) {
+            fv->failed++;
+            continue;
+        }
+        freezer->writes[n].addr = fv->addr;
+        freezer->writes[n].buf = &fv->value.data;
+        freezer->writes[n].len = fv->size;
+        freezer->writes[n].ok = 0;
+        n++;
+    }
+    if (n && !target->write_batch(target, freezer->writes, n)) {
+        /* Writes are in the order of the values */
+        for (i = j = 0; i < freezer->size && j < n; i++) {
+            struct freeze_value *fv = freezer->values[i];
+            if (freezer->writes[j].buf != &fv->value.data)
+                continue;
+            if (!freezer->writes[j++].ok)
+                fv->failed++;
+        }
+    }
+}
+
+static void *freezer_run(void *arg)
+{
+    struct freezer *freezer = (struct freezer *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&freezer->lock);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    while (!freezer->quit) {
+        struct timespec now;
+        unsigned long rate;
+        long period;
+        double start;
+
+        if (!freezer->size) {
+            pthread_cond_wait(&freezer->cond, &freezer->lock);
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            continue;
+        }
+
+        start = stats_now();
+        freezer_tick(freezer);
+        freezer->elapsed += stats_now() - start;
+        freezer->ticks++;
+
+        /* Next tick on a fixed schedule (restarted if fallen behind) */
+        if (!(rate = freezer->ctx->config->freeze.rate))
+            rate = 1;
+        if (rate > FREEZE_RATE_MAX)
+            rate = FREEZE_RATE_MAX;
+        period = 1000000000L / (long)rate;
+        deadline.tv_nsec += period;
+        while (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec
+                                             && now.tv_nsec > deadline.tv_nsec))
+            deadline = now;
+        while (!freezer->quit && pthread_cond_timedwait(&freezer->cond,
+                                                        &freezer->lock,
+                                                        &deadline)
+                                 != ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&freezer->lock);
+    return NULL;
+}
+
+struct freezer *freezer_new(struct ramfuck *ctx)
+{
+    struct freezer *freezer;
+    if (!(freezer = calloc(1, sizeof(struct freezer)))) {
+        errf("freeze: out-of-memory for freezer");
+        return NULL;
+    }
+    freezer->ctx = ctx;
+    pthread_mutex_init(&freezer->lock, NULL);
+    pthread_cond_init(&freezer->cond, NULL);
+    if (pthread_create(&freezer->thread, NULL, freezer_run, freezer)) {
+        errf("freeze: error starting scheduler thread");
+        pthread_cond_destroy(&freezer->cond);
+        pthread_mutex_destroy(&freezer->lock);
+        free(freezer);
+        return NULL;
+    }
+    return freezer;
+}
+
+void freezer_delete(struct freezer *freezer)
+{
+    pthread_mutex_lock(&freezer->lock);
+    freezer->quit = 1;
+    pthread_cond_broadcast(&freezer->cond);
+    pthread_mutex_unlock(&freezer->lock);
+    pthread_join(freezer->thread, NULL);
+    pthread_cond_destroy(&freezer->cond);
+    pthread_mutex_destroy(&freezer->lock);
+
+    while (freezer->size)
+        freeze_value_delete(freezer->values[--freezer->size]);
+    free(freezer->writes);
+    free(freezer->values);
+    free(freezer);
+}
+
+int freezer_add(struct freezer *freezer, addr_t addr, enum value_type type,
+                const char *expression)
+{
+    struct freeze_value *fv;
+    size_t i;
+
+    if (!(fv = freeze_value_new(freezer->ctx, addr, type, expression)))
+        return 0;
+
+    pthread_mutex_lock(&freezer->lock);
+    for (i = 0; i < freezer->size && freezer->values[i]->addr != addr; i++);
+    if (i < freezer->size) {
+        freeze_value_delete(freezer->values[i]);
+        freezer->values[i] = fv;
+    } else {
+        if (freezer->size == freezer->capacity) {
+            size_t capacity = freezer->capacity ? 2 * freezer->capacity : 16;
+            struct freeze_value **values;
+            struct target_read *writes;
+            if (!(values = realloc(freezer->values,
+                                   capacity * sizeof(struct freeze_value *)))) {
+                pthread_mutex_unlock(&freezer->lock);
+                errf("freeze: out-of-memory for frozen values");
+                freeze_value_delete(fv);
+                return 0;
+            }
+            freezer->values = values;
+            if (!(writes = realloc(freezer->writes,
+                                   capacity * sizeof(struct target_read)))) {
+                pthread_mutex_unlock(&freezer->lock);
+                errf("freeze: out-of-memory for frozen values");
+                freeze_value_delete(fv);
+                return 0;
+            }
+            freezer->writes = writes;
+            freezer->capacity = capacity;
+        }
+        freezer->values[freezer->size++] = fv;
+    }
+    pthread_cond_broadcast(&freezer->cond);
+    pthread_mutex_unlock(&freezer->lock);
+    return 1;
+}
+
+int freezer_remove(struct freezer *freezer, size_t i)
+{
+    pthread_mutex_lock(&freezer->lock);
+    if (i >= freezer->size) {
+        pthread_mutex_unlock(&freezer->lock);
+        return 0;
+    }
+    freeze_value_delete(freezer->values[i]);
+    memmove(&freezer->values[i], &freezer->values[i + 1],
+            (freezer->size - i - 1) * sizeof(struct freeze_value *));
+    freezer->size--;
+    pthread_mutex_unlock(&freezer->lock);
+    return 1;
+}
+
+void freezer_clear(struct freezer *freezer)
+{
+    pthread_mutex_lock(&freezer->lock);
+    while (freezer->size)
+        freeze_value_delete(freezer->values[--freezer->size]);
+    pthread_mutex_unlock(&freezer->lock);
+}
+
+void freezer_print(struct freezer *freezer, FILE *out)
+{
+    size_t (*to_string)(const struct value *, char *, size_t)
+        = (freezer->ctx->config->cli.base == 16) ? value_to_hexstring
+                                                 : value_to_string;
+    size_t i;
+
+    pthread_mutex_lock(&freezer->lock);
+    for (i = 0; i < freezer->size; i++) {
+        const struct freeze_value *fv = freezer->values[i];
+        char buf[64];
+        to_string(&fv->value, buf, sizeof(buf));
+        fprintf(out, "%lu. *(%s *)0x%08" PRIaddr " = %s (%s)",
+                (unsigned long)i+1, value_type_to_string(fv->type), fv->addr,
+                buf, fv->expression);
+        if (fv->failed)
+            fprintf(out, ", %lu failed writes", fv->failed);
+        fputc('\n', out);
+    }
+    if (freezer->ticks) {
+        fprintf(out, "%lu ticks (%.3fms per tick)\n", freezer->ticks,
+                freezer->elapsed * 1000 / freezer->ticks);
+    }
+    pthread_mutex_unlock(&freezer->lock);
+}
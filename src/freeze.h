@@ -0,0 +1,84 @@
+/*
+ * Frozen values.
+ *
+ * A freezer holds values fixed by re-writing them at freeze.rate ticks per
+ * second on a scheduler thread. Expressions are compiled once (constant ones
+ * are evaluated once) and every tick writes all values with a single
+ * write_batch() (process_vm_writev(2) for processes) without stopping the
+ * target.
+ */
+
+#ifndef FREEZE_H_INCLUDED
+#define FREEZE_H_INCLUDED
+
+#include "defines.h"
+#include "ramfuck.h"
+#include "value.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Maximum freeze.rate (ticks per second) */
+#define FREEZE_RATE_MAX 1000000
+
+struct freeze_value {
+    addr_t addr;
+    union value_data addr_data; /* addr of the address type for `addr` */
+    enum value_type type;
+    size_t size;
+    char *expression;
+    struct symbol_table *symtab;
+    struct ast *ast;
+    struct vm_program *prog; /* NULL if the expression is constant */
+    struct value value;      /* value written on the last tick */
+    unsigned long failed;    /* failed writes */
+};
+
+struct freezer {
+    struct ramfuck *ctx;
+    struct freeze_value **values;
+    size_t size, capacity;
+    struct target_read *writes;
+    unsigned long ticks;
+    double elapsed; /* seconds spent writing */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int quit;
+};
+
+/*
+ * Create a freezer and start its scheduler thread. Returns NULL on error.
+ */
+struct freezer *freezer_new(struct ramfuck *ctx);
+
+/*
+ * Stop the scheduler thread and delete the freezer.
+ */
+void freezer_delete(struct freezer *freezer);
+
+/*
+ * Freeze the value of `type` at `addr` to `expression` (of symbol addr),
+ * replacing an earlier freeze of the address. Returns zero on error.
+ */
+int freezer_add(struct freezer *freezer, addr_t addr, enum value_type type,
+                const char *expression);
+
+/*
+ * Unfreeze the i'th value. Returns zero if there is no such value.
+ */
+int freezer_remove(struct freezer *freezer, size_t i);
+
+/*
+ * Unfreeze all values.
+ */
+void freezer_clear(struct freezer *freezer);
+
+/*
+ * Print the frozen values.
+ */
+void freezer_print(struct freezer *freezer, FILE *out);
+
+#endif
@@ -0,0 +1,808 @@
+#define _DEFAULT_SOURCE /* for readlink(2) and realpath(3) */
+#include "group.h"
+
+#include "value.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if ADDR_BITS == 64
+
+struct target_group {
+    struct target base;
+    struct target **members;
+    unsigned long *pids;
+    int *stopped;
+    size_t size;
+};
+
+struct group_region_iter {
+    struct region region;
+    struct target_group *group;
+    size_t member;
+    struct region *it; /* region iterator of the member */
+};
+
+/*
+ * Member of `addr` or NULL if there is no such member.
+ */
+static struct target *group_target(struct target_group *group, addr_t addr)
+{
+    size_t i = group_index(addr);
+    return (i < group->size) ? group->members[i] : NULL;
+}
+
+static int group_detach(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    for (i = 0; i < group->size; i++)
+        target_detach(group->members[i]);
+    free(group->stopped);
+    free(group->pids);
+    free(group->members);
+    free(group);
+    return 1;
+}
+
+static int group_run(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (!member->run(member))
+            rc = 0;
+    }
+    return rc;
+}
+
+static int group_stop(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    if (target_stop_all(group->members, group->size, group->stopped))
+        return 1;
+
+    /* All or nothing: resume the members that did stop */
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (group->stopped[i])
+            member->run(member);
+    }
+    return 0;
+}
+
+static int group_stop_mode(struct target *target, enum target_stop mode)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (!member->stop_mode(member, mode))
+            rc = 0;
+    }
+    return rc;
+}
+
+static struct region *group_region_next(struct region *it)
+{
+    struct group_region_iter *iter = (struct group_region_iter *)it;
+    if (iter) {
+        struct target_group *group = iter->group;
+        while (iter->member < group->size) {
+            struct target *member = group->members[iter->member];
+            struct region *mr;
+            mr = iter->it ? member->region_next(iter->it)
+                          : member->region_first(member);
+            if (!(iter->it = mr)) {
+                iter->member++;
+                continue;
+            }
+            /* Regions beyond the member address bits (e.g., vsyscall) */
+            if (group_member_addr(mr->start + (mr->size - 1))
+                    != mr->start + (mr->size - 1))
+                continue;
+            memcpy(&iter->region, mr, sizeof(struct region));
+            iter->region.start |= (addr_t)iter->member << GROUP_SHIFT;
+            return &iter->region;
+        }
+        free(iter);
+    }
+    return NULL;
+}
+
+static struct region *group_region_first(struct target *target)
+{
+    struct group_region_iter *it;
+    if (!(it = malloc(sizeof(struct group_region_iter)))) {
+        errf("target: out-of-memory for region iterator");
+        return NULL;
+    }
+    it->group = (struct target_group *)target;
+    it->member = 0;
+    it->it = NULL;
+    return group_region_next((struct region *)it);
+}
+
+static int group_read(struct target *target, addr_t addr, void *buf,
+                      size_t len)
+{
+    struct target *member;
+    if (!(member = group_target((struct target_group *)target, addr)))
+        return 0;
+    return member->read(member, group_member_addr(addr), buf, len);
+}
+
+static int group_write(struct target *target, addr_t addr, void *buf,
+                       size_t len)
+{
+    struct target *member;
+    if (!(member = group_target((struct target_group *)target, addr)))
+        return 0;
+    return member->write(member, group_member_addr(addr), buf, len);
+}
+
+static size_t group_read_prefix(struct target *target, addr_t addr,
+                                void *buf, size_t len)
+{
+    struct target *member;
+    if (!(member = group_target((struct target_group *)target, addr)))
+        return 0;
+    return member->read_prefix(member, group_member_addr(addr), buf, len);
+}
+
+/*
+ * Forward runs of elements of the same member to its read_batch or
+ * write_batch (`write` set) with the member addresses.
+ */
+static int group_batch(struct target *target, struct target_read *elems,
+                       size_t n, int write)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i, j, k;
+    int rc = 1;
+
+    for (i = 0; i < n; i = j) {
+        size_t m = group_index(elems[i].addr);
+        addr_t base = (addr_t)m << GROUP_SHIFT;
+        struct target *member = group_target(group, elems[i].addr);
+        for (j = i + 1; j < n && group_index(elems[j].addr) == m; j++);
+        if (!member) {
+            for (k = i; k < j; k++)
+                elems[k].ok = 0;
+            rc = 0;
+            continue;
+        }
+        for (k = i; k < j; k++)
+            elems[k].addr -= base;
+        if (!(write ? member->write_batch(member, elems + i, j - i)
+                    : member->read_batch(member, elems + i, j - i)))
+            rc = 0;
+        for (k = i; k < j; k++)
+            elems[k].addr += base;
+    }
+    return rc;
+}
+
+static int group_read_batch(struct target *target, struct target_read *reads,
+                            size_t n)
+{
+    return group_batch(target, reads, n, 0);
+}
+
+static int group_write_batch(struct target *target,
+                             struct target_read *writes, size_t n)
+{
+    return group_batch(target, writes, n, 1);
+}
+
+static int group_page_flags(struct target *target, addr_t addr, size_t len,
+                            unsigned char *flags)
+{
+    struct target *member;
+    if (!(member = group_target((struct target_group *)target, addr)))
+        return 0;
+    return member->page_flags(member, group_member_addr(addr), len, flags);
+}
+
+static int group_clear_soft_dirty(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (!member->clear_soft_dirty(member))
+            rc = 0;
+    }
+    return rc;
+}
+
+static int group_refresh(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (!member->refresh(member))
+            rc = 0;
+    }
+    return rc;
+}
+
+static const void *group_map(struct target *target, addr_t addr, size_t len)
+{
+    struct target *member;
+    if (!(member = group_target((struct target_group *)target, addr)))
+        return NULL;
+    return member->map(member, group_member_addr(addr), len);
+}
+
+/*
+ * Add `pid` to the pids of a group being attached.
+ */
+static int group_idle(struct target *target)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    int rc = 0;
+    for (i = 0; i < group->size; i++) {
+        struct target *member = group->members[i];
+        if (member->idle(member))
+            rc = 1;
+    }
+    return rc;
+}
+
+static int group_add_pid(unsigned long **ppids, size_t *psize,
+                         size_t *pcapacity, unsigned long pid)
+{
+    if (*psize == GROUP_MEMBERS_MAX) {
+        errf("group: more than %d processes", GROUP_MEMBERS_MAX);
+        return 0;
+    }
+    if (*psize == *pcapacity) {
+        size_t capacity = *pcapacity ? 2 * *pcapacity : 16;
+        unsigned long *pids;
+        if (!(pids = realloc(*ppids, capacity * sizeof(unsigned long)))) {
+            errf("group: out-of-memory for process ids");
+            return 0;
+        }
+        *ppids = pids;
+        *pcapacity = capacity;
+    }
+    (*ppids)[(*psize)++] = pid;
+    return 1;
+}
+
+/*
+ * Find the processes (other than this one) running executable `path`.
+ */
+static int group_find_exe(const char *path, unsigned long **ppids,
+                          size_t *psize, size_t *pcapacity)
+{
+    char real[PATH_MAX], link[64], exe[PATH_MAX];
+    unsigned long self = (unsigned long)getpid();
+    struct dirent *entry;
+    DIR *dir;
+    int rc = 1;
+
+    if (!realpath(path, real)) {
+        errf("group: cannot resolve executable %s", path);
+        return 0;
+    }
+    if (!(dir = opendir("/proc"))) {
+        errf("group: cannot list processes");
+        return 0;
+    }
+    while (rc && (entry = readdir(dir))) {
+        char *end;
+        unsigned long pid = strtoul(entry->d_name, &end, 10);
+        ssize_t len;
+        if (*end || !pid || pid == self)
+            continue;
+        sprintf(link, "/proc/%lu/exe", pid);
+        if ((len = readlink(link, exe, sizeof(exe) - 1)) <= 0)
+            continue;
+        exe[len] = '\0';
+        if (!strcmp(exe, real))
+            rc = group_add_pid(ppids, psize, pcapacity, pid);
+    }
+    closedir(dir);
+    return rc;
+}
+
+struct target *target_attach_group(const char *spec)
+{
+    static const struct target group_init = {
+        group_detach,
+        group_stop,
+        group_run,
+        group_region_first,
+        group_region_next,
+        group_read,
+        group_write,
+        group_read_prefix,
+        group_read_batch,
+        group_write_batch,
+        group_stop_mode,
+        group_page_flags,
+        group_clear_soft_dirty,
+        group_refresh,
+        group_map,
+        group_idle
+    };
+    struct target_group *group;
+    unsigned long *pids = NULL;
+    size_t i, size = 0, capacity = 0;
+
+    if (!memcmp(spec, "exe=", 4)) {
+        if (!group_find_exe(spec + 4, &pids, &size, &capacity)) {
+            free(pids);
+            return NULL;
+        }
+    } else {
+        const char *p = spec;
+        do {
+            char *end;
+            unsigned long pid;
+            while (isspace(*p)) p++;
+            pid = strtoul(p, &end, 10);
+            if (!pid || end == p || pid != (pid_t)pid) {
+                errf("group: invalid pid list (%s)", spec);
+                free(pids);
+                return NULL;
+            }
+            for (p = end; isspace(*p); p++);
+            if (!group_add_pid(&pids, &size, &capacity, pid)) {
+                free(pids);
+                return NULL;
+            }
+        } while (*p++ == ',');
+        if (p[-1]) {
+            errf("group: invalid pid list (%s)", spec);
+            free(pids);
+            return NULL;
+        }
+    }
+    if (!size) {
+        errf("group: no processes (%s)", spec);
+        free(pids);
+        return NULL;
+    }
+
+    if (!(group = calloc(1, sizeof(struct target_group)))
+            || !(group->members = malloc(size * sizeof(struct target *)))
+            || !(group->stopped = malloc(size * sizeof(int)))) {
+        errf("target: out-of-memory for group target instance");
+        if (group) free(group->members);
+        free(group);
+        free(pids);
+        return NULL;
+    }
+    memcpy(group, &group_init, sizeof(struct target));
+    group->pids = pids;
+    for (i = 0; i < size; i++) {
+        char uri[64];
+        sprintf(uri, "pid://%lu", pids[i]);
+        if (!(group->members[group->size] = target_attach(uri))) {
+            errf("group: attaching to %s failed", uri);
+            group_detach((struct target *)group);
+            return NULL;
+        }
+        group->size++;
+    }
+    return (struct target *)group;
+}
+
+size_t target_group_size(const struct target *target)
+{
+    if (!target || target->detach != group_detach)
+        return 0;
+    return ((const struct target_group *)target)->size;
+}
+
+void group_print(struct target *target, FILE *out)
+{
+    struct target_group *group = (struct target_group *)target;
+    size_t i;
+    for (i = 0; i < target_group_size(target); i++) {
+        addr_t base = (addr_t)i << GROUP_SHIFT;
+        fprintf(out, "%lu. pid %lu at 0x%08" PRIaddr "\n",
+                (unsigned long)i + 1, group->pids[i], base);
+    }
+}
+
+/* Named region of a member and the start of its first mapping */
+struct group_module {
+    addr_t start, end, base;
+    char *path;
+};
+
+/* Hit located in a module */
+struct group_hit {
+    const char *path;
+    addr_t offset;
+    enum value_type type;
+    size_t member;
+    const union value_data *value;
+};
+
+static int group_hit_compare(const void *a, const void *b)
+{
+    const struct group_hit *x = (const struct group_hit *)a;
+    const struct group_hit *y = (const struct group_hit *)b;
+    int cmp;
+    if ((cmp = strcmp(x->path, y->path)))
+        return cmp;
+    if (x->offset != y->offset)
+        return (x->offset < y->offset) ? -1 : 1;
+    if (x->type != y->type)
+        return (x->type < y->type) ? -1 : 1;
+    return (x->member < y->member) ? -1 : (x->member > y->member);
+}
+
+/*
+ * Collect the mapped-file regions of a member (in address order).
+ */
+static int group_modules(struct target *member, struct group_module **pmodules,
+                         size_t *psize)
+{
+    struct group_module *modules = NULL;
+    size_t size = 0, capacity = 0, i;
+    struct region *mr;
+    int rc = 1;
+
+    for (mr = member->region_first(member); mr; mr = member->region_next(mr)) {
+        struct group_module *module;
+        if (!rc || !mr->path || !*mr->path)
+            continue;
+        if (size == capacity) {
+            size_t new_capacity = capacity ? 2 * capacity : 64;
+            struct group_module *new;
+            if (!(new = realloc(modules, new_capacity
+                                         * sizeof(struct group_module)))) {
+                rc = 0;
+                continue;
+            }
+            modules = new;
+            capacity = new_capacity;
+        }
+        module = &modules[size];
+        module->start = mr->start;
+        module->end = mr->start + (mr->size - 1);
+        module->base = mr->start;
+        /* The module base is its lowest mapping */
+        for (i = size; i-- > 0; ) {
+            if (!strcmp(modules[i].path, mr->path)) {
+                module->base = modules[i].base;
+                break;
+            }
+        }
+        if (!(module->path = malloc(strlen(mr->path) + 1))) {
+            rc = 0;
+            continue;
+        }
+        strcpy(module->path, mr->path);
+        size++;
+    }
+    *pmodules = modules;
+    *psize = size;
+    return rc;
+}
+
+long group_common(struct target *target, const struct hits *hits, FILE *out)
+{
+    struct target_group *group = (struct target_group *)target;
+    struct group_module **modules;
+    size_t *modules_size;
+    struct group_hit *located;
+    size_t i, j, n;
+    long common = -1;
+
+    if (!target_group_size(target)) {
+        errf("group: target is not a group");
+        return -1;
+    }
+    modules = calloc(group->size, sizeof(struct group_module *));
+    modules_size = calloc(group->size, sizeof(size_t));
+    located = malloc((hits->size ? hits->size : 1) * sizeof(struct group_hit));
+    if (!modules || !modules_size || !located) {
+        errf("group: out-of-memory for merged hits");
+        goto out;
+    }
+    for (i = 0; i < group->size; i++) {
+        if (!group_modules(group->members[i], &modules[i], &modules_size[i])) {
+            errf("group: out-of-memory for modules");
+            goto out;
+        }
+    }
+
+    /* Locate the hits in the modules of their members */
+    for (i = n = 0; i < hits->size; i++) {
+        addr_t addr = hits_addr(hits, i);
+        size_t m = group_index(addr), lo, hi;
+        const struct group_module *mods;
+        addr = group_member_addr(addr);
+        if (m >= group->size)
+            continue;
+        mods = modules[m];
+        lo = 0;
+        hi = modules_size[m];
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (mods[mid].end < addr) {
+                lo = mid + 1;
+            } else hi = mid;
+        }
+        if (lo == modules_size[m] || addr < mods[lo].start)
+            continue;
+        located[n].path = mods[lo].path;
+        located[n].offset = addr - mods[lo].base;
+        located[n].type = hits_type(hits, i);
+        located[n].member = m;
+        located[n].value = hits_prev(hits, i);
+        n++;
+    }
+    qsort(located, n, sizeof(struct group_hit), group_hit_compare);
+
+    /* Report the runs found in every member */
+    for (i = common = 0; i < n; i = j) {
+        size_t members = 1;
+        int same = 1;
+        for (j = i + 1; j < n && !strcmp(located[j].path, located[i].path)
+                        && located[j].offset == located[i].offset
+                        && located[j].type == located[i].type; j++) {
+            enum value_type type = located[j].type;
+            size_t size = value_type_sizeof((type & PTR) ? hits->addr_type
+                                                         : type);
+            if (located[j].member != located[j-1].member)
+                members++;
+            if (memcmp(located[j].value, located[i].value, size))
+                same = 0;
+        }
+        if (members < group->size)
+            continue;
+        fprintf(out, "%s %s+0x%" PRIaddr, value_type_to_string(located[i].type),
+                located[i].path, located[i].offset);
+        if (same) {
+            struct value value;
+            char buf[64];
+            value.type = (located[i].type & PTR) ? hits->addr_type
+                                                 : located[i].type;
+            memcpy(&value.data, located[i].value, value_type_sizeof(value.type));
+            value_to_string(&value, buf, sizeof(buf));
+            fprintf(out, " = %s\n", buf);
+        } else fputs(" (values differ)\n", out);
+        common++;
+    }
+
+out:
+    for (i = 0; modules && i < group->size; i++) {
+        for (j = 0; j < modules_size[i]; j++)
+            free(modules[i][j].path);
+        free(modules[i]);
+    }
+    free(located);
+    free(modules_size);
+    free(modules);
+    return common;
+}
+
+/*
+ * Read cache for the dereferences of expressions evaluated on one member at
+ * a time. Pointer values read from a member carry no member bits, so reads
+ * are moved to the member selected with group_deref_select(). Writes go to
+ * the given (hit) addresses unchanged.
+ */
+struct group_deref {
+    struct target base;
+    struct target *cache;
+    addr_t member; /* member bits of the selected member */
+};
+
+#define group_deref_addr(deref, addr) \
+    (group_member_addr((addr)) | (deref)->member)
+
+static int group_deref_detach(struct target *target)
+{
+    struct group_deref *deref = (struct group_deref *)target;
+    target_detach(deref->cache);
+    free(deref);
+    return 1;
+}
+
+static int group_deref_stop(struct target *target)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->stop(cache);
+}
+
+static int group_deref_run(struct target *target)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->run(cache);
+}
+
+/* Expressions do not iterate regions */
+static struct region *group_deref_region_first(struct target *target)
+{
+    return NULL;
+}
+
+static struct region *group_deref_region_next(struct region *it)
+{
+    return NULL;
+}
+
+static int group_deref_read(struct target *target, addr_t addr, void *buf,
+                            size_t len)
+{
+    struct group_deref *deref = (struct group_deref *)target;
+    return deref->cache->read(deref->cache, group_deref_addr(deref, addr),
+                              buf, len);
+}
+
+static int group_deref_write(struct target *target, addr_t addr, void *buf,
+                             size_t len)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->write(cache, addr, buf, len);
+}
+
+static size_t group_deref_read_prefix(struct target *target, addr_t addr,
+                                      void *buf, size_t len)
+{
+    struct group_deref *deref = (struct group_deref *)target;
+    return deref->cache->read_prefix(deref->cache,
+                                     group_deref_addr(deref, addr), buf, len);
+}
+
+static int group_deref_read_batch(struct target *target,
+                                  struct target_read *reads, size_t n)
+{
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < n; i++) {
+        reads[i].ok = group_deref_read(target, reads[i].addr, reads[i].buf,
+                                       reads[i].len);
+        if (!reads[i].ok)
+            rc = 0;
+    }
+    return rc;
+}
+
+static int group_deref_write_batch(struct target *target,
+                                   struct target_read *writes, size_t n)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->write_batch(cache, writes, n);
+}
+
+static int group_deref_stop_mode(struct target *target, enum target_stop mode)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->stop_mode(cache, mode);
+}
+
+static int group_deref_page_flags(struct target *target, addr_t addr,
+                                  size_t len, unsigned char *flags)
+{
+    struct group_deref *deref = (struct group_deref *)target;
+    return deref->cache->page_flags(deref->cache,
+                                    group_deref_addr(deref, addr), len, flags);
+}
+
+static int group_deref_clear_soft_dirty(struct target *target)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->clear_soft_dirty(cache);
+}
+
+static int group_deref_refresh(struct target *target)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->refresh(cache);
+}
+
+static const void *group_deref_map(struct target *target, addr_t addr,
+                                   size_t len)
+{
+    struct group_deref *deref = (struct group_deref *)target;
+    return deref->cache->map(deref->cache, group_deref_addr(deref, addr), len);
+}
+
+static int group_deref_idle(struct target *target)
+{
+    struct target *cache = ((struct group_deref *)target)->cache;
+    return cache->idle(cache);
+}
+
+struct target *group_deref_new(struct target *target, size_t pages)
+{
+    static const struct target deref_init = {
+        group_deref_detach,
+        group_deref_stop,
+        group_deref_run,
+        group_deref_region_first,
+        group_deref_region_next,
+        group_deref_read,
+        group_deref_write,
+        group_deref_read_prefix,
+        group_deref_read_batch,
+        group_deref_write_batch,
+        group_deref_stop_mode,
+        group_deref_page_flags,
+        group_deref_clear_soft_dirty,
+        group_deref_refresh,
+        group_deref_map,
+        group_deref_idle
+    };
+    struct group_deref *deref;
+    struct target *cache;
+
+    if (!(cache = target_cache_new(target, pages)))
+        return NULL;
+    if (!target_group_size(target))
+        return cache;
+    if (!(deref = malloc(sizeof(struct group_deref)))) {
+        errf("group: out-of-memory for dereference target");
+        target_detach(cache);
+        return NULL;
+    }
+    memcpy(deref, &deref_init, sizeof(struct target));
+    deref->cache = cache;
+    deref->member = 0;
+    return (struct target *)deref;
+}
+
+void group_deref_select(struct target *target, addr_t addr)
+{
+    if (target->detach == group_deref_detach) {
+        struct group_deref *deref = (struct group_deref *)target;
+        deref->member = addr - group_member_addr(addr);
+    }
+}
+
+#else
+
+struct target *group_deref_new(struct target *target, size_t pages)
+{
+    return target_cache_new(target, pages);
+}
+
+void group_deref_select(struct target *target, addr_t addr)
+{
+}
+
+struct target *target_attach_group(const char *spec)
+{
+    errf("group: target groups need 64-bit addresses");
+    return NULL;
+}
+
+size_t target_group_size(const struct target *target)
+{
+    return 0;
+}
+
+void group_print(struct target *target, FILE *out)
+{
+}
+
+long group_common(struct target *target, const struct hits *hits, FILE *out)
+{
+    errf("group: target is not a group");
+    return -1;
+}
+
+#endif
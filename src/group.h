@@ -0,0 +1,65 @@
+/*
+ * Target groups.
+ *
+ * group://<pid>,<pid>,... and group://exe=<path> (every process running the
+ * executable) attach to a set of processes as one target. The memory of the
+ * i'th member is addressed with i in the bits above GROUP_SHIFT, so searches,
+ * filters and hits work on groups unchanged and every hit is tagged by its
+ * member. All members are stopped at once so that their stop windows
+ * overlap, and searches and filters use (at least) one worker per member.
+ */
+
+#ifndef GROUP_H_INCLUDED
+#define GROUP_H_INCLUDED
+
+#include "defines.h"
+#include "hits.h"
+#include "ramfuck.h"
+#include "target.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Member index of group addresses is stored above this bit */
+#define GROUP_SHIFT 48
+
+/* Maximum number of processes in a group */
+#define GROUP_MEMBERS_MAX 65536
+
+/* Member of a group address and the address within the member */
+#define group_index(addr) ((size_t)((addr) >> GROUP_SHIFT))
+#define group_member_addr(addr) ((addr) & (((addr_t)1 << GROUP_SHIFT) - 1))
+
+/*
+ * Attach to the processes of a group:// URI (without the scheme). Returns
+ * NULL on error.
+ */
+struct target *target_attach_group(const char *spec);
+
+/*
+ * Number of members of a group target (0 if `target` is not a group).
+ */
+size_t target_group_size(const struct target *target);
+
+/*
+ * Print the members of a group target.
+ */
+void group_print(struct target *target, FILE *out);
+
+/*
+ * Print hits found at the same offset of the same module (named region) in
+ * every member of the group as "type module+offset" lines. Returns the
+ * number of such hits, or -1 on error.
+ */
+long group_common(struct target *target, const struct hits *hits, FILE *out);
+
+/*
+ * Read cache of `target` (see target_cache_new()) for dereferences of
+ * expressions. On a group target, reads go to the member selected with
+ * group_deref_select() of an address of the member, because pointer values
+ * read from a member do not tell the member. Returns NULL on error.
+ */
+struct target *group_deref_new(struct target *target, size_t pages);
+void group_deref_select(struct target *target, addr_t addr);
+
+#endif
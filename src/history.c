@@ -0,0 +1,253 @@
+#include "history.h"
+#include "ramfuck.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct history *history_new()
+{
+    return calloc(1, sizeof(struct history));
+}
+
+static void history_step_destroy(struct history_step *step)
+{
+    if (step->full) hits_delete(step->full);
+    free(step->survivors);
+    free(step->values);
+    memset(step, 0, sizeof(struct history_step));
+}
+
+/*
+ * Drop the current hits unless they are owned by the current step.
+ */
+static void history_drop_current(struct history *history)
+{
+    if (history->current) {
+        if (!history->size || history->steps[history->pos].full
+                != history->current)
+            hits_delete(history->current);
+        history->current = NULL;
+    }
+}
+
+void history_delete(struct history *history)
+{
+    history_drop_current(history);
+    while (history->size)
+        history_step_destroy(&history->steps[--history->size]);
+    free(history->steps);
+    free(history);
+}
+
+/* Index of the segment of hit `i` given the segment of the previous hit */
+#define history_segment(hits, seg, i) \
+    while ((seg) + 1 < (hits)->segments_size \
+            && (hits)->segments[(seg) + 1].start <= (i)) (seg)++
+
+/*
+ * Encode `child` as a delta of `parent`. Returns zero if `child` is not a
+ * subsequence of `parent` with the same types.
+ */
+static int history_step_delta(struct history_step *step,
+                              const struct hits *parent,
+                              const struct hits *child)
+{
+    size_t i, j, ps, cs, vs;
+
+    if (!parent || !child || parent->types || child->types
+            || parent->addr_type != child->addr_type
+            || parent->value_type != child->value_type
+            || parent->value_size != child->value_size
+            || child->size > parent->size)
+        return 0;
+
+    vs = child->value_size;
+    if (!(step->survivors = calloc((parent->size + 7) / 8, 1))
+            || !(step->values = malloc(child->size * vs + 1))) {
+        free(step->survivors);
+        step->survivors = NULL;
+        return 0;
+    }
+
+    ps = cs = 0;
+    for (i = j = 0; i < parent->size && j < child->size; i++) {
+        addr_t paddr, caddr;
+        history_segment(parent, ps, i);
+        history_segment(child, cs, j);
+        paddr = parent->segments[ps].base + parent->offsets[i];
+        caddr = child->segments[cs].base + child->offsets[j];
+        if (paddr == caddr) {
+            step->survivors[i / 8] |= 1 << (i % 8);
+            memcpy(step->values + j*vs, child->values + j*vs, vs);
+            j++;
+        }
+    }
+
+    if (j < child->size) {
+        free(step->values);
+        free(step->survivors);
+        step->values = NULL;
+        step->survivors = NULL;
+        return 0;
+    }
+    step->bytes = (parent->size + 7) / 8 + child->size * vs;
+    return 1;
+}
+
+/*
+ * Reconstruct hits of a delta step from its parent hits.
+ */
+static struct hits *history_step_apply(const struct history_step *step,
+                                       const struct hits *parent)
+{
+    struct hits *hits;
+    size_t i, n, seg, vs;
+
+    if (!(hits = hits_new(parent->addr_type, parent->value_type)))
+        return NULL;
+    vs = parent->value_size;
+    for (i = n = seg = 0; i < parent->size; i++) {
+        if (step->survivors[i / 8] & (1 << (i % 8))) {
+            history_segment(parent, seg, i);
+            if (!hits_add(hits, parent->segments[seg].base + parent->offsets[i],
+                          parent->value_type,
+                          (union value_data *)(step->values + n++ * vs))) {
+                hits_delete(hits);
+                return NULL;
+            }
+        }
+    }
+    return hits;
+}
+
+/*
+ * Reconstruct hits of step `k`. The returned hits are owned by the step if
+ * they are its full hits, otherwise by the caller.
+ */
+static int history_materialize(struct history *history, size_t k,
+                               struct hits **out)
+{
+    struct hits *hits;
+    size_t j;
+
+    for (j = k; history->steps[j].survivors; j--);
+    hits = history->steps[j].full;
+    while (j++ < k) {
+        struct hits *next = history_step_apply(&history->steps[j], hits);
+        if (hits != history->steps[j-1].full)
+            hits_delete(hits);
+        if (!(hits = next))
+            return 0;
+    }
+    *out = hits;
+    return 1;
+}
+
+/*
+ * Evict the oldest step, converting its child to a full step if needed.
+ */
+static int history_evict(struct history *history)
+{
+    struct history_step *child = &history->steps[1];
+
+    if (child->survivors) {
+        struct hits *hits;
+        if (history->pos == 1 && history->current) {
+            hits = history->current;
+        } else if (!history_materialize(history, 1, &hits)) {
+            return 0;
+        }
+        history->bytes -= child->bytes;
+        free(child->survivors);
+        free(child->values);
+        child->survivors = NULL;
+        child->values = NULL;
+        child->full = hits;
+        child->bytes = hits_bytes(hits);
+        history->bytes += child->bytes;
+    }
+
+    history->bytes -= history->steps[0].bytes;
+    history_step_destroy(&history->steps[0]);
+    memmove(&history->steps[0], &history->steps[1],
+            (history->size - 1) * sizeof(struct history_step));
+    history->size--;
+    history->pos--;
+    return 1;
+}
+
+int history_push(struct history *history, struct hits *hits, size_t budget)
+{
+    struct history_step *step;
+
+    /* Discard redo steps */
+    while (history->size > history->pos + 1) {
+        step = &history->steps[--history->size];
+        history->bytes -= step->bytes;
+        history_step_destroy(step);
+    }
+
+    if (history->size == history->capacity) {
+        size_t capacity = history->capacity ? 2 * history->capacity : 16;
+        struct history_step *new;
+        if (!(new = realloc(history->steps,
+                            sizeof(struct history_step) * capacity))) {
+            errf("history: out-of-memory for history steps");
+            if (hits) hits_delete(hits);
+            return 0;
+        }
+        history->steps = new;
+        history->capacity = capacity;
+    }
+
+    step = &history->steps[history->size];
+    memset(step, 0, sizeof(struct history_step));
+    if (!history_step_delta(step, history->current, hits) && hits) {
+        step->full = hits;
+        step->bytes = hits_bytes(hits);
+    }
+    history_drop_current(history);
+    history->pos = history->size++;
+    history->bytes += step->bytes;
+    history->current = hits;
+
+    while (history->bytes > budget && history->pos > 0) {
+        if (!history_evict(history)) {
+            warnf("history: out-of-memory evicting history steps");
+            break;
+        }
+    }
+    return 1;
+}
+
+static int history_move(struct history *history, size_t pos)
+{
+    struct hits *hits;
+    const struct history_step *step = &history->steps[pos];
+    if (pos == history->pos + 1 && step->survivors && history->current) {
+        /* Redo of a delta step applies directly to the current hits */
+        if (!(hits = history_step_apply(step, history->current))) {
+            errf("history: out-of-memory reconstructing hits");
+            return 0;
+        }
+    } else if (!history_materialize(history, pos, &hits)) {
+        errf("history: out-of-memory reconstructing hits");
+        return 0;
+    }
+    history_drop_current(history);
+    history->pos = pos;
+    history->current = hits;
+    return 1;
+}
+
+int history_undo(struct history *history)
+{
+    return history->size && history->pos > 0
+        && history_move(history, history->pos - 1);
+}
+
+int history_redo(struct history *history)
+{
+    return history->pos + 1 < history->size
+        && history_move(history, history->pos + 1);
+}
@@ -0,0 +1,55 @@
+/*
+ * Multi-level undo/redo history of hits.
+ *
+ * Every change of the current hits pushes a step. A step whose hits are a
+ * subsequence of its parent's hits (e.g., the result of a filter) is stored
+ * as a delta: a survivor bitmap over the parent hits and the packed values
+ * of the survivors. Other steps store the full hits. Oldest steps are
+ * evicted when the history exceeds its byte budget.
+ */
+
+#ifndef HISTORY_H_INCLUDED
+#define HISTORY_H_INCLUDED
+
+#include "hits.h"
+
+#include <stddef.h>
+
+struct history_step {
+    struct hits *full;        /* full hits, NULL for delta and empty steps */
+    unsigned char *survivors; /* bitmap over parent hits, NULL unless delta */
+    char *values;             /* packed values of survivors */
+    size_t bytes;             /* memory used by the step */
+};
+
+struct history {
+    struct history_step *steps;
+    size_t size, capacity;
+    size_t pos;          /* index of the current step */
+    size_t bytes;        /* memory used by all steps */
+    struct hits *current; /* hits of the current step */
+};
+
+/*
+ * (De)allocate a history.
+ */
+struct history *history_new();
+void history_delete(struct history *history);
+
+/*
+ * Push `hits` (possibly NULL) as the new current step, taking ownership of
+ * it. Redo steps are discarded and the oldest steps are evicted until the
+ * history uses at most `budget` bytes (the current step is always kept).
+ *
+ * Returns zero if the step could not be added; `hits` is deleted then.
+ */
+int history_push(struct history *history, struct hits *hits, size_t budget);
+
+/*
+ * Move to the previous or next step. Returns zero if there is no such step
+ * or reconstructing its hits failed.
+ */
+int history_undo(struct history *history);
+int history_redo(struct history *history);
+
+#endif
@@ -1,19 +1,231 @@
+#define _POSIX_C_SOURCE 200809L /* for mmap(2), fileno(3) and mkstemp(3) */
 #include "hits.h"
 #include "ramfuck.h"
 
 #include <memory.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-struct hits *hits_new()
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Hits file format (native byte order, sections aligned to 8 bytes):
+ *   header
+ *   segments  struct { uint64_t base, start; }[segments_size]
+ *   offsets   uint32_t[size]
+ *   values    char[size * value_size]
+ *   types     uint32_t[size] (if HITS_FILE_TYPES)
+ */
+#define HITS_FILE_MAGIC "RFHITS\0\0"
+#define HITS_FILE_VERSION 1
+#define HITS_FILE_BYTE_ORDER 0x01020304
+#define HITS_FILE_TYPES 1
+
+struct hits_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t addr_type, value_type;
+    uint32_t value_size, flags;
+    uint64_t size, segments_size;
+    uint64_t segments_pos, offsets_pos, values_pos, types_pos;
+};
+
+#define hits_file_align(pos) (((pos) + 7) & ~(uint64_t)7)
+
+/* Arrays of the container (indices of struct hits_spill) */
+#define HITS_OFFSETS 0
+#define HITS_VALUES 1
+#define HITS_TYPES 2
+
+/*
+ * Temporary files backing the arrays of hits exceeding the memory budget.
+ */
+struct hits_spill {
+    int fds[3];      /* file of each array (-1 if still on the heap) */
+    size_t bytes[3]; /* size of each file mapping */
+};
+
+/* Budget shared by all containers and bytes of arrays on the heap */
+static size_t hits_memory = HITS_MEMORY_DEFAULT;
+static size_t hits_heap;
+static pthread_mutex_t hits_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void hits_set_memory(size_t bytes)
+{
+    hits_memory = bytes;
+}
+
+/*
+ * Create an unlinked temporary file in $TMPDIR (default /tmp).
+ */
+static int hits_spill_file()
+{
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    int fd;
+
+    if (!dir || !*dir)
+        dir = "/tmp";
+    if (strlen(dir) + sizeof("/ramfuck-hits-XXXXXX") > sizeof(path)) {
+        errf("hits: temporary directory path too long");
+        return -1;
+    }
+    sprintf(path, "%s/ramfuck-hits-XXXXXX", dir);
+    if ((fd = mkstemp(path)) == -1) {
+        errf("hits: cannot create temporary file in %s", dir);
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+static int hits_spill_write(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t ret = write(fd, data, len);
+        if (ret <= 0)
+            return 0;
+        data += ret;
+        len -= ret;
+    }
+    return 1;
+}
+
+/*
+ * Resize the k'th array at `array` (of `used` bytes in use) to `bytes`. The
+ * array is reallocated on the heap or, if the hits are spilled, mapped from
+ * its temporary file (moving it there first if needed). Returns the new
+ * array, or NULL leaving the old one intact.
+ */
+static void *hits_array_resize(struct hits *hits, int k, void *array,
+                               size_t used, size_t bytes)
+{
+    struct hits_spill *spill = hits->spill;
+    size_t len = bytes ? bytes : 1;
+    void *map;
+    int fd;
+
+    if (!spill)
+        return realloc(array, len);
+
+    if ((fd = spill->fds[k]) == -1) {
+        if ((fd = hits_spill_file()) == -1)
+            return NULL;
+        if (!hits_spill_write(fd, (const char *)array, used)) {
+            errf("hits: error writing temporary file");
+            close(fd);
+            return NULL;
+        }
+    }
+    if (ftruncate(fd, len) || (map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        errf("hits: cannot map temporary file");
+        if (spill->fds[k] == -1)
+            close(fd);
+        return NULL;
+    }
+
+    /* Data of the old mapping is already in the file */
+    if (spill->fds[k] == -1) {
+        free(array);
+        spill->fds[k] = fd;
+    } else munmap(array, spill->bytes[k]);
+    spill->bytes[k] = len;
+    return map;
+}
+
+/*
+ * Bytes of the arrays for `capacity` hits with values of `value_size` bytes.
+ */
+static size_t hits_array_bytes(size_t capacity, size_t value_size, int types)
+{
+    size_t bytes = sizeof(uint32_t) + value_size;
+    if (types)
+        bytes += sizeof(enum value_type);
+    return (capacity > (size_t)-1 / bytes) ? (size_t)-1 : bytes * capacity;
+}
+
+/*
+ * Account the arrays of hits growing to `bytes` against the shared budget,
+ * and start spilling them to disk if the heap arrays of all containers
+ * would exceed it.
+ */
+static int hits_budget(struct hits *hits, size_t bytes)
+{
+    int k, spill;
+    if (hits->spill)
+        return 1;
+    pthread_mutex_lock(&hits_heap_lock);
+    hits_heap -= hits->heap;
+    spill = hits_memory && (bytes > hits_memory
+                            || hits_heap > hits_memory - bytes);
+    hits->heap = spill ? 0 : bytes;
+    hits_heap += hits->heap;
+    pthread_mutex_unlock(&hits_heap_lock);
+    if (!spill)
+        return 1;
+    if (!(hits->spill = malloc(sizeof(struct hits_spill))))
+        return 0;
+    for (k = 0; k < 3; k++) {
+        hits->spill->fds[k] = -1;
+        hits->spill->bytes[k] = 0;
+    }
+    return 1;
+}
+
+/*
+ * Resize the arrays for `capacity` hits.
+ */
+static int hits_resize(struct hits *hits, size_t capacity)
+{
+    void *p;
+
+    if (hits_array_bytes(capacity, hits->value_size, !!hits->types)
+            == (size_t)-1)
+        return 0;
+    if (!hits_budget(hits, hits_array_bytes(capacity, hits->value_size,
+                                            !!hits->types)))
+        return 0;
+    if (!(p = hits_array_resize(hits, HITS_OFFSETS, hits->offsets,
+                                sizeof(uint32_t) * hits->size,
+                                sizeof(uint32_t) * capacity)))
+        return 0;
+    hits->offsets = (uint32_t *)p;
+    if (!(p = hits_array_resize(hits, HITS_VALUES, hits->values,
+                                hits->value_size * hits->size,
+                                hits->value_size * capacity)))
+        return 0;
+    hits->values = (char *)p;
+    if (hits->types) {
+        if (!(p = hits_array_resize(hits, HITS_TYPES, hits->types,
+                                    sizeof(enum value_type) * hits->size,
+                                    sizeof(enum value_type) * capacity)))
+            return 0;
+        hits->types = (enum value_type *)p;
+    }
+    hits->capacity = capacity;
+    return 1;
+}
+
+struct hits *hits_new(enum value_type addr_type, enum value_type value_type)
 {
     struct hits *hits;
-    if ((hits = malloc(sizeof(struct hits)))) {
-        hits->size = 0;
-        hits->capacity = 256;
-        hits->addr_type = U32;
-        hits->value_type = S32;
-        if (!(hits->items = malloc(sizeof(struct hit) * hits->capacity))) {
-            free(hits);
+    if ((hits = calloc(1, sizeof(struct hits)))) {
+        hits->segments_capacity = 16;
+        hits->addr_type = addr_type;
+        hits->value_type = value_type;
+        hits->value_size = value_type_sizeof((value_type & PTR) ? addr_type
+                                                                : value_type);
+        if (!hits_resize(hits, 256)
+                || !(hits->segments = malloc(sizeof(struct hits_segment)
+                                             * hits->segments_capacity))) {
+            hits_delete(hits);
             hits = NULL;
         }
     }
@@ -22,31 +234,392 @@ struct hits *hits_new()
 
 void hits_delete(struct hits *hits)
 {
-    free(hits->items);
+    pthread_mutex_lock(&hits_heap_lock);
+    hits_heap -= hits->heap;
+    pthread_mutex_unlock(&hits_heap_lock);
+    free(hits->segments);
+    if (hits->map) {
+        munmap(hits->map, hits->map_size);
+    } else if (hits->spill) {
+        void *arrays[3];
+        int k;
+        arrays[HITS_OFFSETS] = hits->offsets;
+        arrays[HITS_VALUES] = hits->values;
+        arrays[HITS_TYPES] = hits->types;
+        for (k = 0; k < 3; k++) {
+            if (hits->spill->fds[k] != -1) {
+                munmap(arrays[k], hits->spill->bytes[k]);
+                close(hits->spill->fds[k]);
+            } else free(arrays[k]);
+        }
+        free(hits->spill);
+    } else {
+        free(hits->types);
+        free(hits->values);
+        free(hits->offsets);
+    }
     free(hits);
 }
 
+static int hits_grow(struct hits *hits)
+{
+    return hits_resize(hits, 2 * hits->capacity);
+}
+
+/*
+ * Switch to per-hit types with values stored in full value_data slots.
+ */
+static int hits_mix(struct hits *hits)
+{
+    size_t i, size = sizeof(union value_data);
+    void *p;
+
+    if (!hits_budget(hits, hits_array_bytes(hits->capacity, size, 1)))
+        return 0;
+    if (hits->value_size < size) {
+        if (!(p = hits_array_resize(hits, HITS_VALUES, hits->values,
+                                    hits->value_size * hits->size,
+                                    size * hits->capacity)))
+            return 0;
+        hits->values = (char *)p;
+        /* Spread the values to full slots from the end backwards */
+        for (i = hits->size; i-- > 0; )
+            memmove(hits->values + i*size, hits->values + i*hits->value_size,
+                    hits->value_size);
+        hits->value_size = size;
+    }
+
+    if (!(p = hits_array_resize(hits, HITS_TYPES, NULL, 0,
+                                sizeof(enum value_type) * hits->capacity)))
+        return 0;
+    hits->types = (enum value_type *)p;
+    for (i = 0; i < hits->size; i++)
+        hits->types[i] = hits->value_type;
+    return 1;
+}
+
+static int hits_add_segment(struct hits *hits, addr_t base)
+{
+    struct hits_segment *segment;
+    if (hits->segments_size == hits->segments_capacity) {
+        size_t capacity = 2 * hits->segments_capacity;
+        struct hits_segment *new;
+        if (!(new = realloc(hits->segments,
+                            sizeof(struct hits_segment) * capacity)))
+            return 0;
+        hits->segments = new;
+        hits->segments_capacity = capacity;
+    }
+    segment = &hits->segments[hits->segments_size++];
+    segment->base = base;
+    segment->start = hits->size;
+    return 1;
+}
+
 int hits_add(struct hits *hits, addr_t addr, enum value_type type,
              union value_data *data)
 {
-    struct hit *hit;
+    struct hits_segment *segment;
     size_t size = value_type_sizeof((type & PTR) ? hits->addr_type : type);
 
-    if (hits->size == hits->capacity) {
-        struct hit *new;
-        new = realloc(hits->items, sizeof(struct hit) * 2*hits->capacity);
-        if (!new) {
-            errf("hits: out-of-memory for larger hits container");
+    if (hits->map) {
+        errf("hits: cannot add to read-only hits");
+        return 0;
+    }
+
+    if (hits->size == hits->capacity && !hits_grow(hits)) {
+        errf("hits: out-of-memory for larger hits container");
+        return 0;
+    }
+
+    if (type != hits->value_type && !hits->types && !hits_mix(hits)) {
+        errf("hits: out-of-memory for hit types");
+        return 0;
+    }
+
+    segment = hits->segments_size
+            ? &hits->segments[hits->segments_size - 1] : NULL;
+    if (!segment || addr < segment->base || addr - segment->base > UINT32_MAX) {
+        if (!hits_add_segment(hits, addr)) {
+            errf("hits: out-of-memory for hit segments");
             return 0;
         }
-        hits->capacity *= 2;
-        hits->items = new;
+        segment = &hits->segments[hits->segments_size - 1];
     }
 
-    hit = &hits->items[hits->size++];
-    hit->addr = addr;
-    hit->type = type;
-    memcpy(&hit->prev, data, size);
+    hits->offsets[hits->size] = (uint32_t)(addr - segment->base);
+    memcpy(hits->values + hits->size * hits->value_size, data, size);
+    if (hits->types)
+        hits->types[hits->size] = type;
+    hits->size++;
+
+    return 1;
+}
+
+void hits_clear(struct hits *hits)
+{
+    hits->size = 0;
+    hits->segments_size = 0;
+}
 
+struct hits *hits_copy(const struct hits *hits)
+{
+    struct hits *copy;
+    void *types;
+    if (!(copy = malloc(sizeof(struct hits))))
+        return NULL;
+    memcpy(copy, hits, sizeof(struct hits));
+    copy->offsets = NULL;
+    copy->values = NULL;
+    copy->types = NULL;
+    copy->size = copy->capacity = 0;
+    copy->segments = NULL;
+    copy->map = NULL;
+    copy->map_size = 0;
+    copy->spill = NULL;
+    copy->heap = 0;
+    if (!hits_budget(copy, hits_array_bytes(hits->capacity,
+                                            hits->value_size, !!hits->types))
+            || !hits_resize(copy, hits->capacity)
+            || (hits->types && !(types = hits_array_resize(copy, HITS_TYPES,
+                NULL, 0, sizeof(enum value_type) * hits->capacity)))
+            || !(copy->segments = malloc(sizeof(struct hits_segment)
+                                         * hits->segments_capacity))) {
+        hits_delete(copy);
+        return NULL;
+    }
+    if (hits->types)
+        copy->types = (enum value_type *)types;
+    copy->size = hits->size;
+    memcpy(copy->offsets, hits->offsets, sizeof(uint32_t) * hits->size);
+    memcpy(copy->values, hits->values, hits->value_size * hits->size);
+    memcpy(copy->segments, hits->segments,
+           sizeof(struct hits_segment) * hits->segments_size);
+    if (hits->types)
+        memcpy(copy->types, hits->types, sizeof(enum value_type) * hits->size);
+    return copy;
+}
+
+static int hits_file_write(FILE *fp, const void *buf, size_t size,
+                           uint64_t *ppos)
+{
+    static const char zeros[8];
+    size_t pad = hits_file_align(*ppos + size) - (*ppos + size);
+    *ppos += size + pad;
+    return fwrite(buf, 1, size, fp) == size
+        && fwrite(zeros, 1, pad, fp) == pad;
+}
+
+int hits_save(const struct hits *hits, const char *path)
+{
+    struct hits_file_header header;
+    uint64_t pos, segment[2];
+    uint32_t type;
+    size_t i;
+    FILE *fp;
+    int ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HITS_FILE_MAGIC, sizeof(header.magic));
+    header.version = HITS_FILE_VERSION;
+    header.byte_order = HITS_FILE_BYTE_ORDER;
+    header.addr_type = hits->addr_type;
+    header.value_type = hits->value_type;
+    header.value_size = hits->value_size;
+    header.flags = hits->types ? HITS_FILE_TYPES : 0;
+    header.size = hits->size;
+    header.segments_size = hits->segments_size;
+    header.segments_pos = hits_file_align(sizeof(header));
+    header.offsets_pos = header.segments_pos
+                       + header.segments_size * sizeof(segment);
+    header.values_pos = hits_file_align(header.offsets_pos
+                                        + header.size * sizeof(uint32_t));
+    header.types_pos = hits->types ? hits_file_align(header.values_pos
+                                     + header.size * header.value_size) : 0;
+
+    if (!(fp = fopen(path, "wb"))) {
+        errf("hits: cannot open %s for writing", path);
+        return 0;
+    }
+    pos = 0;
+    ok = hits_file_write(fp, &header, sizeof(header), &pos);
+    for (i = 0; ok && i < hits->segments_size; i++) {
+        segment[0] = hits->segments[i].base;
+        segment[1] = hits->segments[i].start;
+        ok = fwrite(segment, sizeof(segment), 1, fp) == 1;
+        pos += sizeof(segment);
+    }
+    ok = ok && hits_file_write(fp, hits->offsets,
+                               sizeof(uint32_t) * hits->size, &pos)
+            && hits_file_write(fp, hits->values,
+                               hits->value_size * hits->size, &pos);
+    for (i = 0; ok && hits->types && i < hits->size; i++) {
+        type = hits->types[i];
+        ok = fwrite(&type, sizeof(type), 1, fp) == 1;
+    }
+    ok = !fclose(fp) && ok;
+    if (!ok)
+        errf("hits: error writing %s", path);
+    return ok;
+}
+
+/*
+ * Check that the header describes sections fitting in `file_size` bytes.
+ */
+static int hits_file_check(const struct hits_file_header *header,
+                           uint64_t file_size)
+{
+    uint64_t max = file_size;
+    size_t value_size = (header->flags & HITS_FILE_TYPES)
+        ? sizeof(union value_data)
+        : value_type_sizeof((header->value_type & PTR) ? header->addr_type
+                                                       : header->value_type);
+    if (memcmp(header->magic, HITS_FILE_MAGIC, sizeof(header->magic))) {
+        errf("hits: not a hits file");
+        return 0;
+    }
+    if (header->byte_order != HITS_FILE_BYTE_ORDER) {
+        errf("hits: hits file has foreign byte order");
+        return 0;
+    }
+    if (header->version != HITS_FILE_VERSION) {
+        errf("hits: unsupported hits file version %lu",
+             (unsigned long)header->version);
+        return 0;
+    }
+    if (!value_type_is_valid(header->addr_type)
+            || !value_type_is_int(header->addr_type)
+            || value_type_sizeof(header->addr_type) > sizeof(addr_t)
+            || !value_type_is_valid(header->value_type)
+            || !header->value_size || header->value_size != value_size
+            || header->size > max / sizeof(uint32_t)
+            || header->size > max / header->value_size
+            || header->segments_size > max / (2 * sizeof(uint64_t))
+            || (header->size && !header->segments_size)
+            || header->size != (size_t)header->size
+            || header->segments_size != (size_t)header->segments_size
+            || header->segments_pos > max
+            || header->segments_size * 2 * sizeof(uint64_t)
+               > max - header->segments_pos
+            || header->offsets_pos > max || (header->offsets_pos & 3)
+            || header->size * sizeof(uint32_t) > max - header->offsets_pos
+            || header->values_pos > max || (header->values_pos & 7)
+            || header->size * header->value_size > max - header->values_pos
+            || (header->flags & HITS_FILE_TYPES
+                && (header->types_pos > max || (header->types_pos & 3)
+                    || header->size * sizeof(uint32_t)
+                       > max - header->types_pos))) {
+        errf("hits: corrupted hits file");
+        return 0;
+    }
     return 1;
 }
+
+struct hits *hits_load(const char *path)
+{
+    struct hits_file_header header;
+    struct hits *hits;
+    struct stat st;
+    const uint64_t *segments;
+    char *map;
+    size_t i;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        errf("hits: cannot open %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(header)
+            || read(fd, &header, sizeof(header)) != sizeof(header)) {
+        errf("hits: error reading %s", path);
+        close(fd);
+        return NULL;
+    }
+    if (!hits_file_check(&header, st.st_size)) {
+        close(fd);
+        return NULL;
+    }
+    if ((header.flags & HITS_FILE_TYPES)
+            && sizeof(enum value_type) != sizeof(uint32_t)) {
+        errf("hits: mixed-type hits files are unsupported on this platform");
+        close(fd);
+        return NULL;
+    }
+
+    if (!header.size) {
+        close(fd);
+        return hits_new(header.addr_type, header.value_type);
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        errf("hits: cannot map %s", path);
+        return NULL;
+    }
+    if (!(hits = calloc(1, sizeof(struct hits)))
+            || !(hits->segments = malloc(sizeof(struct hits_segment)
+                                         * header.segments_size))) {
+        errf("hits: out-of-memory for loaded hits");
+        free(hits);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    hits->map = map;
+    hits->map_size = st.st_size;
+    hits->offsets = (uint32_t *)(map + header.offsets_pos);
+    hits->values = map + header.values_pos;
+    if (header.flags & HITS_FILE_TYPES)
+        hits->types = (enum value_type *)(map + header.types_pos);
+    hits->size = hits->capacity = header.size;
+    hits->value_size = header.value_size;
+    hits->addr_type = header.addr_type;
+    hits->value_type = header.value_type;
+
+    /* Segments are converted to the native layout */
+    segments = (const uint64_t *)(map + header.segments_pos);
+    hits->segments_size = hits->segments_capacity = header.segments_size;
+    for (i = 0; i < hits->segments_size; i++) {
+        hits->segments[i].base = (addr_t)segments[2*i];
+        hits->segments[i].start = (size_t)segments[2*i + 1];
+        if (hits->segments[i].base != segments[2*i]
+                || segments[2*i + 1] >= header.size
+                || (i ? hits->segments[i].start < hits->segments[i-1].start
+                      : hits->segments[i].start != 0)) {
+            errf("hits: corrupted hits file segments");
+            hits_delete(hits);
+            return NULL;
+        }
+    }
+    for (i = 0; hits->types && i < hits->size; i++) {
+        if (!value_type_is_valid(hits->types[i])) {
+            errf("hits: corrupted hits file types");
+            hits_delete(hits);
+            return NULL;
+        }
+    }
+    return hits;
+}
+
+size_t hits_bytes(const struct hits *hits)
+{
+    size_t bytes = sizeof(struct hits)
+                 + sizeof(struct hits_segment) * hits->segments_capacity;
+    /* Spilled arrays are in the page cache, not on the heap */
+    if (!hits->spill)
+        bytes += hits_array_bytes(hits->capacity, hits->value_size,
+                                  !!hits->types);
+    return bytes;
+}
+
+addr_t hits_addr(const struct hits *hits, size_t i)
+{
+    size_t lo = 0, hi = hits->segments_size;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hits->segments[mid].start <= i)
+            lo = mid;
+        else hi = mid;
+    }
+    return hits->segments[lo].base + hits->offsets[i];
+}
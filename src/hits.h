@@ -3,31 +3,106 @@
 
 #include "defines.h"
 #include "value.h"
+#include <stddef.h>
 #include <stdint.h>
 
 /*
- * Structure representing a hit (a found value) in the target process.
+ * Hits (found values) in the target process stored as structure-of-arrays.
+ *
+ * Addresses are stored as 32-bit offsets relative to the base address of
+ * the segment the hit belongs to. A new segment begins whenever an address
+ * does not fit in the current one (e.g., a hit in the next region that is
+ * more than 4 GiB away, or an address smaller than the segment base).
+ *
+ * Previous values are packed at their natural width. The value type is
+ * stored once per container unless hits of different types are added, in
+ * which case a per-hit types array is allocated.
+ *
+ * Once the arrays of all containers on the heap would exceed
+ * hits_set_memory() bytes, the arrays of the growing container are moved to
+ * unlinked temporary files and mapped from there, so growing
+ * them copies nothing and large hit sets are paged to disk instead of
+ * exhausting memory.
  */
-struct hit {
-    addr_t addr;
-    enum value_type type;
-    union value_data prev;
+struct hits_segment {
+    addr_t base;
+    size_t start; /* index of the first hit in the segment */
 };
 
 struct hits {
-    struct hit *items;
+    uint32_t *offsets;
+    char *values;
+    enum value_type *types; /* NULL unless hits have mixed types */
     size_t size, capacity;
+    size_t value_size; /* width of each packed value in bytes */
+
+    struct hits_segment *segments;
+    size_t segments_size, segments_capacity;
+
     enum value_type addr_type;
     enum value_type value_type;
+
+    /* File mapping the arrays of read-only hits (see hits_load()) */
+    void *map;
+    size_t map_size;
+
+    /* Temporary files of spilled arrays (NULL if on the heap) */
+    struct hits_spill *spill;
+    size_t heap; /* bytes accounted against the budget (0 if spilled) */
 };
 
+/* Default memory budget of the arrays of all hits containers */
+#define HITS_MEMORY_DEFAULT ((size_t)512 * 1024 * 1024)
+
 /*
- * (De)allocate a hits container.
+ * Set the memory budget (in bytes) shared by the arrays of all hits
+ * containers before they are spilled to temporary files (0 never spills).
  */
-struct hits *hits_new();
+void hits_set_memory(size_t bytes);
+
+/*
+ * (De)allocate a hits container for values of `value_type`.
+ */
+struct hits *hits_new(enum value_type addr_type, enum value_type value_type);
 void hits_delete(struct hits *hits);
 
 int hits_add(struct hits *hits, addr_t addr, enum value_type type,
              union value_data *data);
 
+/*
+ * Remove all hits keeping the allocated memory.
+ */
+void hits_clear(struct hits *hits);
+
+/*
+ * Create a copy of hits.
+ */
+struct hits *hits_copy(const struct hits *hits);
+
+/*
+ * Save hits to a file. Returns zero on error.
+ */
+int hits_save(const struct hits *hits, const char *path);
+
+/*
+ * Load hits saved with hits_save(). If possible, the arrays are used directly
+ * from a read-only mapping of the file, in which case no hits can be added.
+ * Returns NULL on error.
+ */
+struct hits *hits_load(const char *path);
+
+/*
+ * Memory allocated for the hits container in bytes.
+ */
+size_t hits_bytes(const struct hits *hits);
+
+/*
+ * Accessors of the i'th hit.
+ */
+addr_t hits_addr(const struct hits *hits, size_t i);
+#define hits_type(hits, i) \
+    ((hits)->types ? (hits)->types[(i)] : (hits)->value_type)
+#define hits_prev(hits, i) \
+    ((union value_data *)((hits)->values + (i) * (hits)->value_size))
+
 #endif
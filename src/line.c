@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L /* for fileno(3) */
 #include "line.h"
 #include "ramfuck.h"
 
@@ -10,6 +11,10 @@ struct linereader {
     char *(*get_line)(struct linereader *reader, const char *prompt);
     void (*free_line)(struct linereader *reader, char *line);
     int (*add_history)(struct linereader *reader, const char *line);
+
+    /* Called with the input fd before blocking for a line */
+    void (*wait)(void *arg, int fd);
+    void *wait_arg;
 };
 
 #if 1
@@ -53,6 +58,8 @@ static char *fgets_reader_get_line(struct linereader *reader,
         return NULL;
 
     /* Get next line */
+    if (reader->wait)
+        reader->wait(reader->wait_arg, fileno(this->in));
     while (fgets(&this->buf[this->len], this->capacity - this->len, this->in)) {
         this->len += strlen(&this->buf[this->len]);
         if (this->buf[this->len-1] == '\n') {
@@ -99,7 +106,8 @@ static struct fgets_reader *fgets_reader_get(FILE *in)
             fgets_reader_put,
             fgets_reader_get_line,
             fgets_reader_free_line,
-            fgets_reader_add_history
+            fgets_reader_add_history,
+            NULL, NULL
         },
         NULL, NULL, 0, BUFSIZ
     };
@@ -108,6 +116,8 @@ static struct fgets_reader *fgets_reader_get(FILE *in)
     if (this) {
         memcpy(this, &reader_c_init, sizeof(struct fgets_reader));
         this->in = in;
+        /* Unbuffered, so that a readable fd means an unread line */
+        setvbuf(in, NULL, _IONBF, 0);
         this->buf = malloc(this->capacity);
         if (!this->buf) {
             errf("line: out-of-memory for fgets_reader buffer of BUFSIZ bytes");
@@ -137,6 +147,13 @@ void linereader_close(struct linereader *reader)
         fclose(in);
 }
 
+void linereader_set_wait(struct linereader *reader,
+                         void (*wait)(void *arg, int fd), void *arg)
+{
+    reader->wait = wait;
+    reader->wait_arg = arg;
+}
+
 char *linereader_get_line(struct linereader *reader, const char *prompt)
 {
     return reader->get_line(reader, prompt);
@@ -14,6 +14,10 @@ FILE *linereader_put(struct linereader *reader);
 /* Release line reader and close its input sream (if still open) */
 void linereader_close(struct linereader *reader);
 
+/* Set a function called with the input fd before blocking for a line */
+void linereader_set_wait(struct linereader *reader,
+                         void (*wait)(void *arg, int fd), void *arg);
+
 /* Get line with prompt message */
 char *linereader_get_line(struct linereader *reader, const char *prompt);
 
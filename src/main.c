@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 1 /* for kill(2) */
+#include "ramfuck.h"
+#include "cli.h"
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+int main(int argc, char *argv[])
+{
+    struct ramfuck ctx;
+    size_t size;
+    int i, j, rc;
+
+    if (!ramfuck_init(&ctx)) {
+        errf("main: out-of-memory for ramfuck context");
+        return 1;
+    }
+
+    if (argc > (i = 1)) {
+        char *end;
+        const char *in = !memcmp(argv[i], "pid://", 6) ? &argv[i][6] : argv[i];
+        unsigned long pid = strtoul(in, &end, 10);
+        if (pid && pid == (pid_t)pid && end != in)  {
+            while (isspace(*end)) end++;
+            if (!*end && !kill(pid, 0))
+                i += !cli_execute_format(&ctx, "attach pid://%lu", pid);
+        } else if (in == argv[i] && strstr(argv[i], "://")) {
+            i += !cli_execute_format(&ctx, "attach %s", argv[i]);
+        }
+    }
+
+    for (j = i, size = 0; j < argc; size += strlen(argv[j++]) + 1);
+    if (size) {
+        char *buffer = malloc(size);
+        if (buffer) {
+            char *p = buffer;
+            for (j = i; j < argc; j++) {
+                size_t len = strlen(argv[j]);
+                memcpy(p, argv[j], len);
+                p += len;
+                *p++ = (j == argc-1) ? '\0' : ' ';
+            }
+            cli_execute(&ctx, buffer);
+            free(buffer);
+        } else {
+            errf("main: out-of-memory for arguments buffer");
+            rc = 2;
+            goto destroy;
+        }
+    }
+
+    if (!ctx.rc) {
+        ramfuck_set_input_stream(&ctx, stdin);
+        cli_main_loop(&ctx);
+    }
+    rc = ctx.rc;
+
+destroy:
+    ramfuck_destroy(&ctx);
+    return rc;
+}
@@ -1,6 +1,8 @@
 #include "opt.h"
 #include "eval.h"
 
+#include <stdint.h>
+
 static struct ast *ast_var_optimize(struct ast *this)
 {
     struct ast_var *var = (struct ast_var *)this;
@@ -100,3 +102,310 @@ struct ast *(*ast_optimize_funcs[AST_TYPES])(struct ast *) = {
     /* AST_AND_COND */ ast_binary_optimize,
     /* AST_OR_COND  */ ast_binary_optimize
 };
+
+/*
+ * Address bounds analysis.
+ */
+struct addr_analysis {
+    struct symbol_table *symtab;
+    size_t sym;
+    enum value_type type;
+    addr_t max;
+};
+
+static void addr_bounds_any(struct addr_bounds *bounds, addr_t max)
+{
+    bounds->min = 0;
+    bounds->max = max;
+    bounds->align = 1;
+    bounds->residue = 0;
+    bounds->empty = 0;
+}
+
+/*
+ * Shrink [min, max] to the first and last address with the right residue.
+ */
+static void addr_bounds_normalize(struct addr_bounds *bounds)
+{
+    addr_t mask = bounds->align - 1, min, max;
+    if (bounds->empty)
+        return;
+    min = bounds->min + ((bounds->residue - bounds->min) & mask);
+    max = bounds->max - ((bounds->max - bounds->residue) & mask);
+    if (min < bounds->min || max > bounds->max || min > max) {
+        bounds->empty = 1;
+        return;
+    }
+    bounds->min = min;
+    bounds->max = max;
+}
+
+static void addr_bounds_intersect(struct addr_bounds *bounds,
+                                  const struct addr_bounds *other)
+{
+    if (bounds->empty || other->empty) {
+        bounds->empty = 1;
+        return;
+    }
+    if (bounds->min < other->min)
+        bounds->min = other->min;
+    if (bounds->max > other->max)
+        bounds->max = other->max;
+    if (bounds->align <= other->align) {
+        if ((other->residue & (bounds->align - 1)) != bounds->residue) {
+            bounds->empty = 1;
+            return;
+        }
+        bounds->align = other->align;
+        bounds->residue = other->residue;
+    } else if ((bounds->residue & (other->align - 1)) != other->residue) {
+        bounds->empty = 1;
+        return;
+    }
+    addr_bounds_normalize(bounds);
+}
+
+void addr_bounds_union(struct addr_bounds *bounds,
+                       const struct addr_bounds *other)
+{
+    addr_t align;
+    if (other->empty)
+        return;
+    if (bounds->empty) {
+        *bounds = *other;
+        return;
+    }
+    if (bounds->min > other->min)
+        bounds->min = other->min;
+    if (bounds->max < other->max)
+        bounds->max = other->max;
+    align = (bounds->align < other->align) ? bounds->align : other->align;
+    while ((bounds->residue & (align - 1)) != (other->residue & (align - 1)))
+        align >>= 1;
+    bounds->align = align;
+    bounds->residue &= align - 1;
+}
+
+/*
+ * Check if `ast` is the address symbol (possibly cast to a type holding all
+ * of its values).
+ */
+static int is_addr(const struct addr_analysis *a, struct ast *ast)
+{
+    struct ast_var *var;
+    if (ast->node_type == AST_CAST && value_type_is_int(ast->value_type)
+            && (ast->value_type == a->type || value_type_sizeof(ast->value_type)
+                                              > value_type_sizeof(a->type))) {
+        ast = ((struct ast_unary *)ast)->child;
+    }
+    if (ast->node_type != AST_VAR || ast->value_type != a->type)
+        return 0;
+    var = (struct ast_var *)ast;
+    return var->symtab == a->symtab && var->sym == a->sym
+        && var->size == value_type_sizeof(a->type);
+}
+
+/*
+ * Integer constant `ast` as an address. Returns zero if `ast` is not an
+ * integer constant, otherwise -1 if it is negative, 2 if it is too large to
+ * be an address and 1 if *pc was set.
+ */
+static int addr_constant(const struct addr_analysis *a, struct ast *ast,
+                         addr_t *pc)
+{
+    const struct value *v = &((struct ast_value *)ast)->value;
+    if (ast->node_type != AST_VALUE)
+        return 0;
+    switch (v->type) {
+    case S32:
+        if (v->data.s32 < 0)
+            return -1;
+        if ((uint32_t)v->data.s32 > a->max)
+            return 2;
+        *pc = (addr_t)v->data.s32;
+        return 1;
+    case U32:
+        if (v->data.u32 > a->max)
+            return 2;
+        *pc = (addr_t)v->data.u32;
+        return 1;
+#ifndef NO_64BIT_VALUES
+    case S64:
+        if (v->data.s64 < 0)
+            return -1;
+        if ((uint64_t)v->data.s64 > a->max)
+            return 2;
+        *pc = (addr_t)v->data.s64;
+        return 1;
+    case U64:
+        if (v->data.u64 > a->max)
+            return 2;
+        *pc = (addr_t)v->data.u64;
+        return 1;
+#endif
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Bounds of `addr % 2^n == c` or `(addr & 2^n-1) == c` (in either order).
+ */
+static int addr_align_bounds(const struct addr_analysis *a, struct ast *ast,
+                             struct addr_bounds *bounds)
+{
+    struct ast *left = ((struct ast_binary *)ast)->left;
+    struct ast *right = ((struct ast_binary *)ast)->right;
+    struct ast *op, *x = NULL;
+    addr_t n, c;
+
+    if (ast->node_type != AST_EQ)
+        return 0;
+    if (left->node_type == AST_MOD || left->node_type == AST_AND) {
+        op = left;
+    } else if (right->node_type == AST_MOD || right->node_type == AST_AND) {
+        op = right;
+        right = left;
+    } else {
+        return 0;
+    }
+    if (addr_constant(a, right, &c) != 1)
+        return 0;
+
+    left = ((struct ast_binary *)op)->left;
+    if (is_addr(a, left)) {
+        x = ((struct ast_binary *)op)->right;
+    } else if (op->node_type == AST_AND
+               && is_addr(a, ((struct ast_binary *)op)->right)) {
+        x = left;
+    }
+    if (!x || addr_constant(a, x, &n) != 1)
+        return 0;
+    if (op->node_type == AST_AND) {
+        if (n == a->max)
+            return 0;
+        n++;
+    }
+    if (!n || (n & (n - 1)))
+        return 0;
+
+    addr_bounds_any(bounds, a->max);
+    if (c >= n) {
+        bounds->empty = 1;
+        return 1;
+    }
+    bounds->align = n;
+    bounds->residue = c;
+    addr_bounds_normalize(bounds);
+    return 1;
+}
+
+/*
+ * Bounds of `addr OP constant` (or `constant OP addr`).
+ */
+static int addr_compare_bounds(const struct addr_analysis *a, struct ast *ast,
+                               struct addr_bounds *bounds)
+{
+    struct ast *left = ((struct ast_binary *)ast)->left;
+    struct ast *right = ((struct ast_binary *)ast)->right;
+    enum ast_type op = ast->node_type;
+    addr_t c = 0;
+    int k;
+
+    if (op == AST_NEQ)
+        return 0;
+    if (is_addr(a, left)) {
+        k = addr_constant(a, right, &c);
+    } else if (is_addr(a, right)) {
+        k = addr_constant(a, left, &c);
+        switch (op) {
+        case AST_LT: op = AST_GT; break;
+        case AST_GT: op = AST_LT; break;
+        case AST_LE: op = AST_GE; break;
+        case AST_GE: op = AST_LE; break;
+        default: break;
+        }
+    } else {
+        return 0;
+    }
+    if (!k)
+        return 0;
+
+    addr_bounds_any(bounds, a->max);
+    if (k == -1) {
+        /* Negative constant: every address is greater */
+        bounds->empty = (op != AST_GT && op != AST_GE);
+    } else if (k == 2) {
+        /* Constant above the address range: every address is less */
+        bounds->empty = (op != AST_LT && op != AST_LE);
+    } else {
+        switch (op) {
+        case AST_EQ: bounds->min = bounds->max = c; break;
+        case AST_LT:
+            if (!c) {
+                bounds->empty = 1;
+            } else {
+                bounds->max = c-1;
+            }
+            break;
+        case AST_LE: bounds->max = c; break;
+        case AST_GT:
+            if (c == a->max) {
+                bounds->empty = 1;
+            } else {
+                bounds->min = c+1;
+            }
+            break;
+        case AST_GE: bounds->min = c; break;
+        default: break;
+        }
+    }
+    return 1;
+}
+
+static int addr_bounds_analyze(const struct addr_analysis *a, struct ast *ast,
+                               struct addr_bounds *bounds)
+{
+    struct addr_bounds other;
+    int exact;
+
+    switch (ast->node_type) {
+    case AST_AND_COND:
+        exact = addr_bounds_analyze(a, ((struct ast_binary *)ast)->left,
+                                    bounds);
+        exact &= addr_bounds_analyze(a, ((struct ast_binary *)ast)->right,
+                                     &other);
+        addr_bounds_intersect(bounds, &other);
+        return exact;
+    case AST_OR_COND:
+        addr_bounds_analyze(a, ((struct ast_binary *)ast)->left, bounds);
+        addr_bounds_analyze(a, ((struct ast_binary *)ast)->right, &other);
+        addr_bounds_union(bounds, &other);
+        return 0;
+    case AST_EQ: case AST_LT: case AST_GT: case AST_LE: case AST_GE:
+        if (addr_compare_bounds(a, ast, bounds)
+                || addr_align_bounds(a, ast, bounds))
+            return 1;
+        break;
+    default:
+        break;
+    }
+    addr_bounds_any(bounds, a->max);
+    return 0;
+}
+
+int ast_addr_bounds(struct ast *ast, struct symbol_table *symtab, size_t sym,
+                    enum value_type addr_type, struct addr_bounds *bounds)
+{
+    struct addr_analysis a;
+    a.symtab = symtab;
+    a.sym = sym;
+    a.type = addr_type;
+#if ADDR_BITS == 64
+    a.max = (addr_type == U64) ? UINT64_MAX : UINT32_MAX;
+#else
+    a.max = UINT32_MAX;
+#endif
+    return addr_bounds_analyze(&a, ast, bounds);
+}
@@ -1,13 +1,20 @@
 /*
  * Functions performing simple optimization on AST nodes.
  * For the time being, only simple constant folding is implemented.
+ *
+ * ast_addr_bounds() is a static analysis of an (optimized) AST deriving the
+ * addresses at which the expression can be true from comparisons of the
+ * address symbol against constants.
  */
 
 #ifndef OPTIMIZE_H_INCLUDED
 #define OPTIMIZE_H_INCLUDED
 
+#include "defines.h"
 #include "ast.h"
 
+#include <stddef.h>
+
 /*
  * Optimize an AST.
  *
@@ -17,4 +24,32 @@
 extern struct ast *(*ast_optimize_funcs[AST_TYPES])(struct ast *); 
 #define ast_optimize(ast) (ast_optimize_funcs[(ast)->node_type]((ast)))
 
+/*
+ * Addresses at which an expression can be true: min <= addr <= max and
+ * addr % align == residue (align is a power of two).
+ */
+struct addr_bounds {
+    addr_t min, max;
+    addr_t align, residue;
+    int empty; /* the expression is never true */
+};
+
+/*
+ * Derive address bounds of `ast` for symbol `sym` of `symtab` (of type
+ * `addr_type`). Comparisons (==, <, <=, >, >=) of the address against
+ * constants and alignment tests (addr % 2^n == c, (addr & 2^n-1) == c)
+ * combined with && and || are recognized; anything else is unconstrained.
+ *
+ * Returns non-zero if the expression is true exactly within the bounds, i.e.,
+ * it only tests the address.
+ */
+int ast_addr_bounds(struct ast *ast, struct symbol_table *symtab, size_t sym,
+                    enum value_type addr_type, struct addr_bounds *bounds);
+
+/*
+ * Widen `bounds` to include the addresses of `other` (bounds of a || b).
+ */
+void addr_bounds_union(struct addr_bounds *bounds,
+                       const struct addr_bounds *other);
+
 #endif
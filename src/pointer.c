@@ -0,0 +1,361 @@
+#include "pointer.h"
+#include "config.h"
+#include "target.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Pointer chain search node: a location pointing near the address of its
+ * parent node (root node is the searched address).
+ */
+struct pointer_node {
+    addr_t addr;
+    size_t parent;
+    addr_t offset; /* offset from the pointer value to the parent address */
+};
+
+#define POINTER_ROOT ((size_t)-1)
+
+static int pointer_region_anonymous(const struct region *region)
+{
+    return !region->path || !strcmp(region->path, "[heap]")
+        || !strcmp(region->path, "[stack]");
+}
+
+static int pointer_region_module(const struct region *region)
+{
+    return region->path && region->path[0] != '[';
+}
+
+/*
+ * Find the region containing `addr` or NULL.
+ */
+static const struct region *pointer_map_region(const struct pointer_map *map,
+                                               addr_t addr)
+{
+    size_t lo = 0, hi = map->regions_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct region *region = &map->regions[mid];
+        if (addr < region->start) {
+            hi = mid;
+        } else if (addr - region->start >= region->size) {
+            lo = mid + 1;
+        } else {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+static int pointer_compare(const void *a, const void *b)
+{
+    const struct pointer *x = a, *y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int pointer_map_add(struct pointer_map *map, addr_t addr, addr_t value)
+{
+    struct pointer *pointer;
+    if (map->pointers_size == map->pointers_capacity) {
+        size_t capacity = map->pointers_capacity
+                        ? 2 * map->pointers_capacity : 4096;
+        struct pointer *new;
+        if (!(new = realloc(map->pointers, sizeof(struct pointer) * capacity)))
+            return 0;
+        map->pointers = new;
+        map->pointers_capacity = capacity;
+    }
+    pointer = &map->pointers[map->pointers_size++];
+    pointer->value = value;
+    pointer->addr = addr;
+    return 1;
+}
+
+/*
+ * Add the aligned pointers to readable memory in `len` bytes of `data`.
+ */
+static int pointer_map_add_chunk(struct pointer_map *map, addr_t addr,
+                                 const char *data, size_t len)
+{
+    const struct region *last = &map->regions[map->regions_size - 1];
+    addr_t low = map->regions[0].start;
+    addr_t high = last->start + (last->size - 1);
+    size_t pos;
+
+    for (pos = 0; pos + map->size <= len; pos += map->size) {
+        addr_t value;
+#if ADDR_BITS == 64
+        if (map->size == sizeof(uint64_t)) {
+            uint64_t u64;
+            memcpy(&u64, data + pos, sizeof(uint64_t));
+            value = u64;
+        } else
+#endif
+        {
+            uint32_t u32;
+            memcpy(&u32, data + pos, sizeof(uint32_t));
+            value = u32;
+        }
+        if (value < low || value > high || !pointer_map_region(map, value))
+            continue;
+        if (!pointer_map_add(map, addr + pos, value))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Scan region memory for pointers in chunks. Chunks of anonymous memory
+ * without present or swapped pages and chunks that cannot be read are
+ * skipped.
+ */
+static int pointer_map_scan_region(struct pointer_map *map,
+                                   struct target *target,
+                                   const struct region *region, char *buf,
+                                   size_t chunk, unsigned char *flags)
+{
+    const unsigned char mask = TARGET_PAGE_PRESENT | TARGET_PAGE_SWAPPED;
+    size_t page_size = target_page_size();
+    int anonymous = pointer_region_anonymous(region);
+    addr_t off, len;
+
+    for (off = 0; off < region->size; off += len) {
+        addr_t addr = region->start + off;
+        const char *data;
+        if ((len = region->size - off) > chunk)
+            len = chunk;
+        if (anonymous && target->page_flags(target, addr, len, flags)) {
+            size_t page, pages;
+            pages = (addr + len - 1) / page_size - addr / page_size + 1;
+            for (page = 0; page < pages && !(flags[page] & mask); page++);
+            if (page == pages)
+                continue;
+        }
+        if (!(data = target->map(target, addr, len))) {
+            if (!target->read(target, addr, buf, len))
+                continue;
+            data = buf;
+        }
+        map->bytes += len;
+        if (!pointer_map_add_chunk(map, addr, data, len))
+            return 0;
+    }
+    return 1;
+}
+
+struct pointer_map *pointer_map_new(struct ramfuck *ctx)
+{
+    struct target *target = ctx->target;
+    struct pointer_map *map;
+    struct region *mr;
+    unsigned char *flags;
+    size_t i, capacity, chunk;
+    char *buf;
+
+    if (!(map = calloc(1, sizeof(struct pointer_map)))) {
+        errf("pointer: out-of-memory for pointer map");
+        return NULL;
+    }
+    map->size = ctx->addr_size;
+
+    capacity = 0;
+    for (mr = target->region_first(target); mr; mr = target->region_next(mr)) {
+        if (!(mr->prot & MEM_READ) || mr->size != (size_t)mr->size)
+            continue;
+        if (map->regions_size == capacity) {
+            struct region *new;
+            capacity = capacity ? 2 * capacity : 16;
+            if (!(new = realloc(map->regions,
+                                sizeof(struct region) * capacity))) {
+                errf("pointer: out-of-memory for regions");
+                while ((mr = target->region_next(mr)));
+                goto fail;
+            }
+            map->regions = new;
+        }
+        if (!region_copy(&map->regions[map->regions_size], mr)) {
+            errf("pointer: out-of-memory for regions");
+            while ((mr = target->region_next(mr)));
+            goto fail;
+        }
+        map->regions_size++;
+    }
+    if (!map->regions_size) {
+        errf("pointer: no readable memory regions");
+        goto fail;
+    }
+
+    if (!(chunk = ctx->config->search.chunk
+                - ctx->config->search.chunk % map->size))
+        chunk = map->size;
+    buf = malloc(chunk);
+    flags = malloc(chunk / target_page_size() + 2);
+    if (!buf || !flags) {
+        errf("pointer: out-of-memory for memory buffer");
+        free(flags);
+        free(buf);
+        goto fail;
+    }
+
+    ramfuck_break(ctx);
+    for (i = 0; i < map->regions_size; i++) {
+        if (!pointer_map_scan_region(map, target, &map->regions[i], buf,
+                                     chunk, flags)) {
+            errf("pointer: out-of-memory for pointers");
+            ramfuck_continue(ctx);
+            free(flags);
+            free(buf);
+            goto fail;
+        }
+    }
+    ramfuck_continue(ctx);
+    free(flags);
+    free(buf);
+
+    qsort(map->pointers, map->pointers_size, sizeof(struct pointer),
+          pointer_compare);
+    return map;
+
+fail:
+    pointer_map_delete(map);
+    return NULL;
+}
+
+void pointer_map_delete(struct pointer_map *map)
+{
+    while (map->regions_size)
+        region_destroy(&map->regions[--map->regions_size]);
+    free(map->regions);
+    free(map->pointers);
+    free(map);
+}
+
+/*
+ * Index of the first pointer with value of at least `value`.
+ */
+static size_t pointer_map_lower_bound(const struct pointer_map *map,
+                                      addr_t value)
+{
+    size_t lo = 0, hi = map->pointers_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->pointers[mid].value < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int pointer_map_emit(const struct pointer_map *map,
+                            const struct pointer_node *nodes, size_t node,
+                            const struct pointer *pointer,
+                            const struct region *region,
+                            int (*callback)(const struct pointer_chain *,
+                                            void *),
+                            void *arg)
+{
+    struct pointer_chain chain;
+    size_t i;
+
+    chain.base = pointer->addr;
+    chain.region = region;
+    chain.module = region->start;
+    for (i = 0; i < map->regions_size; i++) {
+        if (map->regions[i].path && !strcmp(map->regions[i].path,
+                                            region->path)) {
+            chain.module = map->regions[i].start;
+            break;
+        }
+    }
+    chain.offsets[0] = nodes[node].addr - pointer->value;
+    for (chain.depth = 1; nodes[node].parent != POINTER_ROOT;
+         node = nodes[node].parent) {
+        chain.offsets[chain.depth++] = nodes[node].offset;
+    }
+    return callback(&chain, arg);
+}
+
+int pointer_map_scan(const struct pointer_map *map, addr_t addr,
+                     size_t depth, addr_t offset,
+                     int (*callback)(const struct pointer_chain *, void *),
+                     void *arg)
+{
+    struct pointer_node *nodes;
+    size_t nodes_size, capacity;
+    size_t begin, end, level;
+    unsigned char *seen;
+    int ok = 1;
+
+    if (depth > POINTER_DEPTH_MAX)
+        depth = POINTER_DEPTH_MAX;
+    capacity = 1024;
+    nodes = malloc(sizeof(struct pointer_node) * capacity);
+    seen = calloc(map->pointers_size ? map->pointers_size : 1, 1);
+    if (!nodes || !seen) {
+        errf("pointer: out-of-memory for pointer scan");
+        free(seen);
+        free(nodes);
+        return 0;
+    }
+    nodes[0].addr = addr;
+    nodes[0].parent = POINTER_ROOT;
+    nodes[0].offset = 0;
+    nodes_size = 1;
+
+    /* Every pointer location is visited at most once (at its lowest depth) */
+    begin = 0;
+    end = nodes_size;
+    for (level = 1; ok && level <= depth && begin < end; level++) {
+        size_t node;
+        for (node = begin; ok && node < end; node++) {
+            addr_t target = nodes[node].addr;
+            addr_t low = (target >= offset) ? target - offset : 0;
+            size_t i = pointer_map_lower_bound(map, low);
+            for (; i < map->pointers_size && map->pointers[i].value <= target;
+                 i++) {
+                const struct pointer *pointer = &map->pointers[i];
+                const struct region *region;
+                if (seen[i] || pointer->addr == addr)
+                    continue;
+                seen[i] = 1;
+                region = pointer_map_region(map, pointer->addr);
+                if (region && pointer_region_module(region)) {
+                    if (!(ok = pointer_map_emit(map, nodes, node, pointer,
+                                                region, callback, arg)))
+                        break;
+                    continue;
+                }
+                if (level == depth)
+                    continue;
+                if (nodes_size == capacity) {
+                    struct pointer_node *new;
+                    capacity *= 2;
+                    if (!(new = realloc(nodes, sizeof(struct pointer_node)
+                                               * capacity))) {
+                        errf("pointer: out-of-memory for pointer scan");
+                        ok = 0;
+                        break;
+                    }
+                    nodes = new;
+                }
+                nodes[nodes_size].addr = pointer->addr;
+                nodes[nodes_size].parent = node;
+                nodes[nodes_size].offset = target - pointer->value;
+                nodes_size++;
+            }
+        }
+        begin = end;
+        end = nodes_size;
+    }
+
+    free(seen);
+    free(nodes);
+    return ok;
+}
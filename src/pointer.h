@@ -0,0 +1,75 @@
+/*
+ * Pointer maps for finding pointer chains to an address.
+ *
+ * A pointer map is a reverse index from pointed-to addresses to the
+ * locations holding the pointers, built by scanning the readable memory of
+ * the target once. pointer_map_scan() searches the index breadth-first from
+ * an address back to locations in module-backed (file-path) regions without
+ * reading the target again.
+ */
+
+#ifndef POINTER_H_INCLUDED
+#define POINTER_H_INCLUDED
+
+#include "defines.h"
+#include "ramfuck.h"
+#include "target.h"
+
+#include <stddef.h>
+
+/* Maximum length of a pointer chain */
+#define POINTER_DEPTH_MAX 16
+
+struct pointer {
+    addr_t value; /* pointed-to address */
+    addr_t addr;  /* location holding the pointer */
+};
+
+struct pointer_map {
+    size_t size; /* size of pointers in bytes */
+
+    /* Readable regions in address order */
+    struct region *regions;
+    size_t regions_size;
+
+    /* Pointers to readable memory sorted by value (and location) */
+    struct pointer *pointers;
+    size_t pointers_size, pointers_capacity;
+    size_t bytes; /* bytes scanned */
+};
+
+/*
+ * Chain of pointers from a module-backed location to an address: the address
+ * is reached by dereferencing `base`, adding offsets[0], dereferencing the
+ * result, adding offsets[1] and so on until offsets[depth-1] is added.
+ */
+struct pointer_chain {
+    addr_t base;
+    const struct region *region; /* region of base */
+    addr_t module;               /* start of the first region of the module */
+    size_t depth;
+    addr_t offsets[POINTER_DEPTH_MAX];
+};
+
+/*
+ * Build a pointer map of the target memory for pointers of ctx->addr_size.
+ */
+struct pointer_map *pointer_map_new(struct ramfuck *ctx);
+
+/*
+ * Delete pointer map and release its memory.
+ */
+void pointer_map_delete(struct pointer_map *map);
+
+/*
+ * Find the shortest chains of at most `depth` pointers with offsets of at
+ * most `offset` from module-backed locations to `addr`. The callback is
+ * called for every chain in order of depth and the search is stopped if it
+ * returns zero. Returns zero if out of memory or stopped.
+ */
+int pointer_map_scan(const struct pointer_map *map, addr_t addr,
+                     size_t depth, addr_t offset,
+                     int (*callback)(const struct pointer_chain *, void *),
+                     void *arg);
+
+#endif
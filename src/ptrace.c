@@ -11,18 +11,16 @@
 
 int ptrace_attach(pid_t pid)
 {
-    int status;
+    return ptrace_attach_request(pid) && ptrace_wait_stopped(pid);
+}
 
+int ptrace_attach_request(pid_t pid)
+{
     if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) == -1) {
         perror("ptrace(ATTACH)");
         return 0;
     }
-    if (waitpid(pid, &status, 0) == -1) {
-        perror("waitpid(ATTACH)");
-        return 0;
-    }
-
-    return !!WIFSTOPPED(status);
+    return 1;
 }
 
 int ptrace_detach(pid_t pid)
@@ -36,27 +34,80 @@ int ptrace_detach(pid_t pid)
 
 int ptrace_break(pid_t pid)
 {
-    int status;
+    return ptrace_break_request(pid) && ptrace_wait_stopped(pid);
+}
+
+int ptrace_break_request(pid_t pid)
+{
     if (kill(pid, SIGSTOP) == -1) {
         perror("ptrace(BREAK)");
         return 0;
     }
-    if (waitpid(pid, &status, 0) == -1) {
-        perror("waitpid(BREAK))");
+    return 1;
+}
+
+/*
+ * Signal to pass on when restarting the tracee from the stop of `status`.
+ * Group-stops (which PTRACE_GETSIGINFO fails for) deliver no signal.
+ */
+static int ptrace_stop_signal(pid_t pid, int status)
+{
+    siginfo_t si;
+    if ((status >> 16) == PTRACE_EVENT_STOP)
+        return 0;
+    if (ptrace(PTRACE_GETSIGINFO, pid, NULL, &si) == -1)
         return 0;
+    return WSTOPSIG(status);
+}
+
+int ptrace_wait_stopped(pid_t pid)
+{
+    int status;
+    for (;;) {
+        if (waitpid(pid, &status, 0) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("waitpid(STOP)");
+            return 0;
+        }
+        if (!WIFSTOPPED(status))
+            return 0;
+        /* Our own SIGSTOP (sent by attach or break) */
+        if (WSTOPSIG(status) == SIGSTOP || (status >> 16) == PTRACE_EVENT_STOP)
+            return 1;
+        /* Other signals the tracee got meanwhile are passed on */
+        if (!ptrace_continue(pid, ptrace_stop_signal(pid, status)))
+            return 0;
     }
-    return !!WIFSTOPPED(status);
 }
 
-int ptrace_continue(pid_t pid)
+int ptrace_continue(pid_t pid, int sig)
 {
-    if (ptrace(PTRACE_CONT, pid, NULL, NULL) == -1) {
+    if (ptrace(PTRACE_CONT, pid, NULL, (void *)(long)sig) == -1) {
         perror("ptrace(CONT)");
         return 0;
     }
     return 1;
 }
 
+int ptrace_service(pid_t pid)
+{
+    int status;
+    pid_t rc;
+    while ((rc = waitpid(pid, &status, WNOHANG)) != 0) {
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        if (!WIFSTOPPED(status))
+            return 0;
+        if (!ptrace_continue(pid, ptrace_stop_signal(pid, status)))
+            return 0;
+    }
+    return 1;
+}
+
 int ptrace_read(pid_t pid, const void *addr, void *buf, size_t len)
 {
     int errnold = errno;
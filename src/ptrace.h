@@ -12,10 +12,25 @@ int ptrace_attach(pid_t pid);
 int ptrace_detach(pid_t pid);
 
 /*
- * Break/continue process.
+ * Break/continue process. Stops for other signals than the SIGSTOP of the
+ * break are passed on; ptrace_continue() delivers `sig` (if nonzero).
  */
 int ptrace_break(pid_t pid);
-int ptrace_continue(pid_t pid);
+int ptrace_continue(pid_t pid, int sig);
+
+/*
+ * Restart a running tracee from the stops it entered since, passing their
+ * signals on. Returns zero if the tracee is gone.
+ */
+int ptrace_service(pid_t pid);
+
+/*
+ * Attach and break without waiting for the process to stop, which is done
+ * with ptrace_wait_stopped() (so that many processes can be stopped at once).
+ */
+int ptrace_attach_request(pid_t pid);
+int ptrace_break_request(pid_t pid);
+int ptrace_wait_stopped(pid_t pid);
 
 /*
  * Read & write data.
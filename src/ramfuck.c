@@ -1,14 +1,21 @@
-#define _DEFAULT_SOURCE /* snprintf(3) vfprintf(3) */
+#define _DEFAULT_SOURCE /* snprintf(3) vfprintf(3) poll(2) */
 #include "ramfuck.h"
 #include "config.h"
 #include "cli.h"
+#include "freeze.h"
+#include "history.h"
 #include "hits.h"
 #include "line.h"
+#include "pointer.h"
 #include "ptrace.h"
+#include "search.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "target.h"
+#include "watch.h"
 
-#include <ctype.h>
-#include <signal.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,8 +79,21 @@ int ramfuck_init(struct ramfuck *ctx)
     ctx->breaks = 0;
     ctx->addr_size = sizeof(uint32_t);
     ctx->hits = NULL;
-    ctx->undo = NULL;
-    ctx->redo = NULL;
+    if (!(ctx->history = history_new())) {
+        config_delete(ctx->config);
+        return 0;
+    }
+    ctx->snapshot = NULL;
+    ctx->pointers = NULL;
+    ctx->watch = NULL;
+    ctx->freezer = NULL;
+    ctx->search_cache = NULL;
+    ctx->dirty_clears = 0;
+    if (!(ctx->stats = stats_new())) {
+        history_delete(ctx->history);
+        config_delete(ctx->config);
+        return 0;
+    }
     return 1;
 }
 
@@ -82,6 +102,10 @@ void ramfuck_destroy(struct ramfuck *ctx)
     if (!ramfuck_dead(ctx)) {
         ctx->state = DEAD;
         ctx->rc = 0;
+        if (ctx->freezer) {
+            freezer_delete(ctx->freezer);
+            ctx->freezer = NULL;
+        }
         if (ctx->config) {
             config_delete(ctx->config);
             ctx->config = NULL;
@@ -90,6 +114,10 @@ void ramfuck_destroy(struct ramfuck *ctx)
             linereader_close(ctx->linereader);
             ctx->linereader = NULL;
         }
+        if (ctx->watch) {
+            watch_stop(ctx->watch);
+            ctx->watch = NULL;
+        }
         if (ctx->target) {
             if (!ctx->breaks)
                 ctx->target->stop(ctx->target);
@@ -98,17 +126,26 @@ void ramfuck_destroy(struct ramfuck *ctx)
         }
         ctx->breaks = 0;
         ctx->addr_size = 0;
-        if (ctx->hits) {
-            hits_delete(ctx->hits);
-            ctx->hits = NULL;
+        if (ctx->history) {
+            history_delete(ctx->history);
+            ctx->history = NULL;
+        }
+        ctx->hits = NULL;
+        if (ctx->snapshot) {
+            snapshot_delete(ctx->snapshot);
+            ctx->snapshot = NULL;
+        }
+        if (ctx->pointers) {
+            pointer_map_delete(ctx->pointers);
+            ctx->pointers = NULL;
         }
-        if (ctx->undo) {
-            hits_delete(ctx->undo);
-            ctx->undo = NULL;
+        if (ctx->search_cache) {
+            search_cache_delete(ctx->search_cache);
+            ctx->search_cache = NULL;
         }
-        if (ctx->redo) {
-            hits_delete(ctx->redo);
-            ctx->redo = NULL;
+        if (ctx->stats) {
+            stats_delete(ctx->stats);
+            ctx->stats = NULL;
         }
     }
 }
@@ -118,11 +155,30 @@ void ramfuck_quit(struct ramfuck *ctx)
     ctx->state = QUITTING;
 }
 
+void ramfuck_wait_input(struct ramfuck *ctx, int fd)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (ctx->target && !ctx->breaks && ctx->target->idle(ctx->target)) {
+        int rc = poll(&pfd, 1, RAMFUCK_IDLE_MS);
+        if (rc > 0 || (rc == -1 && errno != EINTR))
+            break;
+    }
+}
+
+static void ramfuck_wait_line(void *arg, int fd)
+{
+    ramfuck_wait_input((struct ramfuck *)arg, fd);
+}
+
 void ramfuck_set_input_stream(struct ramfuck *ctx, FILE *in)
 {
     if (ctx->linereader)
         linereader_close(ctx->linereader);
-    ctx->linereader = linereader_get(in);
+    if ((ctx->linereader = linereader_get(in)))
+        linereader_set_wait(ctx->linereader, ramfuck_wait_line, ctx);
 }
 
 void ramfuck_close_input_stream(struct ramfuck *ctx)
@@ -189,7 +245,18 @@ int ramfuck_write(struct ramfuck *ctx, addr_t addr, void *buf, size_t len)
 
 int ramfuck_break(struct ramfuck *ctx)
 {
-    if (ctx->target && (ctx->breaks > 0 || ctx->target->stop(ctx->target))) {
+    if (ctx->target && ctx->breaks == 0) {
+        enum target_stop mode = (enum target_stop)ctx->config->target.stop;
+        if (!ctx->target->stop_mode(ctx->target, mode))
+            warnf("ramfuck: changing target stop mode failed");
+    }
+    if (ctx->target && ctx->breaks == 0) {
+        double start = stats_now();
+        if (!ctx->target->stop(ctx->target))
+            return 0;
+        stats_stopped(ctx->stats, stats_now() - start);
+    }
+    if (ctx->target) {
         ctx->breaks++;
         return 1;
     }
@@ -199,35 +266,38 @@ int ramfuck_break(struct ramfuck *ctx)
 int ramfuck_continue(struct ramfuck *ctx)
 {
     if (ctx->target && ctx->breaks > 0) {
-        if (ctx->breaks > 1 || ctx->target->run(ctx->target))
-            ctx->breaks--;
+        if (ctx->breaks == 1) {
+            double start = stats_now();
+            if (!ctx->target->run(ctx->target))
+                return 1;
+            stats_running(ctx->stats, stats_now() - start);
+        }
+        ctx->breaks--;
         return 1;
     }
     return 0;
 }
 
+int ramfuck_clear_soft_dirty(struct ramfuck *ctx)
+{
+    if (!ctx->target || !ctx->target->clear_soft_dirty(ctx->target))
+        return 0;
+    ctx->dirty_clears++;
+    return 1;
+}
+
 void ramfuck_set_hits(struct ramfuck *ctx, struct hits *hits)
 {
     if (ctx->hits != hits) {
-        if (ctx->undo)
-            hits_delete(ctx->undo);
-        ctx->undo = ctx->hits;
-        ctx->hits = hits;
-        if (ctx->redo) {
-            hits_delete(ctx->redo);
-            ctx->redo = NULL;
-        }
+        history_push(ctx->history, hits, ctx->config->history.size);
+        ctx->hits = ctx->history->current;
     }
 }
 
 int ramfuck_undo(struct ramfuck *ctx)
 {
-    if (ctx->undo) {
-        if (ctx->redo)
-            hits_delete(ctx->redo);
-        ctx->redo = ctx->hits;
-        ctx->hits = ctx->undo;
-        ctx->undo = NULL;
+    if (history_undo(ctx->history)) {
+        ctx->hits = ctx->history->current;
         return 1;
     }
     return 0;
@@ -235,68 +305,45 @@ int ramfuck_undo(struct ramfuck *ctx)
 
 int ramfuck_redo(struct ramfuck *ctx)
 {
-    if (ctx->redo) {
-        if (ctx->undo)
-            hits_delete(ctx->undo);
-        ctx->undo = ctx->hits;
-        ctx->hits = ctx->redo;
-        ctx->redo = NULL;
+    if (history_redo(ctx->history)) {
+        ctx->hits = ctx->history->current;
         return 1;
     }
     return 0;
 }
 
-int main(int argc, char *argv[])
+void ramfuck_set_snapshot(struct ramfuck *ctx, struct snapshot *snapshot)
 {
-    struct ramfuck ctx;
-    size_t size;
-    int i, j, rc;
-
-    if (!ramfuck_init(&ctx)) {
-        errf("main: out-of-memory for ramfuck context");
-        return 1;
+    if (ctx->snapshot != snapshot) {
+        if (ctx->snapshot)
+            snapshot_delete(ctx->snapshot);
+        ctx->snapshot = snapshot;
     }
+}
 
-    if (argc > (i = 1)) {
-        char *end;
-        const char *in = !memcmp(argv[i], "pid://", 6) ? &argv[i][6] : argv[i];
-        unsigned long pid = strtoul(in, &end, 10);
-        if (pid && pid == (pid_t)pid && end != in)  {
-            while (isspace(*end)) end++;
-            if (!*end && !kill(pid, 0))
-                i += !cli_execute_format(&ctx, "attach pid://%lu", pid);
-        } else if (in == argv[i] && strstr(argv[i], "://")) {
-            i += !cli_execute_format(&ctx, "attach %s", argv[i]);
-        }
+void ramfuck_set_pointer_map(struct ramfuck *ctx, struct pointer_map *map)
+{
+    if (ctx->pointers != map) {
+        if (ctx->pointers)
+            pointer_map_delete(ctx->pointers);
+        ctx->pointers = map;
     }
+}
 
-    for (j = i, size = 0; j < argc; size += strlen(argv[j++]) + 1);
-    if (size) {
-        char *buffer = malloc(size);
-        if (buffer) {
-            char *p = buffer;
-            for (j = i; j < argc; j++) {
-                size_t len = strlen(argv[j]);
-                memcpy(p, argv[j], len);
-                p += len;
-                *p++ = (j == argc-1) ? '\0' : ' ';
-            }
-            cli_execute(&ctx, buffer);
-            free(buffer);
-        } else {
-            errf("main: out-of-memory for arguments buffer");
-            rc = 2;
-            goto destroy;
-        }
+void ramfuck_set_watch(struct ramfuck *ctx, struct watch *watch)
+{
+    if (ctx->watch != watch) {
+        if (ctx->watch)
+            watch_stop(ctx->watch);
+        ctx->watch = watch;
     }
+}
 
-    if (!ctx.rc) {
-        ramfuck_set_input_stream(&ctx, stdin);
-        cli_main_loop(&ctx);
+void ramfuck_set_freezer(struct ramfuck *ctx, struct freezer *freezer)
+{
+    if (ctx->freezer != freezer) {
+        if (ctx->freezer)
+            freezer_delete(ctx->freezer);
+        ctx->freezer = freezer;
     }
-    rc = ctx.rc;
-
-destroy:
-    ramfuck_destroy(&ctx);
-    return rc;
 }
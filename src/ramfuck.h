@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 void infof(const char *format, ...);
 void warnf(const char *format, ...);
@@ -25,8 +26,14 @@ struct ramfuck {
     int breaks;
     int addr_size;
     struct hits *hits;
-    struct hits *undo;
-    struct hits *redo;
+    struct history *history;
+    struct snapshot *snapshot;
+    struct pointer_map *pointers;
+    struct watch *watch;
+    struct freezer *freezer;
+    struct search_cache *search_cache;
+    struct stats *stats;
+    unsigned long dirty_clears; /* soft-dirty resets of the target */
 };
 
 #define ramfuck_dead(ctx) ((ctx)->state == DEAD)
@@ -37,14 +44,36 @@ int ramfuck_init(struct ramfuck *ctx);
 void ramfuck_destroy(struct ramfuck *ctx);
 void ramfuck_quit(struct ramfuck *ctx);
 
+/* Interval of handling target events while waiting for input */
+#define RAMFUCK_IDLE_MS 10
+
+void ramfuck_set_input_stream(struct ramfuck *ctx, FILE *in);
+
+/*
+ * Wait until `fd` is readable, handling events of the running target (see
+ * target idle()) meanwhile.
+ */
+void ramfuck_wait_input(struct ramfuck *ctx, int fd);
 char *ramfuck_get_line(struct ramfuck *ctx);
 void ramfuck_free_line(struct ramfuck *ctx, char *line);
 
 int ramfuck_break(struct ramfuck *ctx);
 int ramfuck_continue(struct ramfuck *ctx);
 
+/*
+ * Reset soft-dirty bits of the target counting the resets in dirty_clears.
+ * Clean pages only tell of writes since the latest reset, so users of the
+ * bits record dirty_clears and stop trusting them once it has moved.
+ */
+int ramfuck_clear_soft_dirty(struct ramfuck *ctx);
+
 void ramfuck_set_hits(struct ramfuck *ctx, struct hits *hits);
 int ramfuck_undo(struct ramfuck *ctx);
 int ramfuck_redo(struct ramfuck *ctx);
 
+void ramfuck_set_snapshot(struct ramfuck *ctx, struct snapshot *snapshot);
+void ramfuck_set_pointer_map(struct ramfuck *ctx, struct pointer_map *map);
+void ramfuck_set_watch(struct ramfuck *ctx, struct watch *watch);
+void ramfuck_set_freezer(struct ramfuck *ctx, struct freezer *freezer);
+
 #endif
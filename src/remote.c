@@ -0,0 +1,971 @@
+#define _DEFAULT_SOURCE /* for getaddrinfo(3) */
+#include "remote.h"
+
+#include "config.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/* Maximum bytes and elements of a single REMOTE_READ request */
+#define REMOTE_READ_BYTES (4 * 1024 * 1024)
+#define REMOTE_READ_ELEMENTS 4096
+
+/* Maximum payload accepted from the other end */
+#define REMOTE_PAYLOAD_MAX ((uint64_t)1 << 30)
+
+/* Payloads are received (and their buffer grown) this many bytes at a time */
+#define REMOTE_RECV_BYTES (1024 * 1024)
+
+void remote_buf_init(struct remote_buf *buf)
+{
+    buf->data = NULL;
+    buf->size = buf->capacity = 0;
+    buf->error = 0;
+}
+
+void remote_buf_destroy(struct remote_buf *buf)
+{
+    free(buf->data);
+    remote_buf_init(buf);
+}
+
+/*
+ * Make room for `len` more bytes. Returns NULL (and sets error) on failure.
+ */
+static char *remote_reserve(struct remote_buf *buf, size_t len)
+{
+    if (buf->error)
+        return NULL;
+    if (len > buf->capacity - buf->size) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        char *data;
+        while (capacity - buf->size < len) {
+            if (capacity * 2 < capacity) {
+                buf->error = 1;
+                return NULL;
+            }
+            capacity *= 2;
+        }
+        if (!(data = realloc(buf->data, capacity))) {
+            buf->error = 1;
+            return NULL;
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    return buf->data + buf->size;
+}
+
+void remote_put(struct remote_buf *buf, const void *data, size_t len)
+{
+    char *p;
+    if ((p = remote_reserve(buf, len))) {
+        memcpy(p, data, len);
+        buf->size += len;
+    }
+}
+
+void remote_put_u8(struct remote_buf *buf, uint8_t value)
+{
+    remote_put(buf, &value, 1);
+}
+
+void remote_put_u32(struct remote_buf *buf, uint32_t value)
+{
+    unsigned char bytes[4];
+    int i;
+    for (i = 0; i < 4; i++)
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    remote_put(buf, bytes, 4);
+}
+
+void remote_put_u64(struct remote_buf *buf, uint64_t value)
+{
+    unsigned char bytes[8];
+    int i;
+    for (i = 0; i < 8; i++)
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    remote_put(buf, bytes, 8);
+}
+
+void remote_put_bytes(struct remote_buf *buf, const void *data, size_t len)
+{
+    remote_put_u64(buf, len);
+    remote_put(buf, data, len);
+}
+
+/*
+ * Run-length encode `len` bytes to at most `max` bytes at `out`. A control
+ * byte c < 128 is followed by c+1 literal bytes and c >= 128 by a byte
+ * repeated c-125 times. Returns the encoded length or 0 if it exceeds max.
+ */
+static size_t remote_rle_encode(const unsigned char *in, size_t len,
+                                unsigned char *out, size_t max)
+{
+    size_t i = 0, o = 0, literal = 0;
+    while (i < len) {
+        size_t run = 1;
+        while (i + run < len && run < 130 && in[i + run] == in[i])
+            run++;
+        if (run >= 3) {
+            if (o + 2 > max)
+                return 0;
+            out[o++] = (unsigned char)(run + 125);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        /* Collect literals until the next run of at least 3 bytes */
+        literal = i;
+        while (i < len && i - literal < 128) {
+            if (i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2])
+                break;
+            i++;
+        }
+        if (o + 1 + (i - literal) > max)
+            return 0;
+        out[o++] = (unsigned char)(i - literal - 1);
+        memcpy(out + o, in + literal, i - literal);
+        o += i - literal;
+    }
+    return o;
+}
+
+static int remote_rle_decode(const unsigned char *in, size_t size,
+                             unsigned char *out, size_t len)
+{
+    size_t i = 0, o = 0;
+    while (i < size) {
+        unsigned int c = in[i++];
+        size_t n;
+        if (c < 128) {
+            n = c + 1;
+            if (n > size - i || n > len - o)
+                return 0;
+            memcpy(out + o, in + i, n);
+            i += n;
+        } else {
+            n = c - 125;
+            if (i == size || n > len - o)
+                return 0;
+            memset(out + o, in[i++], n);
+        }
+        o += n;
+    }
+    return o == len;
+}
+
+void remote_put_data(struct remote_buf *buf, const void *data, size_t len)
+{
+    if (len >= REMOTE_RLE_MIN) {
+        size_t header = 1 + 8 + 8, encoded;
+        char *p;
+        if (!(p = remote_reserve(buf, header + len)))
+            return;
+        encoded = remote_rle_encode((const unsigned char *)data, len,
+                                    (unsigned char *)p + header,
+                                    len - len / 8);
+        if (encoded) {
+            remote_put_u8(buf, REMOTE_DATA_RLE);
+            remote_put_u64(buf, len);
+            remote_put_u64(buf, encoded);
+            buf->size += encoded;
+            return;
+        }
+    }
+    remote_put_u8(buf, REMOTE_DATA_RAW);
+    remote_put_bytes(buf, data, len);
+}
+
+void remote_put_hits(struct remote_buf *buf, const struct hits *hits)
+{
+    size_t i;
+    remote_put_u32(buf, hits->addr_type);
+    remote_put_u32(buf, hits->value_type);
+    remote_put_u64(buf, hits->size);
+    for (i = 0; i < hits->size && !buf->error; i++) {
+        enum value_type type = hits_type(hits, i);
+        remote_put_u64(buf, hits_addr(hits, i));
+        remote_put_u32(buf, type);
+        remote_put(buf, hits_prev(hits, i),
+                   value_type_sizeof((type & PTR) ? hits->addr_type : type));
+    }
+}
+
+const char *remote_get(struct remote_msg *msg, size_t len)
+{
+    const char *p = msg->p;
+    if (msg->error || len > (size_t)(msg->end - msg->p)) {
+        msg->error = 1;
+        return NULL;
+    }
+    msg->p += len;
+    return p;
+}
+
+uint8_t remote_get_u8(struct remote_msg *msg)
+{
+    const char *p = remote_get(msg, 1);
+    return p ? (uint8_t)*p : 0;
+}
+
+uint32_t remote_get_u32(struct remote_msg *msg)
+{
+    const unsigned char *p = (const unsigned char *)remote_get(msg, 4);
+    uint32_t value = 0;
+    int i;
+    for (i = 0; p && i < 4; i++)
+        value |= (uint32_t)p[i] << (8 * i);
+    return value;
+}
+
+uint64_t remote_get_u64(struct remote_msg *msg)
+{
+    const unsigned char *p = (const unsigned char *)remote_get(msg, 8);
+    uint64_t value = 0;
+    int i;
+    for (i = 0; p && i < 8; i++)
+        value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+const char *remote_get_bytes(struct remote_msg *msg, size_t *plen)
+{
+    uint64_t len = remote_get_u64(msg);
+    if (len != (size_t)len) {
+        msg->error = 1;
+        return NULL;
+    }
+    *plen = (size_t)len;
+    return remote_get(msg, *plen);
+}
+
+int remote_get_data(struct remote_msg *msg, void *out, size_t *plen)
+{
+    uint8_t encoding = remote_get_u8(msg);
+    const char *p;
+    uint64_t len;
+    size_t size;
+
+    if (encoding == REMOTE_DATA_RAW) {
+        if (!(p = remote_get_bytes(msg, &size)) || size > *plen)
+            return 0;
+        memcpy(out, p, size);
+        *plen = size;
+        return 1;
+    }
+    if (encoding == REMOTE_DATA_RLE) {
+        len = remote_get_u64(msg);
+        if (!(p = remote_get_bytes(msg, &size)) || len > *plen
+                || !remote_rle_decode((const unsigned char *)p, size,
+                                      (unsigned char *)out, (size_t)len)) {
+            msg->error = 1;
+            return 0;
+        }
+        *plen = (size_t)len;
+        return 1;
+    }
+    if (encoding != REMOTE_DATA_NONE)
+        msg->error = 1;
+    return 0;
+}
+
+struct hits *remote_get_hits(struct remote_msg *msg)
+{
+    enum value_type addr_type = (enum value_type)remote_get_u32(msg);
+    enum value_type value_type = (enum value_type)remote_get_u32(msg);
+    uint64_t i, n = remote_get_u64(msg);
+    struct hits *hits;
+
+    if (msg->error || !value_type_is_valid(addr_type)
+            || !value_type_is_int(addr_type)
+            || value_type_sizeof(addr_type) > sizeof(addr_t)
+            || !value_type_is_valid(value_type)) {
+        msg->error = 1;
+        return NULL;
+    }
+    if (!(hits = hits_new(addr_type, value_type)))
+        return NULL;
+    for (i = 0; i < n; i++) {
+        union value_data data;
+        uint64_t addr = remote_get_u64(msg);
+        enum value_type type = (enum value_type)remote_get_u32(msg);
+        size_t size = value_type_sizeof((type & PTR) ? addr_type : type);
+        const char *p;
+        if (!value_type_is_valid(type) || size > sizeof(data)
+                || !(p = remote_get(msg, size))
+                || (addr_t)addr != addr) {
+            msg->error = 1;
+            break;
+        }
+        memcpy(&data, p, size);
+        if (!hits_add(hits, (addr_t)addr, type, &data))
+            break;
+    }
+    if (i < n) {
+        hits_delete(hits);
+        return NULL;
+    }
+    return hits;
+}
+
+static int remote_write_all(int fd, const void *data, size_t len)
+{
+    while (len) {
+        ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        data = (const char *)data + ret;
+        len -= ret;
+    }
+    return 1;
+}
+
+static int remote_read_all(int fd, void *data, size_t len)
+{
+    while (len) {
+        ssize_t ret = recv(fd, data, len, 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        data = (char *)data + ret;
+        len -= ret;
+    }
+    return 1;
+}
+
+int remote_send(int fd, uint32_t op, const struct remote_buf *payload)
+{
+    struct remote_buf header;
+    int ok;
+    if (payload->error)
+        return 0;
+    remote_buf_init(&header);
+    remote_put_u32(&header, op);
+    remote_put_u64(&header, payload->size);
+    ok = !header.error && remote_write_all(fd, header.data, header.size)
+      && remote_write_all(fd, payload->data, payload->size);
+    remote_buf_destroy(&header);
+    return ok;
+}
+
+int remote_recv(int fd, uint32_t *pop, struct remote_buf *payload)
+{
+    char header[12];
+    struct remote_msg msg;
+    uint64_t len;
+
+    if (!remote_read_all(fd, header, sizeof(header)))
+        return 0;
+    msg.p = header;
+    msg.end = header + sizeof(header);
+    msg.error = 0;
+    *pop = remote_get_u32(&msg);
+    len = remote_get_u64(&msg);
+    if (len > REMOTE_PAYLOAD_MAX || len != (size_t)len)
+        return 0;
+
+    /* Grow with the data actually received, not with the claimed length */
+    payload->size = 0;
+    payload->error = 0;
+    while (payload->size < len) {
+        size_t n = (size_t)len - payload->size;
+        char *p;
+        if (n > REMOTE_RECV_BYTES)
+            n = REMOTE_RECV_BYTES;
+        if (!(p = remote_reserve(payload, n)) || !remote_read_all(fd, p, n))
+            return 0;
+        payload->size += n;
+    }
+    return 1;
+}
+
+void remote_put_config(struct remote_buf *buf, const struct config *cfg)
+{
+    remote_put_u32(buf, cfg->search.align);
+    remote_put_u32(buf, cfg->search.prot);
+    remote_put_u32(buf, cfg->search.threads);
+    remote_put_u64(buf, cfg->search.chunk);
+    remote_put_u64(buf, cfg->read.gap);
+    remote_put_u32(buf, cfg->target.stop);
+}
+
+void remote_get_config(struct remote_msg *msg, struct config *cfg)
+{
+    unsigned int align = remote_get_u32(msg);
+    unsigned int prot = remote_get_u32(msg);
+    unsigned int threads = remote_get_u32(msg);
+    unsigned long chunk = (unsigned long)remote_get_u64(msg);
+    unsigned long gap = (unsigned long)remote_get_u64(msg);
+    unsigned int stop = remote_get_u32(msg);
+    if (!msg->error && chunk && stop <= 2) {
+        cfg->search.align = align;
+        cfg->search.prot = prot;
+        cfg->search.threads = threads;
+        cfg->search.chunk = chunk;
+        cfg->read.gap = gap;
+        cfg->target.stop = stop;
+    }
+}
+
+/*
+ * Client of an agent. Calls are serialized by the lock (searches read with
+ * several threads).
+ */
+struct target_remote {
+    struct target base;
+    int fd;
+    pthread_mutex_t lock;
+    struct remote_buf out, in;
+
+    struct region *regions; /* fetched by region_first() */
+    size_t regions_size;
+    char *paths;
+    unsigned int iterators; /* ongoing region iterations */
+};
+
+struct remote_region_iter {
+    struct region region;
+    struct target_remote *remote;
+    size_t index;
+};
+
+/*
+ * Send remote->out as `op` and receive the reply to remote->in (read with
+ * *reply). Called with the lock held. Returns the status of the reply, or
+ * zero if the connection failed.
+ */
+static int remote_call(struct target_remote *remote, uint32_t op,
+                       struct remote_msg *reply)
+{
+    uint32_t status;
+    if (remote->fd == -1)
+        return 0;
+    if (!remote_send(remote->fd, op, &remote->out)
+            || !remote_recv(remote->fd, &status, &remote->in)) {
+        errf("remote: connection to agent lost");
+        close(remote->fd);
+        remote->fd = -1;
+        return 0;
+    }
+    reply->p = remote->in.data;
+    reply->end = remote->in.data + remote->in.size;
+    reply->error = 0;
+    return status;
+}
+
+/*
+ * Call an operation without arguments returning only a status.
+ */
+static int remote_call_status(struct target *target, uint32_t op)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_msg reply;
+    int ok;
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    ok = remote_call(remote, op, &reply);
+    pthread_mutex_unlock(&remote->lock);
+    return ok;
+}
+
+static void remote_regions_clear(struct target_remote *remote)
+{
+    free(remote->regions);
+    free(remote->paths);
+    remote->regions = NULL;
+    remote->paths = NULL;
+    remote->regions_size = 0;
+}
+
+static int remote_detach(struct target *target)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    if (remote->fd != -1)
+        close(remote->fd);
+    remote_buf_destroy(&remote->out);
+    remote_buf_destroy(&remote->in);
+    remote_regions_clear(remote);
+    pthread_mutex_destroy(&remote->lock);
+    free(remote);
+    return 1;
+}
+
+static int remote_stop(struct target *target)
+{
+    return remote_call_status(target, REMOTE_STOP);
+}
+
+static int remote_run(struct target *target)
+{
+    return remote_call_status(target, REMOTE_RUN);
+}
+
+static int remote_stop_mode(struct target *target, enum target_stop mode)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_msg reply;
+    int ok;
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_u32(&remote->out, mode);
+    ok = remote_call(remote, REMOTE_STOP_MODE, &reply);
+    pthread_mutex_unlock(&remote->lock);
+    return ok;
+}
+
+/*
+ * Fetch the regions of the agent target (paths to one arena).
+ */
+static int remote_regions_fetch(struct target_remote *remote)
+{
+    struct remote_msg reply, msg;
+    uint64_t i, n;
+    size_t paths_size, len;
+    char *path;
+
+    remote->out.size = 0;
+    if (!remote_call(remote, REMOTE_REGIONS, &reply))
+        return 0;
+    n = remote_get_u64(&reply);
+    msg = reply;
+    for (i = 0, paths_size = 0; i < n && !msg.error; i++) {
+        remote_get(&msg, 8 + 8 + 4);
+        remote_get_bytes(&msg, &len);
+        paths_size += len + 1;
+    }
+    if (msg.error || n > (uint64_t)(size_t)-1 / sizeof(struct region)) {
+        errf("remote: bad region list from agent");
+        return 0;
+    }
+
+    remote_regions_clear(remote);
+    if (!(remote->regions = malloc(sizeof(struct region) * (size_t)n + 1))
+            || !(remote->paths = malloc(paths_size + 1))) {
+        errf("remote: out-of-memory for regions");
+        remote_regions_clear(remote);
+        return 0;
+    }
+    path = remote->paths;
+    for (i = 0; i < n; i++) {
+        struct region *mr = &remote->regions[i];
+        const char *p;
+        mr->start = (addr_t)remote_get_u64(&reply);
+        mr->size = (addr_t)remote_get_u64(&reply);
+        mr->prot = (enum mem_protection)remote_get_u32(&reply);
+        p = remote_get_bytes(&reply, &len);
+        mr->path = NULL;
+        if (len) {
+            memcpy(path, p, len);
+            path[len] = '\0';
+            mr->path = path;
+            path += len + 1;
+        }
+    }
+    remote->regions_size = (size_t)n;
+    return 1;
+}
+
+static struct region *remote_region_next(struct region *it)
+{
+    struct remote_region_iter *iter = (struct remote_region_iter *)it;
+    if (iter) {
+        struct target_remote *remote = iter->remote;
+        if (iter->index < remote->regions_size) {
+            memcpy(&iter->region, &remote->regions[iter->index++],
+                   sizeof(struct region));
+            return &iter->region;
+        }
+        pthread_mutex_lock(&remote->lock);
+        remote->iterators--;
+        pthread_mutex_unlock(&remote->lock);
+        free(iter);
+    }
+    return NULL;
+}
+
+static struct region *remote_region_first(struct target *target)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_region_iter *it;
+
+    /* Regions of ongoing iterations must stay valid */
+    pthread_mutex_lock(&remote->lock);
+    if (!remote->iterators && !remote_regions_fetch(remote)) {
+        pthread_mutex_unlock(&remote->lock);
+        return NULL;
+    }
+    if (!(it = malloc(sizeof(struct remote_region_iter)))) {
+        pthread_mutex_unlock(&remote->lock);
+        errf("target: out-of-memory for region iterator");
+        return NULL;
+    }
+    it->remote = remote;
+    it->index = 0;
+    remote->iterators++;
+    pthread_mutex_unlock(&remote->lock);
+    return remote_region_next((struct region *)it);
+}
+
+/*
+ * Read batch in requests of at most REMOTE_READ_ELEMENTS elements and
+ * REMOTE_READ_BYTES bytes.
+ */
+static int remote_read_batch(struct target *target,
+                             struct target_read *reads, size_t n)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_msg reply;
+    size_t i, j, k, bytes;
+    int rc = 1;
+
+    pthread_mutex_lock(&remote->lock);
+    for (i = 0; i < n; i = j) {
+        for (j = i, bytes = 0; j < n && j - i < REMOTE_READ_ELEMENTS; j++) {
+            if (j > i && bytes + reads[j].len > REMOTE_READ_BYTES)
+                break;
+            bytes += reads[j].len;
+        }
+        remote->out.size = 0;
+        remote_put_u64(&remote->out, j - i);
+        for (k = i; k < j; k++) {
+            remote_put_u64(&remote->out, reads[k].addr);
+            remote_put_u64(&remote->out, reads[k].len);
+        }
+        if (!remote_call(remote, REMOTE_READ, &reply)) {
+            for (k = i; k < n; k++)
+                reads[k].ok = 0;
+            rc = 0;
+            break;
+        }
+        for (k = i; k < j; k++) {
+            size_t len = reads[k].len;
+            reads[k].ok = remote_get_data(&reply, reads[k].buf, &len)
+                       && len == reads[k].len;
+            if (!reads[k].ok)
+                rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&remote->lock);
+    return rc;
+}
+
+static int remote_read(struct target *target, addr_t addr, void *buf,
+                       size_t len)
+{
+    struct target_read read;
+    size_t off;
+
+    /* Large reads are split to requests of REMOTE_READ_BYTES */
+    for (off = 0; off < len; off += read.len) {
+        read.addr = addr + off;
+        read.buf = (char *)buf + off;
+        if ((read.len = len - off) > REMOTE_READ_BYTES)
+            read.len = REMOTE_READ_BYTES;
+        if (!remote_read_batch(target, &read, 1))
+            return 0;
+    }
+    return 1;
+}
+
+static size_t remote_read_prefix(struct target *target, addr_t addr,
+                                 void *buf, size_t len)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_msg reply;
+    size_t got = len;
+
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_u64(&remote->out, addr);
+    remote_put_u64(&remote->out, len);
+    if (!remote_call(remote, REMOTE_READ_PREFIX, &reply)
+            || !remote_get_data(&reply, buf, &got))
+        got = 0;
+    pthread_mutex_unlock(&remote->lock);
+    return got;
+}
+
+static int remote_write_batch(struct target *target,
+                              struct target_read *writes, size_t n)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    struct remote_msg reply;
+    size_t i;
+    int rc = 1;
+
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_u64(&remote->out, n);
+    for (i = 0; i < n; i++) {
+        remote_put_u64(&remote->out, writes[i].addr);
+        remote_put_bytes(&remote->out, writes[i].buf, writes[i].len);
+    }
+    if (!remote_call(remote, REMOTE_WRITE, &reply)) {
+        for (i = 0; i < n; i++)
+            writes[i].ok = 0;
+        rc = 0;
+    } else {
+        for (i = 0; i < n; i++) {
+            if (!(writes[i].ok = remote_get_u8(&reply)))
+                rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&remote->lock);
+    return rc;
+}
+
+static int remote_write(struct target *target, addr_t addr, void *buf,
+                        size_t len)
+{
+    struct target_read write;
+    write.addr = addr;
+    write.buf = buf;
+    write.len = len;
+    write.ok = 0;
+    return remote_write_batch(target, &write, 1);
+}
+
+static int remote_page_flags(struct target *target, addr_t addr, size_t len,
+                             unsigned char *flags)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    size_t page_size = target_page_size();
+    struct remote_msg reply;
+    const char *p;
+    size_t pages, size;
+    int ok;
+
+    if (!len)
+        return 0;
+    pages = (addr + len - 1) / page_size - addr / page_size + 1;
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_u64(&remote->out, addr);
+    remote_put_u64(&remote->out, len);
+    ok = remote_call(remote, REMOTE_PAGE_FLAGS, &reply)
+      && (p = remote_get_bytes(&reply, &size)) && size == pages;
+    if (ok)
+        memcpy(flags, p, pages);
+    pthread_mutex_unlock(&remote->lock);
+    return ok;
+}
+
+static int remote_clear_soft_dirty(struct target *target)
+{
+    return remote_call_status(target, REMOTE_CLEAR_SOFT_DIRTY);
+}
+
+static int remote_refresh(struct target *target)
+{
+    struct target_remote *remote = (struct target_remote *)target;
+    if (remote->iterators)
+        return 0;
+    return remote_call_status(target, REMOTE_REFRESH);
+}
+
+static const void *remote_map(struct target *target, addr_t addr, size_t len)
+{
+    return NULL;
+}
+
+/* The agent services its own target while waiting for requests */
+static int remote_idle(struct target *target)
+{
+    return 0;
+}
+
+/*
+ * Connect to `host:port` ([host]:port for IPv6 addresses).
+ */
+static int remote_connect(const char *hostport)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port;
+    size_t len;
+    int fd = -1, one = 1;
+
+    if (*hostport == '[' && (port = strstr(hostport, "]:"))) {
+        hostport++;
+        len = port++ - hostport;
+    } else if ((port = strrchr(hostport, ':'))) {
+        len = port - hostport;
+    }
+    if (!port || !*++port || len >= sizeof(host)) {
+        errf("remote: expected host:port (%s)", hostport);
+        return -1;
+    }
+    memcpy(host, hostport, len);
+    host[len] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        errf("remote: cannot resolve %s", host);
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+            continue;
+        if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1) {
+        errf("remote: cannot connect to %s:%s", host, port);
+        return -1;
+    }
+    /* Requests are small and answered one at a time */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+struct target *target_attach_remote(const char *hostport)
+{
+    static const struct target remote_init = {
+        remote_detach,
+        remote_stop,
+        remote_run,
+        remote_region_first,
+        remote_region_next,
+        remote_read,
+        remote_write,
+        remote_read_prefix,
+        remote_read_batch,
+        remote_write_batch,
+        remote_stop_mode,
+        remote_page_flags,
+        remote_clear_soft_dirty,
+        remote_refresh,
+        remote_map,
+        remote_idle
+    };
+    struct target_remote *remote;
+    struct remote_msg reply;
+    uint32_t version;
+
+    if (!(remote = calloc(1, sizeof(struct target_remote)))) {
+        errf("target: out-of-memory for remote target instance");
+        return NULL;
+    }
+    memcpy(remote, &remote_init, sizeof(struct target));
+    pthread_mutex_init(&remote->lock, NULL);
+    remote_buf_init(&remote->out);
+    remote_buf_init(&remote->in);
+    if ((remote->fd = remote_connect(hostport)) == -1) {
+        remote_detach((struct target *)remote);
+        return NULL;
+    }
+    if (!remote_call(remote, REMOTE_HELLO, &reply)
+            || (version = remote_get_u32(&reply)) != REMOTE_VERSION) {
+        errf("remote: agent at %s does not speak protocol version %d",
+             hostport, REMOTE_VERSION);
+        remote_detach((struct target *)remote);
+        return NULL;
+    }
+    return (struct target *)remote;
+}
+
+int target_is_remote(const struct target *target)
+{
+    return target && target->detach == remote_detach;
+}
+
+/*
+ * Call an agent-side search or filter whose request is in remote->out and
+ * receive the resulting hits.
+ */
+static struct hits *remote_call_hits(struct ramfuck *ctx, uint32_t op,
+                                     const char *command)
+{
+    struct target_remote *remote = (struct target_remote *)ctx->target;
+    struct remote_msg reply;
+    struct hits *hits = NULL;
+    double start;
+
+    start = stats_now();
+    if (!remote_call(remote, op, &reply)) {
+        errf("%s: failed on the agent", command);
+    } else if (!(hits = remote_get_hits(&reply))) {
+        errf("%s: bad hits from agent", command);
+    }
+    ctx->stats->read += stats_now() - start;
+    ctx->stats->reads++;
+    ctx->stats->bytes += remote->in.size;
+    if (hits)
+        ctx->stats->hits = hits->size;
+    return hits;
+}
+
+struct hits *remote_search(struct ramfuck *ctx, const enum value_type *types,
+                           size_t types_size, const char *expression)
+{
+    struct target_remote *remote = (struct target_remote *)ctx->target;
+    struct hits *hits;
+    size_t i;
+
+    stats_begin(ctx->stats, "search");
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_config(&remote->out, ctx->config);
+    remote_put_u64(&remote->out, types_size);
+    for (i = 0; i < types_size; i++)
+        remote_put_u32(&remote->out, types[i]);
+    remote_put_bytes(&remote->out, expression, strlen(expression));
+    hits = remote_call_hits(ctx, REMOTE_SEARCH, "search");
+    pthread_mutex_unlock(&remote->lock);
+    stats_end(ctx->stats);
+    return hits;
+}
+
+struct hits *remote_search_bytes(struct ramfuck *ctx, const char *pattern)
+{
+    struct target_remote *remote = (struct target_remote *)ctx->target;
+    struct hits *hits;
+
+    stats_begin(ctx->stats, "search");
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_config(&remote->out, ctx->config);
+    remote_put_bytes(&remote->out, pattern, strlen(pattern));
+    hits = remote_call_hits(ctx, REMOTE_SEARCH_BYTES, "search");
+    pthread_mutex_unlock(&remote->lock);
+    stats_end(ctx->stats);
+    return hits;
+}
+
+struct hits *remote_filter(struct ramfuck *ctx, struct hits *hits,
+                           const char *expression)
+{
+    struct target_remote *remote = (struct target_remote *)ctx->target;
+    struct hits *filtered;
+
+    stats_begin(ctx->stats, "filter");
+    pthread_mutex_lock(&remote->lock);
+    remote->out.size = 0;
+    remote_put_config(&remote->out, ctx->config);
+    remote_put_bytes(&remote->out, expression, strlen(expression));
+    remote_put_hits(&remote->out, hits);
+    filtered = remote_call_hits(ctx, REMOTE_FILTER, "filter");
+    pthread_mutex_unlock(&remote->lock);
+    stats_end(ctx->stats);
+    return filtered ? filtered : hits;
+}
@@ -0,0 +1,158 @@
+/*
+ * Remote targets served by ramfuck-agent over TCP.
+ *
+ * tcp://host:port attaches to an agent running next to the target. The
+ * protocol is built around bulk operations: the region list, batched reads
+ * and writes, and searches and filters executed by the agent so that only
+ * hits are transferred instead of the memory they were found in. Memory
+ * sent to the client is run-length encoded when that makes it smaller.
+ *
+ * Every message is a header (u32 operation or status, u64 payload length)
+ * followed by the payload. Integers are little-endian.
+ */
+
+#ifndef REMOTE_H_INCLUDED
+#define REMOTE_H_INCLUDED
+
+#include "defines.h"
+#include "config.h"
+#include "hits.h"
+#include "ramfuck.h"
+#include "target.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Operations (requests) of the protocol */
+enum remote_op {
+    REMOTE_HELLO = 1,       /* -> u32 version */
+    REMOTE_STOP,            /* -> status */
+    REMOTE_RUN,             /* -> status */
+    REMOTE_STOP_MODE,       /* u32 mode -> status */
+    REMOTE_REGIONS,         /* -> u64 n, n * (u64 start, u64 size,
+                                              u32 prot, string path) */
+    REMOTE_READ,            /* u64 n, n * (u64 addr, u64 len) -> n * data */
+    REMOTE_READ_PREFIX,     /* u64 addr, u64 len -> data */
+    REMOTE_WRITE,           /* u64 n, n * (u64 addr, bytes) -> n * u8 ok */
+    REMOTE_PAGE_FLAGS,      /* u64 addr, u64 len -> bytes flags */
+    REMOTE_CLEAR_SOFT_DIRTY,/* -> status */
+    REMOTE_REFRESH,         /* -> status */
+    REMOTE_SEARCH,          /* config, u64 n, n * u32 type, string expression
+                               -> hits */
+    REMOTE_SEARCH_BYTES,    /* config, string pattern -> hits */
+    REMOTE_FILTER           /* config, string expression, hits -> hits */
+};
+
+/* Protocol version exchanged with REMOTE_HELLO */
+#define REMOTE_VERSION 1
+
+/*
+ * Memory in replies: u8 encoding, then u64 length and the bytes (RAW) or u64
+ * length, u64 encoded length and the run-length encoded bytes (RLE).
+ */
+#define REMOTE_DATA_NONE 0 /* read failed */
+#define REMOTE_DATA_RAW  1
+#define REMOTE_DATA_RLE  2
+
+/* Smallest read worth run-length encoding */
+#define REMOTE_RLE_MIN 256
+
+/*
+ * Growable message buffer.
+ */
+struct remote_buf {
+    char *data;
+    size_t size, capacity;
+    int error; /* out-of-memory while appending */
+};
+
+void remote_buf_init(struct remote_buf *buf);
+void remote_buf_destroy(struct remote_buf *buf);
+
+void remote_put_u8(struct remote_buf *buf, uint8_t value);
+void remote_put_u32(struct remote_buf *buf, uint32_t value);
+void remote_put_u64(struct remote_buf *buf, uint64_t value);
+void remote_put(struct remote_buf *buf, const void *data, size_t len);
+
+/* Append u64 length and bytes (strings are sent without NUL) */
+void remote_put_bytes(struct remote_buf *buf, const void *data, size_t len);
+
+/*
+ * Append `len` bytes of memory as REMOTE_DATA_RLE if run-length encoding
+ * makes them smaller, or REMOTE_DATA_RAW otherwise.
+ */
+void remote_put_data(struct remote_buf *buf, const void *data, size_t len);
+
+/*
+ * Append hits (u32 addr_type, u32 value_type, u64 n, n * (u64 addr,
+ * u32 type, value)).
+ */
+void remote_put_hits(struct remote_buf *buf, const struct hits *hits);
+
+/*
+ * Reader of a received payload. Reads past the end set `error`.
+ */
+struct remote_msg {
+    const char *p, *end;
+    int error;
+};
+
+uint8_t remote_get_u8(struct remote_msg *msg);
+uint32_t remote_get_u32(struct remote_msg *msg);
+uint64_t remote_get_u64(struct remote_msg *msg);
+const char *remote_get(struct remote_msg *msg, size_t len);
+
+/* Get bytes appended with remote_put_bytes() (*plen is their length) */
+const char *remote_get_bytes(struct remote_msg *msg, size_t *plen);
+
+/*
+ * Get memory appended with remote_put_data() to at most *plen bytes at `out`
+ * storing its length to *plen. Returns zero if the data is missing (the
+ * read failed) or does not fit.
+ */
+int remote_get_data(struct remote_msg *msg, void *out, size_t *plen);
+
+/*
+ * Get hits appended with remote_put_hits(). Returns NULL on error.
+ */
+struct hits *remote_get_hits(struct remote_msg *msg);
+
+/*
+ * Send the header and payload of a message. Returns zero on error.
+ */
+int remote_send(int fd, uint32_t op, const struct remote_buf *payload);
+
+/*
+ * Receive a message to `payload` (replacing its contents). Returns zero on
+ * error or end of stream.
+ */
+int remote_recv(int fd, uint32_t *pop, struct remote_buf *payload);
+
+/*
+ * Settings sent with searches and filters (search.*, read.gap and
+ * target.stop).
+ */
+void remote_put_config(struct remote_buf *buf, const struct config *cfg);
+void remote_get_config(struct remote_msg *msg, struct config *cfg);
+
+/*
+ * Attach to the agent at `host:port`. Returns NULL on error.
+ */
+struct target *target_attach_remote(const char *hostport);
+
+/*
+ * Check if `target` is a remote target.
+ */
+int target_is_remote(const struct target *target);
+
+/*
+ * Search, search bytes and filter executed by the agent of the remote
+ * target of `ctx` (see search.h).
+ */
+struct hits *remote_search(struct ramfuck *ctx, const enum value_type *types,
+                           size_t types_size, const char *expression);
+struct hits *remote_search_bytes(struct ramfuck *ctx, const char *pattern);
+struct hits *remote_filter(struct ramfuck *ctx, struct hits *hits,
+                           const char *expression);
+
+#endif
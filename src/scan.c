@@ -0,0 +1,502 @@
+#include "scan.h"
+#include "symbol.h"
+
+#include <ctype.h>
+#include <memory.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Type to which the parser promotes a value of type `type` in comparisons.
+ */
+static enum value_type compare_type(enum value_type type)
+{
+    if (value_type_is_int(type))
+        return (type < S32) ? S32 : type;
+#ifndef NO_FLOAT_VALUES
+    return F64;
+#else
+    return type;
+#endif
+}
+
+static int is_value_var(struct ast *ast, struct symbol_table *symtab,
+                        size_t sym, enum value_type type)
+{
+    struct ast_var *var;
+    if (ast->value_type != compare_type(type))
+        return 0;
+    if (ast->node_type == AST_CAST)
+        ast = ((struct ast_unary *)ast)->child;
+    if (ast->node_type != AST_VAR || ast->value_type != type)
+        return 0;
+    var = (struct ast_var *)ast;
+    return var->symtab == symtab && var->sym == sym
+        && var->size == value_type_sizeof(type);
+}
+
+/*
+ * Accept `value OP constant` (or `constant OP value`) and return OP as if the
+ * value was on the left-hand side.
+ */
+static enum ast_type accept_compare(struct ast *ast,
+                                    struct symbol_table *symtab, size_t sym,
+                                    enum value_type type, struct value *c)
+{
+    struct ast *left, *right;
+    if (ast->node_type < AST_EQ || ast->node_type > AST_GE)
+        return AST_TYPES;
+    left = ((struct ast_binary *)ast)->left;
+    right = ((struct ast_binary *)ast)->right;
+    if (right->node_type == AST_VALUE
+            && right->value_type == compare_type(type)
+            && is_value_var(left, symtab, sym, type)) {
+        *c = ((struct ast_value *)right)->value;
+        return ast->node_type;
+    }
+    if (left->node_type == AST_VALUE
+            && left->value_type == compare_type(type)
+            && is_value_var(right, symtab, sym, type)) {
+        *c = ((struct ast_value *)left)->value;
+        switch (ast->node_type) {
+        case AST_LT: return AST_GT;
+        case AST_GT: return AST_LT;
+        case AST_LE: return AST_GE;
+        case AST_GE: return AST_LE;
+        default: return ast->node_type;
+        }
+    }
+    return AST_TYPES;
+}
+
+/*
+ * Constrain [*lo, *hi] by `value OP c` in a signed or unsigned domain.
+ */
+static int signed_bound(enum ast_type op, intmax_t c, intmax_t min,
+                        intmax_t max, intmax_t *lo, intmax_t *hi)
+{
+    switch (op) {
+    case AST_EQ: if (*lo < c) *lo = c; if (*hi > c) *hi = c; break;
+    case AST_LT: if (c == min) return 0; if (*hi > c-1) *hi = c-1; break;
+    case AST_LE: if (*hi > c) *hi = c; break;
+    case AST_GT: if (c == max) return 0; if (*lo < c+1) *lo = c+1; break;
+    case AST_GE: if (*lo < c) *lo = c; break;
+    default: return 0;
+    }
+    return *lo <= *hi;
+}
+
+static int unsigned_bound(enum ast_type op, uintmax_t c, uintmax_t max,
+                          uintmax_t *lo, uintmax_t *hi)
+{
+    switch (op) {
+    case AST_EQ: if (*lo < c) *lo = c; if (*hi > c) *hi = c; break;
+    case AST_LT: if (c == 0) return 0; if (*hi > c-1) *hi = c-1; break;
+    case AST_LE: if (*hi > c) *hi = c; break;
+    case AST_GT: if (c == max) return 0; if (*lo < c+1) *lo = c+1; break;
+    case AST_GE: if (*lo < c) *lo = c; break;
+    default: return 0;
+    }
+    return *lo <= *hi;
+}
+
+static void int_type_limits(enum value_type type, intmax_t *smin,
+                            intmax_t *smax, uintmax_t *umax)
+{
+    switch (type) {
+    case S8: *smin = INT8_MIN; *smax = INT8_MAX; *umax = INT8_MAX; break;
+    case U8: *smin = 0; *smax = UINT8_MAX; *umax = UINT8_MAX; break;
+    case S16: *smin = INT16_MIN; *smax = INT16_MAX; *umax = INT16_MAX; break;
+    case U16: *smin = 0; *smax = UINT16_MAX; *umax = UINT16_MAX; break;
+    case S32: *smin = INT32_MIN; *smax = INT32_MAX; *umax = INT32_MAX; break;
+    case U32: *smin = 0; *smax = INTMAX_MAX; *umax = UINT32_MAX; break;
+#ifndef NO_64BIT_VALUES
+    case S64: *smin = INT64_MIN; *smax = INT64_MAX; *umax = INT64_MAX; break;
+    case U64: *smin = 0; *smax = INTMAX_MAX; *umax = UINT64_MAX; break;
+#endif
+    default: *smin = *smax = 0; *umax = 0; break;
+    }
+}
+
+#define type_is_signed(t) ((t) == S8 || (t) == S16 || (t) == S32 || is_s64(t))
+#ifndef NO_64BIT_VALUES
+# define is_s64(t) ((t) == S64)
+#else
+# define is_s64(t) 0
+#endif
+
+static intmax_t value_to_intmax(const struct value *v)
+{
+    switch (v->type) {
+    case S32: return v->data.s32;
+    case U32: return v->data.u32;
+#ifndef NO_64BIT_VALUES
+    case S64: return v->data.s64;
+    case U64: return (intmax_t)v->data.u64;
+#endif
+    default: return 0;
+    }
+}
+
+static int int_kernel_init(struct scan_kernel *kernel, enum value_type type,
+                           enum ast_type op1, const struct value *c1,
+                           enum ast_type op2, const struct value *c2)
+{
+    enum value_type ct = compare_type(type);
+    intmax_t nmin, nmax, cmin, cmax;
+    uintmax_t numax, cumax;
+
+    int_type_limits(type, &nmin, &nmax, &numax);
+    int_type_limits(ct, &cmin, &cmax, &cumax);
+    kernel->invert = (op1 == AST_NEQ);
+    if (kernel->invert)
+        op1 = AST_EQ;
+
+    if (type_is_signed(ct)) {
+        intmax_t lo = cmin, hi = cmax;
+        kernel->empty = !signed_bound(op1, value_to_intmax(c1), cmin, cmax,
+                                      &lo, &hi)
+            || (c2 && !signed_bound(op2, value_to_intmax(c2), cmin, cmax,
+                                    &lo, &hi));
+        if (!kernel->empty) {
+            /* Clamp the interval to the range of the scanned type */
+            if (lo < nmin) lo = nmin;
+            if (hi > nmax) hi = nmax;
+            if (lo > hi) {
+                kernel->empty = !kernel->invert;
+                kernel->invert = 0;
+                lo = nmin;
+                hi = nmax;
+            }
+        }
+        kernel->slo = lo;
+        kernel->shi = hi;
+        kernel->ulo = (uintmax_t)lo;
+        kernel->uhi = (uintmax_t)hi;
+    } else {
+        uintmax_t lo = 0, hi = cumax;
+        kernel->empty = !unsigned_bound(op1, (uintmax_t)value_to_intmax(c1),
+                                        cumax, &lo, &hi)
+            || (c2 && !unsigned_bound(op2, (uintmax_t)value_to_intmax(c2),
+                                      cumax, &lo, &hi));
+        kernel->slo = (intmax_t)lo;
+        kernel->shi = (intmax_t)hi;
+        kernel->ulo = lo;
+        kernel->uhi = hi;
+    }
+    return 1;
+}
+
+int scan_kernel_init(struct scan_kernel *kernel, struct ast *ast,
+                     struct symbol_table *symtab, size_t value_sym,
+                     enum value_type type)
+{
+    enum ast_type op1, op2;
+    struct value c1, c2;
+
+    if (type & PTR)
+        return 0;
+
+    memset(kernel, 0, sizeof(struct scan_kernel));
+    kernel->type = type;
+    if ((op1 = accept_compare(ast, symtab, value_sym, type, &c1)) == AST_TYPES) {
+        /* Range: value >= lo && value <= hi (in either order) */
+        struct ast *l, *r;
+        if (ast->node_type != AST_AND_COND)
+            return 0;
+        l = ((struct ast_binary *)ast)->left;
+        r = ((struct ast_binary *)ast)->right;
+        if ((op1 = accept_compare(l, symtab, value_sym, type, &c1)) == AST_TYPES
+         || (op2 = accept_compare(r, symtab, value_sym, type, &c2)) == AST_TYPES)
+            return 0;
+        if (op1 == AST_NEQ || op2 == AST_NEQ)
+            return 0;
+    } else {
+        op2 = AST_TYPES;
+    }
+
+#ifndef NO_FLOAT_VALUES
+    if (value_type_is_fpu(type)) {
+        kernel->op = op1;
+        kernel->c = c1.data.f64;
+        kernel->op2 = op2;
+        kernel->c2 = (op2 != AST_TYPES) ? c2.data.f64 : 0;
+        return 1;
+    }
+#endif
+
+    return int_kernel_init(kernel, type, op1, &c1,
+                           op2, (op2 != AST_TYPES) ? &c2 : NULL);
+}
+
+#ifdef __SSE2__
+/*
+ * Vectorized range check of packed 1, 2 or 4-byte integers (align == size).
+ *
+ * Returns the number of bytes scanned (a multiple of 16), or -1 on failure.
+ */
+static long scan_sse2(const struct scan_kernel *kernel, const char *buf,
+                      size_t len, addr_t addr, struct hits *hits)
+{
+    size_t off, size = value_type_sizeof(kernel->type);
+    int sign = type_is_signed(kernel->type);
+    uint32_t bias = sign ? 0 : (UINT32_C(1) << (size*8 - 1));
+    uint32_t blo = ((uint32_t)kernel->ulo ^ bias);
+    uint32_t bhi = ((uint32_t)kernel->uhi ^ bias);
+    __m128i vlo, vhi, vbias;
+    int want = kernel->invert ? 0xFFFF : 0;
+
+    switch (size) {
+    case 1:
+        vlo = _mm_set1_epi8((char)blo);
+        vhi = _mm_set1_epi8((char)bhi);
+        vbias = _mm_set1_epi8((char)bias);
+        break;
+    case 2:
+        vlo = _mm_set1_epi16((short)blo);
+        vhi = _mm_set1_epi16((short)bhi);
+        vbias = _mm_set1_epi16((short)bias);
+        break;
+    default:
+        vlo = _mm_set1_epi32((int)blo);
+        vhi = _mm_set1_epi32((int)bhi);
+        vbias = _mm_set1_epi32((int)bias);
+        break;
+    }
+
+    for (off = 0; off + 16 <= len; off += 16) {
+        __m128i x, out;
+        int mask;
+        x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(buf + off)), vbias);
+        switch (size) {
+        case 1:
+            out = _mm_or_si128(_mm_cmplt_epi8(x, vlo), _mm_cmpgt_epi8(x, vhi));
+            break;
+        case 2:
+            out = _mm_or_si128(_mm_cmplt_epi16(x, vlo),
+                               _mm_cmpgt_epi16(x, vhi));
+            break;
+        default:
+            out = _mm_or_si128(_mm_cmplt_epi32(x, vlo),
+                               _mm_cmpgt_epi32(x, vhi));
+            break;
+        }
+        /* Bits of values outside of the range are set in the mask */
+        if ((mask = _mm_movemask_epi8(out) ^ 0xFFFF ^ want)) {
+            size_t i;
+            for (i = 0; i < 16; i += size) {
+                if ((mask & (1 << i))
+                        && !hits_add(hits, addr + off + i, kernel->type,
+                                     (union value_data *)(buf + off + i)))
+                    return -1;
+            }
+        }
+    }
+    return (long)off;
+}
+#endif
+
+#define SCAN_INT(NT, LO, HI) \
+    do { \
+        NT lo = (NT)kernel->LO, hi = (NT)kernel->HI; \
+        for (; off + sizeof(NT) <= len; off += align) { \
+            NT x; \
+            memcpy(&x, buf + off, sizeof(NT)); \
+            if (((x >= lo && x <= hi) ^ invert) \
+                    && !hits_add(hits, addr + off, kernel->type, \
+                                 (union value_data *)(buf + off))) \
+                return 0; \
+        } \
+    } while (0)
+
+#ifndef NO_FLOAT_VALUES
+static int fpu_compare(enum ast_type op, double v, double c)
+{
+    switch (op) {
+    case AST_EQ: return v == c;
+    case AST_NEQ: return v != c;
+    case AST_LT: return v < c;
+    case AST_GT: return v > c;
+    case AST_LE: return v <= c;
+    case AST_GE: return v >= c;
+    default: break;
+    }
+    return 1;
+}
+
+#define SCAN_FPU(NT) \
+    do { \
+        for (; off + sizeof(NT) <= len; off += align) { \
+            NT x; \
+            memcpy(&x, buf + off, sizeof(NT)); \
+            if (fpu_compare(kernel->op, x, kernel->c) \
+                    && fpu_compare(kernel->op2, x, kernel->c2) \
+                    && !hits_add(hits, addr + off, kernel->type, \
+                                 (union value_data *)(buf + off))) \
+                return 0; \
+        } \
+    } while (0)
+#endif
+
+int scan_kernel_run(const struct scan_kernel *kernel, const char *buf,
+                    size_t len, addr_t addr, unsigned int align,
+                    struct hits *hits)
+{
+    size_t off = 0;
+    int invert = kernel->invert;
+
+    if (value_type_is_int(kernel->type) && kernel->empty)
+        return 1;
+
+#ifdef __SSE2__
+    if (align == value_type_sizeof(kernel->type)
+            && value_type_is_int(kernel->type) && align <= 4) {
+        long ret = scan_sse2(kernel, buf, len, addr, hits);
+        if (ret < 0)
+            return 0;
+        off = (size_t)ret;
+    }
+#endif
+
+    switch (kernel->type) {
+    case S8: SCAN_INT(int8_t, slo, shi); break;
+    case U8: SCAN_INT(uint8_t, ulo, uhi); break;
+    case S16: SCAN_INT(int16_t, slo, shi); break;
+    case U16: SCAN_INT(uint16_t, ulo, uhi); break;
+    case S32: SCAN_INT(int32_t, slo, shi); break;
+    case U32: SCAN_INT(uint32_t, ulo, uhi); break;
+#ifndef NO_64BIT_VALUES
+    case S64: SCAN_INT(int64_t, slo, shi); break;
+    case U64: SCAN_INT(uint64_t, ulo, uhi); break;
+#endif
+#ifndef NO_FLOAT_VALUES
+    case F32: SCAN_FPU(float); break;
+    case F64: SCAN_FPU(double); break;
+#endif
+    default: break;
+    }
+    return 1;
+}
+
+/*
+ * Rank of a byte by how common it is in code and data (lower is rarer).
+ */
+static int pattern_byte_rank(unsigned char byte)
+{
+    static const unsigned char common[] = {
+        0xcc, 0x90, 0xc3, 0xe8, 0x0f, 0x01, 0x24, 0x44, 0x85, 0xc0,
+        0x83, 0x89, 0x8b, 0x48, 0xff, 0x00
+    };
+    size_t i;
+    for (i = 0; i < sizeof(common); i++) {
+        if (common[i] == byte)
+            return (int)i + 1;
+    }
+    return 0;
+}
+
+static int pattern_nibble(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int scan_pattern_parse(struct scan_pattern *pattern, const char *in)
+{
+    size_t i;
+    int rank = 0;
+
+    pattern->len = 0;
+    for (;;) {
+        unsigned char byte = 0, mask = 0;
+        while (isspace(*in)) in++;
+        if (!*in)
+            break;
+        if (pattern->len == SCAN_PATTERN_MAX)
+            return 0;
+        if (in[0] == '?' && (!in[1] || isspace(in[1]))) {
+            in++;
+        } else {
+            for (i = 0; i < 2; i++, in++) {
+                int nibble;
+                byte <<= 4;
+                mask <<= 4;
+                if (*in == '?')
+                    continue;
+                if ((nibble = pattern_nibble(*in)) < 0)
+                    return 0;
+                byte |= nibble;
+                mask |= 0xf;
+            }
+        }
+        pattern->bytes[pattern->len] = byte;
+        pattern->mask[pattern->len] = mask;
+        pattern->len++;
+    }
+
+    /* Anchor memchr() to the rarest fully specified byte */
+    pattern->anchor = pattern->len;
+    for (i = 0; i < pattern->len; i++) {
+        int r;
+        if (pattern->mask[i] != 0xff)
+            continue;
+        r = pattern_byte_rank(pattern->bytes[i]);
+        if (pattern->anchor == pattern->len || r < rank) {
+            pattern->anchor = i;
+            rank = r;
+        }
+    }
+    return pattern->len > 0;
+}
+
+static int pattern_match(const struct scan_pattern *pattern,
+                         const unsigned char *p)
+{
+    size_t i;
+    for (i = 0; i < pattern->len; i++) {
+        if ((p[i] & pattern->mask[i]) != pattern->bytes[i])
+            return 0;
+    }
+    return 1;
+}
+
+int scan_pattern_run(const struct scan_pattern *pattern, const char *buf,
+                     size_t len, addr_t addr, unsigned int align,
+                     struct hits *hits)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t n = pattern->len, k = pattern->anchor, off, end;
+
+    if (len < n)
+        return 1;
+    end = len - n + 1; /* number of candidate offsets */
+
+    if (k < n) {
+        const unsigned char *q = p + k, *last = p + k + end;
+        while (q < last && (q = memchr(q, pattern->bytes[k], last - q))) {
+            off = q - p - k;
+            if ((addr + off) % align == 0 && pattern_match(pattern, p + off)
+                    && !hits_add(hits, addr + off, U8,
+                                 (union value_data *)(buf + off)))
+                return 0;
+            q++;
+        }
+        return 1;
+    }
+
+    off = (align - addr % align) % align;
+    for (; off < end; off += align) {
+        if (pattern_match(pattern, p + off)
+                && !hits_add(hits, addr + off, U8,
+                             (union value_data *)(buf + off)))
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,90 @@
+/*
+ * Specialized scan kernels for common search predicates.
+ *
+ * search() recognizes simple comparisons of the scanned value against
+ * constants (after ast_optimize()) and runs a tight type-specialized loop
+ * over the memory buffer instead of interpreting the AST at every address.
+ */
+
+#ifndef SCAN_H_INCLUDED
+#define SCAN_H_INCLUDED
+
+#include "defines.h"
+#include "ast.h"
+#include "hits.h"
+#include "value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct scan_kernel {
+    enum value_type type; /* type of the scanned values */
+    int invert;           /* match values outside of [lo, hi] */
+    int empty;            /* integer predicate that never matches */
+
+    /* Integers: inclusive bounds in the domain of `type` */
+    intmax_t slo, shi;
+    uintmax_t ulo, uhi;
+
+#ifndef NO_FLOAT_VALUES
+    /* Floating-point: comparison against one or two f64 constants */
+    enum ast_type op, op2;
+    double c, c2;
+#endif
+};
+
+/*
+ * Try to build a kernel for AST `ast` comparing symbol `value_sym` of `symtab`
+ * (of type `type`) against constants.
+ *
+ * Returns non-zero if the AST can be evaluated with scan_kernel_run().
+ */
+int scan_kernel_init(struct scan_kernel *kernel, struct ast *ast,
+                     struct symbol_table *symtab, size_t value_sym,
+                     enum value_type type);
+
+/*
+ * Scan `len` bytes of `buf` (containing memory at `addr`) for values matching
+ * the kernel predicate at every `align` bytes and add the matches to `hits`.
+ *
+ * Returns zero if adding a hit failed.
+ */
+int scan_kernel_run(const struct scan_kernel *kernel, const char *buf,
+                    size_t len, addr_t addr, unsigned int align,
+                    struct hits *hits);
+
+/* Maximum length of a byte pattern */
+#define SCAN_PATTERN_MAX 256
+
+/*
+ * Byte pattern with wildcards: memory matches at an address if every byte
+ * `b` at offset `i` from it satisfies (b & mask[i]) == bytes[i].
+ */
+struct scan_pattern {
+    unsigned char bytes[SCAN_PATTERN_MAX];
+    unsigned char mask[SCAN_PATTERN_MAX];
+    size_t len;
+    size_t anchor; /* fully specified byte located with memchr(), or len */
+};
+
+/*
+ * Parse a pattern of hex bytes (optionally separated by whitespace) where
+ * '?' is a wildcard nibble (e.g., "48 8b ?? ?? 8?"). A lone '?' between
+ * whitespace is a wildcard byte.
+ *
+ * Returns zero if the pattern is empty, too long or malformed.
+ */
+int scan_pattern_parse(struct scan_pattern *pattern, const char *in);
+
+/*
+ * Scan `len` bytes of `buf` (containing memory at `addr`) for the pattern at
+ * addresses divisible by `align` and add the matches to `hits` as U8 values
+ * (the first byte).
+ *
+ * Returns zero if adding a hit failed.
+ */
+int scan_pattern_run(const struct scan_pattern *pattern, const char *buf,
+                     size_t len, addr_t addr, unsigned int align,
+                     struct hits *hits);
+
+#endif
@@ -1,53 +1,990 @@
+#define _DEFAULT_SOURCE /* for sysconf(3) _SC_NPROCESSORS_ONLN */
 #include "search.h"
 #include "defines.h"
 
 #include "ast.h"
 #include "config.h"
-#include "eval.h"
+#include "group.h"
 #include "hits.h"
 #include "opt.h"
 #include "parse.h"
+#include "remote.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "symbol.h"
 #include "target.h"
 #include "value.h"
+#include "vm.h"
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-struct hits *search(struct ramfuck *ctx, enum value_type type,
-                    const char *expression)
+/* Smallest unit read by the reader thread (smaller ones are read inline) */
+#define SEARCH_PREFETCH_MIN (64 * 1024)
+
+/*
+ * Regions are scanned in units of at most search.chunk bytes so that memory
+ * use stays bounded and large regions can be spread across worker threads.
+ */
+struct search_unit {
+    const struct region *region;
+    addr_t start, size;
+    struct search_worker *worker;
+    size_t hits_start, hits_end;
+    int first;    /* first scanned unit of the region */
+    int in_cache; /* region was scanned by the cached search */
+    int cached;   /* unit was clean, reuse hits of the cached search */
+
+    /* Statistics */
+    unsigned long bytes, reads, hits;
+    double read, eval;
+    int skipped, failed;
+};
+
+struct search_job {
+    struct ramfuck *ctx;
+    const char *expression;
+    const struct scan_pattern *pattern; /* byte pattern, if not NULL */
+    enum value_type types[SEARCH_TYPES_MAX];
+    size_t types_size;
+    enum value_type addr_type;
+    unsigned int align; /* largest alignment of the types */
+    size_t size;        /* largest size of the types (or pattern length) */
+
+    struct search_unit *units;
+    size_t units_size, next;
+    size_t buf_size;
+    size_t snprint_len_max;
+    pthread_mutex_t lock;
+    int stop;
+
+    /* Skip non-present anonymous pages (all-zero memory never matches) */
+    int skip_zero;
+    size_t page_size;
+
+    /* Previous search when rescanning */
+    const struct search_cache *cache;
+    int has_deref; /* expression reads memory outside of the unit */
+};
+
+/*
+ * Expression state of a worker for one searched type. Symbol table, AST and
+ * program are private to the worker because the symbols point to worker's
+ * own buffer and address.
+ */
+struct search_lane {
+    enum value_type type;
+    size_t size;
+    unsigned int align;
+    unsigned int step; /* alignment stepped by when it is implied by bounds */
+    struct addr_bounds bounds;
+    struct symbol_table *symtab;
+    struct ast *ast;
+    struct vm_program *prog; /* NULL if the kernel evaluates the full AST */
+    struct scan_kernel kernel;
+    int use_kernel;
+    struct value value;
+    size_t value_sym;
+    union value_data **ppdata;
+    struct hits *hits; /* hits of the unit when searching many types */
+};
+
+/*
+ * Per-thread search state.
+ *
+ * Each worker owns two buffers: a reader thread fills one with the next unit
+ * while the worker evaluates the other.
+ */
+struct search_worker {
+    struct search_job *job;
+    pthread_t thread;
+    int started;
+
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int reader_started, quit;
+    struct search_unit *request;
+    char *read_buf; /* buffer to read to, or the mapped memory */
+    size_t read_len;
+    int read_done, read_ok;
+
+    char *bufs[2], *snprint_buf;
+    unsigned char *page_flags;
+    struct target *cache; /* read cache for pointer dereferences */
+    struct search_lane lanes[SEARCH_TYPES_MAX];
+    size_t lanes_size;
+    addr_t addr;
+    struct hits *hits;
+};
+
+static void search_worker_destroy(struct search_worker *w)
+{
+    while (w->lanes_size) {
+        struct search_lane *lane = &w->lanes[--w->lanes_size];
+        if (lane->hits) hits_delete(lane->hits);
+        if (lane->prog) vm_program_delete(lane->prog);
+        if (lane->ast) ast_delete(lane->ast);
+        if (lane->symtab) symbol_table_delete(lane->symtab);
+    }
+    if (w->cache) target_detach(w->cache);
+    if (w->hits) hits_delete(w->hits);
+    free(w->page_flags);
+    free(w->snprint_buf);
+    free(w->bufs[1]);
+    free(w->bufs[0]);
+    memset(w, 0, sizeof(struct search_worker));
+}
+
+/* Maximum number of && operands searched for address tests */
+#define SEARCH_CONJUNCTS_MAX 16
+
+/*
+ * Collect at most `n` operands of the && operators of `ast` to `out`.
+ * Returns the total number of operands.
+ */
+static size_t search_conjuncts(struct ast *ast, struct ast **out, size_t n)
+{
+    size_t k;
+    if (ast->node_type != AST_AND_COND) {
+        if (n) out[0] = ast;
+        return 1;
+    }
+    k = search_conjuncts(((struct ast_binary *)ast)->left, out, n);
+    if (k > n)
+        k = n;
+    return k + search_conjuncts(((struct ast_binary *)ast)->right, out + k,
+                                n - k);
+}
+
+/*
+ * Try to build a scan kernel for the lane AST without its && operands that
+ * only test the address (e.g., `value == 5 && addr >= 0x1000`). The address
+ * tests are then enforced by scanning within the lane bounds.
+ */
+static int search_lane_kernel_init(struct search_lane *lane, size_t addr_sym,
+                                   size_t value_sym)
+{
+    struct ast *conjuncts[SEARCH_CONJUNCTS_MAX], *rest[2];
+    struct ast_binary and;
+    struct addr_bounds bounds;
+    size_t i, n, k;
+
+    if (lane->ast->node_type != AST_AND_COND)
+        return 0;
+    n = search_conjuncts(lane->ast, conjuncts, SEARCH_CONJUNCTS_MAX);
+    if (n > SEARCH_CONJUNCTS_MAX)
+        return 0;
+    for (i = k = 0; i < n; i++) {
+        if (ast_addr_bounds(conjuncts[i], lane->symtab, addr_sym,
+                            lane->symtab->symbols[addr_sym]->type, &bounds))
+            continue;
+        if (k == 2)
+            return 0;
+        rest[k++] = conjuncts[i];
+    }
+    if (k == 0 || k == n)
+        return 0;
+    if (k == 1) {
+        return scan_kernel_init(&lane->kernel, rest[0], lane->symtab,
+                                value_sym, lane->type);
+    }
+    and.tree.node_type = AST_AND_COND;
+    and.tree.value_type = S32;
+    and.left = rest[0];
+    and.right = rest[1];
+    return scan_kernel_init(&lane->kernel, &and.tree, lane->symtab, value_sym,
+                            lane->type);
+}
+
+static int search_lane_init(struct search_worker *w, struct search_lane *lane,
+                            enum value_type type, int quiet)
+{
+    struct search_job *job = w->job;
+    struct parser parser;
+    struct ast *opt;
+    size_t addr_sym, value_sym;
+    int exact;
+
+    lane->type = type;
+    lane->size = value_type_sizeof(type);
+    if (!(lane->align = job->ctx->config->search.align))
+        lane->align = lane->size;
+
+    if ((lane->symtab = symbol_table_new(job->ctx))) {
+#if ADDR_BITS == 64
+        if (job->addr_type == U32) {
+            /* Endianess test to get a u32 pointer to the lower half of u64 */
+            union { uint64_t u64; uint32_t u32; } lebe;
+            uint32_t *data;
+            lebe.u64 = UINT64_C(0x8765432112345678);
+            data = (uint32_t *)&w->addr + (lebe.u32 == 0x87654321);
+            addr_sym = symbol_table_add(lane->symtab, "addr", job->addr_type,
+                                        (void *)data);
+        } else {
+            addr_sym = symbol_table_add(lane->symtab, "addr", job->addr_type,
+                                        (void *)&w->addr);
+        }
+#else
+        addr_sym = symbol_table_add(lane->symtab, "addr", job->addr_type,
+                                    (void *)&w->addr);
+#endif
+        lane->value.type = type;
+        value_sym = symbol_table_add(lane->symtab, "value", lane->value.type,
+                                     &lane->value.data);
+        lane->ppdata = &lane->symtab->symbols[value_sym]->pdata;
+        lane->value_sym = value_sym;
+    } else {
+        errf("search: error creating new symbol table");
+        return 0;
+    }
+
+    parser_init(&parser);
+    parser.quiet = quiet;
+    parser.symtab = lane->symtab;
+    parser.addr_type = job->addr_type;
+    parser.target = w->cache;
+    if (!(lane->ast = parse_expression(&parser, job->expression))) {
+        errf("search: %d parse errors", parser.errors);
+        return 0;
+    }
+    job->has_deref |= parser.has_deref;
+    if ((opt = ast_optimize(lane->ast))) {
+        ast_delete(lane->ast);
+        lane->ast = opt;
+    }
+    exact = ast_addr_bounds(lane->ast, lane->symtab, addr_sym, job->addr_type,
+                            &lane->bounds);
+    lane->step = lane->align;
+    if (lane->bounds.align > lane->align
+            && lane->bounds.align <= job->page_size
+            && lane->bounds.align % lane->align == 0
+            && lane->bounds.residue % lane->align == 0) {
+        lane->step = (unsigned int)lane->bounds.align;
+    }
+    if (!exact && (lane->use_kernel = search_lane_kernel_init(lane, addr_sym,
+                                                              value_sym))) {
+        /* Kernel without the address tests needs the AST for misaligned units */
+        if (!(lane->prog = vm_compile(lane->ast))) {
+            errf("search: error compiling expression");
+            return 0;
+        }
+    } else {
+        lane->use_kernel = scan_kernel_init(&lane->kernel, lane->ast,
+                                            lane->symtab, value_sym, type);
+    }
+    if (!lane->use_kernel && !(lane->prog = vm_compile(lane->ast))) {
+        errf("search: error compiling expression");
+        return 0;
+    }
+
+    if (job->types_size > 1 && !(lane->hits = hits_new(job->addr_type, type))) {
+        errf("search: error allocating hits container");
+        return 0;
+    }
+    return 1;
+}
+
+static int search_worker_init(struct search_worker *w, struct search_job *job,
+                              int quiet)
+{
+    size_t i;
+
+    memset(w, 0, sizeof(struct search_worker));
+    w->job = job;
+
+    if (!(w->bufs[0] = malloc(job->buf_size))
+            || !(w->bufs[1] = malloc(job->buf_size))) {
+        errf("search: out-of-memory for memory region buffer");
+        return 0;
+    }
+
+    if (!(w->snprint_buf = malloc(job->snprint_len_max + 1))) {
+        errf("search: out-of-memory for memory region text representation");
+        goto fail;
+    }
+
+    if (!(w->page_flags = malloc(job->buf_size / job->page_size + 2))) {
+        errf("search: out-of-memory for page flags");
+        goto fail;
+    }
+
+    if (!(w->hits = hits_new(job->addr_type, job->types[0]))) {
+        errf("search: error allocating hits container");
+        goto fail;
+    }
+
+    if (job->pattern)
+        return 1;
+    if (!(w->cache = group_deref_new(job->ctx->target, TARGET_CACHE_PAGES)))
+        goto fail;
+    for (i = 0; i < job->types_size; i++) {
+        w->lanes_size++;
+        if (!search_lane_init(w, &w->lanes[i], job->types[i], quiet || i > 0))
+            goto fail;
+    }
+    return 1;
+
+fail:
+    search_worker_destroy(w);
+    return 0;
+}
+
+/*
+ * Check if expression `ast` depends only on the searched value.
+ */
+static int search_ast_value_only(const struct ast *ast, size_t value_sym)
+{
+    switch (ast->node_type) {
+    case AST_VALUE:
+        return 1;
+    case AST_VAR:
+        return ((const struct ast_var *)ast)->sym == value_sym;
+    case AST_DEREF:
+        return 0;
+    case AST_CAST: case AST_NEG: case AST_NOT: case AST_COMPL:
+        return search_ast_value_only(((struct ast_unary *)ast)->child,
+                                     value_sym);
+    default:
+        break;
+    }
+    return search_ast_value_only(((struct ast_binary *)ast)->left, value_sym)
+        && search_ast_value_only(((struct ast_binary *)ast)->right, value_sym);
+}
+
+/*
+ * Check if the expression of a lane can never match all-zero memory.
+ */
+static int search_lane_zero_never_matches(struct search_worker *w,
+                                          struct search_lane *lane)
+{
+    struct search_job *job = w->job;
+    union value_data zero;
+    struct value result;
+
+    if (!search_ast_value_only(lane->ast, lane->value_sym))
+        return 0;
+    memset(&zero, 0, sizeof(zero));
+    if (lane->use_kernel) {
+        struct hits *hits;
+        int ok;
+        if (!(hits = hits_new(job->addr_type, lane->type)))
+            return 0;
+        ok = scan_kernel_run(&lane->kernel, (char *)&zero, lane->size, 0,
+                             lane->align, hits) && !hits->size;
+        hits_delete(hits);
+        return ok;
+    }
+    *lane->ppdata = &zero;
+    return !vm_execute(lane->prog, &result) || !value_is_nonzero(&result);
+}
+
+/*
+ * Check if the worker's expression can never match all-zero memory.
+ */
+static int search_zero_never_matches(struct search_worker *w)
+{
+    struct search_job *job = w->job;
+    size_t i;
+
+    if (job->pattern) {
+        for (i = 0; i < job->pattern->len && !job->pattern->bytes[i]; i++);
+        return i < job->pattern->len;
+    }
+    for (i = 0; i < w->lanes_size; i++) {
+        if (!search_lane_zero_never_matches(w, &w->lanes[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Check if non-present pages of region read as zero (private anonymous).
+ */
+static int search_region_anonymous(const struct region *region)
+{
+    return !region->path || !strcmp(region->path, "[heap]")
+        || !strcmp(region->path, "[stack]");
+}
+
+/*
+ * Read `len` bytes of anonymous memory of `unit` reading only the pages that
+ * are present or swapped and zero-filling the rest. Returns zero if the read
+ * failed. Sets *pskip if none of the pages need to be read.
+ */
+static int search_read_present(struct search_worker *w,
+                               struct search_unit *unit, char *buf,
+                               size_t len, int *pskip)
+{
+    struct target *target = w->job->ctx->target;
+    addr_t addr = unit->start;
+    size_t page_size = w->job->page_size;
+    size_t off, run, page, pages;
+    const unsigned char mask = TARGET_PAGE_PRESENT | TARGET_PAGE_SWAPPED;
+
+    *pskip = 0;
+    if (!target->page_flags(target, addr, len, w->page_flags)) {
+        unit->reads++;
+        unit->bytes += len;
+        return target->read(target, addr, buf, len);
+    }
+
+    pages = (addr + len - 1) / page_size - addr / page_size + 1;
+    for (page = 0; page < pages && !(w->page_flags[page] & mask); page++);
+    if (page == pages) {
+        *pskip = 1;
+        return 1;
+    }
+
+    off = page = 0;
+    while (off < len) {
+        size_t start = off;
+        int present = w->page_flags[page] & mask;
+        /* Collect a run of pages with the same presence */
+        do {
+            run = page_size - (addr + off) % page_size;
+            if (run > len - off)
+                run = len - off;
+            off += run;
+            page++;
+        } while (off < len && !(w->page_flags[page] & mask) == !present);
+        if (!present) {
+            memset(buf + start, 0, off - start);
+            continue;
+        }
+        unit->reads++;
+        unit->bytes += off - start;
+        if (!target->read(target, addr + start, buf + start, off - start))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Read a unit and the bytes following it needed to find values spanning its
+ * end to *pbuf, or point *pbuf directly to the memory if the target can map
+ * it. Unreadable pages at the start of the unit are dropped from the unit.
+ * Returns zero if the read failed.
+ */
+static int search_unit_fetch(struct search_worker *w, struct search_unit *unit,
+                             char **pbuf, size_t *plen)
+{
+    char *buf = *pbuf;
+    const void *data;
+    size_t got;
+    struct search_job *job = w->job;
+    struct target *target = job->ctx->target;
+    addr_t unit_end = unit->start + unit->size;
+    addr_t region_end = unit->region->start + unit->region->size;
+
+    *plen = unit->size;
+    if (region_end - unit_end < job->size - 1)
+        *plen += region_end - unit_end;
+    else *plen += job->size - 1;
+
+    /* Clean unit says nothing of the pages dereferenced by the expression */
+    if (unit->in_cache && !job->has_deref
+            && target->page_flags(target, unit->start, *plen, w->page_flags)) {
+        size_t page, pages;
+        pages = (unit->start + *plen - 1) / job->page_size
+              - unit->start / job->page_size + 1;
+        for (page = 0; page < pages; page++) {
+            if (w->page_flags[page] & TARGET_PAGE_SOFT_DIRTY)
+                break;
+        }
+        if (page == pages) {
+            unit->cached = 1;
+            *plen = 0;
+            return 1;
+        }
+    }
+
+    if (job->skip_zero && search_region_anonymous(unit->region)) {
+        int skip;
+        if (!search_read_present(w, unit, buf, *plen, &skip))
+            return 0;
+        if (skip)
+            *plen = 0;
+        return 1;
+    }
+    unit->bytes += *plen;
+    if ((data = target->map(target, unit->start, *plen))) {
+        *pbuf = (char *)data;
+        return 1;
+    }
+    /* Search the readable prefix of a partially unreadable unit */
+    unit->reads++;
+    while (!(got = target->read_prefix(target, unit->start, buf, *plen))) {
+        /* Unreadable first page: move the unit past it and retry */
+        size_t skip = job->page_size - (size_t)(unit->start % job->page_size);
+        if (skip >= unit->size)
+            return 0;
+        unit->start += skip;
+        unit->size -= skip;
+        *plen -= skip;
+        unit->reads++;
+    }
+    *plen = got;
+    return 1;
+}
+
+/*
+ * Fetch a unit recording its statistics.
+ */
+static int search_unit_read(struct search_worker *w, struct search_unit *unit,
+                            char **pbuf, size_t *plen)
+{
+    double start = stats_now();
+    int ok = search_unit_fetch(w, unit, pbuf, plen);
+    unit->read = stats_now() - start;
+    unit->failed = !ok;
+    unit->skipped = ok && !*plen && !unit->cached;
+    return ok;
+}
+
+/*
+ * Scan `len` bytes of a unit read to `buf` for values of a lane and add the
+ * matches to `hits`. Returns zero if adding a hit failed.
+ */
+static int search_lane_scan(struct search_worker *w, struct search_lane *lane,
+                            struct search_unit *unit, char *buf, size_t len,
+                            struct hits *hits)
+{
+    const struct addr_bounds *bounds = &lane->bounds;
+    struct value result;
+    addr_t addr, end;
+    unsigned int step;
+
+    /* Values of smaller types than the largest must start within the unit */
+    if (len > unit->size + (lane->size - 1))
+        len = unit->size + (lane->size - 1);
+    if (len < lane->size || bounds->empty)
+        return 1;
+
+    /* Scan only the addresses within the bounds of the expression */
+    addr = unit->start;
+    end = addr + (len - (lane->size - 1));
+    step = lane->align;
+    if (lane->step > step && addr % step == 0) {
+        addr += (bounds->residue - addr) & (lane->step - 1);
+        step = lane->step;
+    }
+    if (addr < bounds->min)
+        addr += (bounds->min - addr + (step - 1)) / step * step;
+    if (end - 1 > bounds->max)
+        end = bounds->max + 1;
+    if (addr < unit->start || addr >= end)
+        return 1;
+    buf += addr - unit->start;
+    len = (end - addr) + (lane->size - 1);
+
+    /* Kernel without the address tests is exact if the scan is aligned */
+    if (lane->use_kernel && (!lane->prog
+            || (step % bounds->align == 0
+                && (addr & (bounds->align - 1)) == bounds->residue))) {
+        return scan_kernel_run(&lane->kernel, buf, len, addr, step, hits);
+    }
+
+    *lane->ppdata = (union value_data *)buf;
+    for (w->addr = addr; w->addr < end; w->addr += step) {
+        if (vm_execute(lane->prog, &result) && value_is_nonzero(&result)) {
+            if (!hits_add(hits, w->addr, lane->type, *lane->ppdata))
+                return 0;
+        }
+        *lane->ppdata = (union value_data *)((char *)*lane->ppdata + step);
+    }
+    return 1;
+}
+
+/*
+ * Merge the unit hits of the lanes to the worker hits in address order.
+ */
+static int search_merge_lanes(struct search_worker *w)
+{
+    size_t next[SEARCH_TYPES_MAX];
+    size_t i;
+
+    memset(next, 0, sizeof(next));
+    for (;;) {
+        struct search_lane *min = NULL;
+        addr_t addr = 0;
+        size_t k = 0;
+        for (i = 0; i < w->lanes_size; i++) {
+            struct search_lane *lane = &w->lanes[i];
+            addr_t lane_addr;
+            if (next[i] == lane->hits->size)
+                continue;
+            lane_addr = hits_addr(lane->hits, next[i]);
+            if (!min || lane_addr < addr) {
+                min = lane;
+                addr = lane_addr;
+                k = i;
+            }
+        }
+        if (!min)
+            break;
+        if (!hits_add(w->hits, addr, min->type, hits_prev(min->hits, next[k])))
+            return 0;
+        next[k]++;
+    }
+    return 1;
+}
+
+/*
+ * Scan `len` bytes of a unit read to `buf`. Returns zero if adding a hit
+ * failed.
+ */
+static int search_unit_scan(struct search_worker *w, struct search_unit *unit,
+                            char *buf, size_t len)
+{
+    struct search_job *job = w->job;
+    const struct region *region = unit->region;
+    size_t i;
+
+    unit->hits_start = unit->hits_end = w->hits->size;
+    group_deref_select(w->cache, unit->start);
+    if (unit->first) {
+        region_snprint(region, w->snprint_buf, job->snprint_len_max + 1);
+        fprintf(stderr, "%s\n", w->snprint_buf);
+    }
+
+    if (job->pattern) {
+        if (!scan_pattern_run(job->pattern, buf, len, unit->start, job->align,
+                              w->hits))
+            return 0;
+        unit->hits_end = w->hits->size;
+        return 1;
+    }
+
+    if (w->lanes_size == 1) {
+        if (!search_lane_scan(w, &w->lanes[0], unit, buf, len, w->hits))
+            return 0;
+        unit->hits_end = w->hits->size;
+        return 1;
+    }
+
+    /* Evaluate every type over the same buffer */
+    for (i = 0; i < w->lanes_size; i++) {
+        struct search_lane *lane = &w->lanes[i];
+        hits_clear(lane->hits);
+        if (!search_lane_scan(w, lane, unit, buf, len, lane->hits))
+            return 0;
+    }
+    if (!search_merge_lanes(w))
+        return 0;
+    unit->hits_end = w->hits->size;
+    return 1;
+}
+
+static void *search_reader_run(void *arg)
+{
+    struct search_worker *w = (struct search_worker *)arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        struct search_unit *unit;
+        char *buf;
+        size_t len;
+        int ok;
+        while (!w->request && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!(unit = w->request))
+            break;
+        buf = w->read_buf;
+        pthread_mutex_unlock(&w->lock);
+        ok = search_unit_read(w, unit, &buf, &len);
+        pthread_mutex_lock(&w->lock);
+        w->request = NULL;
+        w->read_buf = buf;
+        w->read_len = len;
+        w->read_ok = ok;
+        w->read_done = 1;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+ * Start reading `unit` to `buf`. Reads synchronously if the reader thread
+ * could not be started or the unit is too small to pay off the handoff.
+ */
+static void search_prefetch(struct search_worker *w, struct search_unit *unit,
+                            char *buf)
+{
+    unit->worker = w;
+    if (!w->reader_started || unit->size < SEARCH_PREFETCH_MIN) {
+        w->read_buf = buf;
+        w->read_ok = search_unit_read(w, unit, &w->read_buf, &w->read_len);
+        w->read_done = 1;
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->request = unit;
+    w->read_buf = buf;
+    w->read_done = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Wait for the pending read to complete. Returns zero if the read failed.
+ */
+static int search_wait(struct search_worker *w, char **pbuf, size_t *plen)
+{
+    if (w->reader_started) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->read_done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+    }
+    *pbuf = w->read_buf;
+    *plen = w->read_len;
+    return w->read_ok;
+}
+
+static struct search_unit *search_next_unit(struct search_job *job)
+{
+    struct search_unit *unit = NULL;
+    pthread_mutex_lock(&job->lock);
+    if (!job->stop && job->next < job->units_size)
+        unit = &job->units[job->next++];
+    pthread_mutex_unlock(&job->lock);
+    return unit;
+}
+
+static void *search_worker_run(void *arg)
+{
+    struct search_worker *w = (struct search_worker *)arg;
+    struct search_job *job = w->job;
+    struct search_unit *unit, *next;
+    unsigned int i;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->quit = 0;
+    w->request = NULL;
+    w->reader_started = !pthread_create(&w->reader, NULL, search_reader_run, w);
+
+    if ((unit = search_next_unit(job)))
+        search_prefetch(w, unit, w->bufs[0]);
+    for (i = 0; unit; unit = next, i ^= 1) {
+        char *buf;
+        size_t len;
+        int ok = search_wait(w, &buf, &len);
+        if ((next = search_next_unit(job)))
+            search_prefetch(w, next, w->bufs[i ^ 1]);
+        if (ok) {
+            double start = stats_now();
+            ok = search_unit_scan(w, unit, buf, len);
+            unit->eval = stats_now() - start;
+            if (!ok) {
+                pthread_mutex_lock(&job->lock);
+                job->stop = 1;
+                pthread_mutex_unlock(&job->lock);
+            }
+        }
+    }
+
+    if (w->reader_started) {
+        pthread_mutex_lock(&w->lock);
+        w->quit = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->reader, NULL);
+        w->reader_started = 0;
+    }
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    return NULL;
+}
+
+static unsigned int search_threads(struct ramfuck *ctx)
+{
+    size_t members = target_group_size(ctx->target);
+    long n;
+    if (!(n = ctx->config->search.threads)
+            && (n = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+        n = 1;
+    /* One worker per member of a target group */
+    if (members > (size_t)n && members <= UINT_MAX)
+        n = (long)members;
+    return (unsigned int)n;
+}
+
+/*
+ * Check if `region` was scanned by the cached search.
+ */
+static int search_cache_has_region(const struct search_cache *cache,
+                                   const struct region *region)
+{
+    size_t lo = 0, hi = cache->regions_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct region *cached = &cache->regions[mid];
+        if (cached->start == region->start) {
+            return cached->size == region->size
+                && cached->prot == region->prot;
+        }
+        if (cached->start < region->start)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+void search_cache_delete(struct search_cache *cache)
+{
+    free(cache->regions);
+    if (cache->hits) hits_delete(cache->hits);
+    free(cache->expression);
+    free(cache);
+}
+
+static struct search_cache *search_cache_new(const enum value_type *types,
+                                             size_t types_size,
+                                             const char *expression,
+                                             struct hits *hits)
+{
+    struct search_cache *cache;
+    size_t len = strlen(expression) + 1;
+    if (!(cache = calloc(1, sizeof(struct search_cache))))
+        return NULL;
+    memcpy(cache->types, types, sizeof(enum value_type) * types_size);
+    cache->types_size = types_size;
+    if (!(cache->expression = malloc(len)) || !(cache->hits = hits_copy(hits))) {
+        search_cache_delete(cache);
+        return NULL;
+    }
+    memcpy(cache->expression, expression, len);
+    return cache;
+}
+
+/*
+ * Add the totals of a region to `stats` once all of its units are summed up.
+ * Regions with only skipped units count as skipped, not cached.
+ */
+static void search_stats_region(struct stats *stats, struct stats_region *sr)
+{
+    sr->cached &= !sr->skipped;
+    stats->skipped += sr->skipped;
+    stats->cached += sr->cached;
+    stats->failed += sr->failed > 0;
+}
+
+/*
+ * Sum up statistics of the units to `stats` per region.
+ */
+static void search_stats(struct stats *stats, const struct search_job *job,
+                         const struct hits *hits)
+{
+    struct stats_region *sr = NULL;
+    size_t i;
+
+    for (i = 0; i < job->units_size; i++) {
+        const struct search_unit *unit = &job->units[i];
+        unsigned long unit_hits;
+        if (!unit->worker)
+            break;
+        if (unit->first) {
+            if (sr)
+                search_stats_region(stats, sr);
+            stats->regions++;
+            if ((sr = stats_add_region(stats, unit->region)))
+                sr->skipped = sr->cached = 1;
+        }
+        unit_hits = unit->cached ? unit->hits
+                                 : unit->hits_end - unit->hits_start;
+        stats->bytes += unit->bytes;
+        stats->reads += unit->reads;
+        stats->read += unit->read;
+        stats->eval += unit->eval;
+        if (sr) {
+            sr->bytes += unit->bytes;
+            sr->reads += unit->reads;
+            sr->hits += unit_hits;
+            sr->read += unit->read;
+            sr->eval += unit->eval;
+            sr->skipped &= unit->skipped;
+            sr->cached &= unit->cached || unit->skipped;
+            sr->failed |= unit->failed;
+        }
+    }
+    if (sr)
+        search_stats_region(stats, sr);
+    stats->hits = hits->size;
+}
+
+/*
+ * Drop the units outside of the address bounds of the expression and clamp
+ * the rest to the bounds (keeping unit starts aligned for every lane).
+ */
+static void search_clamp_units(struct search_job *job, struct search_worker *w)
+{
+    struct addr_bounds bounds = w->lanes[0].bounds;
+    const struct region *region = NULL;
+    size_t i, n;
+
+    for (i = 1; i < w->lanes_size; i++)
+        addr_bounds_union(&bounds, &w->lanes[i].bounds);
+
+    for (i = n = 0; i < job->units_size; i++) {
+        struct search_unit unit = job->units[i];
+        addr_t end = unit.start + (unit.size - 1);
+        if (bounds.empty || end < bounds.min || unit.start > bounds.max)
+            continue;
+        if (unit.start < bounds.min) {
+            /* Lanes skip to their first address within the bounds */
+            addr_t skip = bounds.min - unit.start;
+            skip -= skip % job->align;
+            unit.start += skip;
+            unit.size -= skip;
+        }
+        if (bounds.max - unit.start < unit.size)
+            unit.size = bounds.max - unit.start + 1;
+        unit.first = (unit.region != region);
+        region = unit.region;
+        job->units[n++] = unit;
+    }
+    job->units_size = n;
+}
+
+static struct hits *search_regions(struct ramfuck *ctx,
+                                   const enum value_type *types,
+                                   size_t types_size, const char *expression,
+                                   const struct scan_pattern *pattern,
+                                   const struct search_cache *cache)
 {
     struct target *target;
     struct region *mr, *regions, *new;
     size_t regions_size, regions_capacity;
-    size_t region_size_max, region_idx, snprint_len_max;
-    char *region_buf, *snprint_buf;
-    struct parser parser;
-    struct symbol_table *symtab;
-    struct value value;
-    unsigned int align;
-    addr_t addr, end;
+    size_t i, unit_size;
+    struct search_job job;
+    struct search_worker *workers;
+    unsigned int threads, started;
     enum value_type addr_type;
-    union value_data **ppdata;
-    struct ast *ast, *opt;
     struct hits *hits, *ret;
+    int dirty, truncated;
 
-    ast = NULL;
-    symtab = NULL;
     hits = ret = NULL;
-    region_buf = snprint_buf = NULL;
+    workers = NULL;
+    memset(&job, 0, sizeof(struct search_job));
+    stats_begin(ctx->stats, cache ? "rescan" : "search");
 
     regions_size = 0;
     regions_capacity = 16;
     if (!(regions = calloc(regions_capacity, sizeof(struct region)))) {
         errf("search: out-of-memory for address regions");
+        stats_end(ctx->stats);
         return NULL;
     }
 
     addr_type = U32;
-    region_size_max = snprint_len_max = 0;
     target = ctx->target;
     for (mr = target->region_first(target); mr; mr = target->region_next(mr)) {
 #if ADDR_BITS == 64
@@ -67,13 +1004,11 @@ struct hits *search(struct ramfuck *ctx, enum value_type type,
                 regions = new;
             }
 
-            region_copy(&regions[regions_size++], mr);
-
-            if (region_size_max < mr->size)
-                region_size_max = mr->size;
+            /* Paths stay valid during the search (see target.h) */
+            regions[regions_size++] = *mr;
 
-            if (snprint_len_max < (len = region_snprint(mr, NULL, 0)))
-                snprint_len_max = len;
+            if (job.snprint_len_max < (len = region_snprint(mr, NULL, 0)))
+                job.snprint_len_max = len;
         }
     }
     if (!regions_size) {
@@ -86,145 +1021,948 @@ struct hits *search(struct ramfuck *ctx, enum value_type type,
     }
     regions = new;
 
-    if (!(region_buf = malloc(region_size_max))) {
-        errf("search: out-of-memory for memory region buffer");
+    job.ctx = ctx;
+    job.expression = expression;
+    job.pattern = pattern;
+    memcpy(job.types, types, sizeof(enum value_type) * types_size);
+    job.types_size = types_size;
+    job.addr_type = addr_type;
+    if (pattern) {
+        job.size = pattern->len;
+        if (!(job.align = ctx->config->search.align))
+            job.align = 1;
+    } else {
+        for (i = 0; i < types_size; i++) {
+            size_t size = value_type_sizeof(types[i]);
+            if (job.size < size)
+                job.size = size;
+        }
+        if (!(job.align = ctx->config->search.align))
+            job.align = job.size;
+    }
+    if (!job.size)
+        job.size = 1;
+
+    /* Split regions to units */
+    unit_size = ctx->config->search.chunk;
+    unit_size -= unit_size % job.align;
+    if (!unit_size)
+        unit_size = job.align;
+    for (i = 0; i < regions_size; i++) {
+        addr_t size = regions[i].size;
+        job.units_size += size / unit_size + (size % unit_size != 0);
+    }
+    if (!(job.units = calloc(job.units_size, sizeof(struct search_unit)))) {
+        errf("search: out-of-memory for search units");
         goto fail;
     }
+    for (i = job.units_size = 0; i < regions_size; i++) {
+        addr_t off;
+        for (off = 0; off < regions[i].size; off += unit_size) {
+            struct search_unit *unit = &job.units[job.units_size++];
+            unit->region = &regions[i];
+            unit->first = (off == 0);
+            unit->in_cache = cache && search_cache_has_region(cache,
+                                                              &regions[i]);
+            unit->start = regions[i].start + off;
+            unit->size = regions[i].size - off;
+            if (unit->size > unit_size)
+                unit->size = unit_size;
+            if (job.buf_size < unit->size)
+                job.buf_size = unit->size;
+        }
+    }
+    job.buf_size += job.size - 1;
+    job.page_size = target_page_size();
+    job.cache = cache;
+    /* Bits reset since the cached search (e.g., by snapshot) hide writes */
+    if (cache && cache->dirty_clears != ctx->dirty_clears) {
+        for (i = 0; i < job.units_size; i++)
+            job.units[i].in_cache = 0;
+    }
 
-    if (!(snprint_buf = malloc(snprint_len_max + 1))) {
-        errf("search: out-of-memory for memory region text representation");
+    if ((threads = search_threads(ctx)) > job.units_size)
+        threads = job.units_size;
+    if (!(workers = calloc(threads, sizeof(struct search_worker)))) {
+        errf("search: out-of-memory for search workers");
         goto fail;
     }
+    for (i = 0; i < threads; i++) {
+        if (!search_worker_init(&workers[i], &job, i > 0)) {
+            if (i == 0)
+                goto fail;
+            threads = i;
+            break;
+        }
+    }
+    job.skip_zero = search_zero_never_matches(&workers[0]);
+    if (!pattern)
+        search_clamp_units(&job, &workers[0]);
 
-    if ((symtab = symbol_table_new(ctx))) {
-        size_t value_sym;
-#if ADDR_BITS == 64
-        if (addr_type == U32) {
-            /* Endianess test to get a u32 pointer to the lower half of u64 */
-            union { uint64_t u64; uint32_t u32; } lebe;
-            uint32_t *data;
-            lebe.u64 = UINT64_C(0x8765432112345678);
-            data = (uint32_t *)&addr + (lebe.u32 == 0x87654321);
-            symbol_table_add(symtab, "addr", addr_type, (void *)data);
-        } else {
-            symbol_table_add(symtab, "addr", addr_type, (void *)&addr);
+    pthread_mutex_init(&job.lock, NULL);
+    ramfuck_break(ctx);
+    for (i = 1, started = 1; i < threads; i++) {
+        if (!pthread_create(&workers[i].thread, NULL, search_worker_run,
+                            &workers[i])) {
+            workers[i].started = 1;
+            started++;
+        }
+    }
+    search_worker_run(&workers[0]);
+    for (i = 1; i < threads; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    }
+    /* Clear after the scan read the bits, so the next rescan sees new writes */
+    dirty = 0;
+    if (ctx->config->target.dirty && !(dirty = ramfuck_clear_soft_dirty(ctx)))
+        warnf("search: clearing soft-dirty bits failed");
+    ramfuck_continue(ctx);
+    pthread_mutex_destroy(&job.lock);
+
+    truncated = job.stop;
+    if (started == 1 && !cache) {
+        /* Hits of a single worker are already in address order */
+        hits = workers[0].hits;
+        workers[0].hits = NULL;
+    } else if ((hits = hits_new(addr_type, types[0]))) {
+        size_t k = 0;
+        for (i = 0; i < job.units_size; i++) {
+            struct search_unit *unit = &job.units[i];
+            size_t j;
+            if (!unit->worker)
+                break;
+            if (unit->cached) {
+                /* Reuse hits of the clean unit from the cached search */
+                const struct hits *from = cache->hits;
+                addr_t end = unit->start + unit->size;
+                while (k < from->size && hits_addr(from, k) < unit->start)
+                    k++;
+                for (; k < from->size && hits_addr(from, k) < end; k++) {
+                    if (!hits_add(hits, hits_addr(from, k), hits_type(from, k),
+                                  hits_prev(from, k)))
+                        break;
+                    unit->hits++;
+                }
+                if (k < from->size && hits_addr(from, k) < end) {
+                    truncated = 1;
+                    break;
+                }
+                continue;
+            }
+            for (j = unit->hits_start; j < unit->hits_end; j++) {
+                struct hits *from = unit->worker->hits;
+                if (!hits_add(hits, hits_addr(from, j), hits_type(from, j),
+                              hits_prev(from, j)))
+                    break;
+            }
+            if (j < unit->hits_end) {
+                truncated = 1;
+                break;
+            }
         }
-#else
-        symbol_table_add(symtab, "addr", addr_type, (void *)&addr);
-#endif
-        value.type = type;
-        value_sym = symbol_table_add(symtab, "value", value.type, &value.data);
-        ppdata = &symtab->symbols[value_sym]->pdata;
     } else {
-        errf("search: error creating new symbol table");
+        errf("search: error allocating hits container");
         goto fail;
     }
+    if (truncated)
+        warnf("search: adding hits failed, stopped at %lu hits",
+              (unsigned long)hits->size);
+    search_stats(ctx->stats, &job, hits);
+
+    if (dirty) {
+        struct search_cache *new_cache;
+        if ((new_cache = search_cache_new(types, types_size, expression,
+                                          hits))) {
+            new_cache->bytes = pattern != NULL;
+            new_cache->dirty_clears = ctx->dirty_clears;
+            /* Borrowed paths would not outlive the region table */
+            for (i = 0; i < regions_size; i++)
+                regions[i].path = NULL;
+            new_cache->regions = regions;
+            new_cache->regions_size = regions_size;
+            regions = NULL;
+            regions_size = 0;
+            if (ctx->search_cache)
+                search_cache_delete(ctx->search_cache);
+            ctx->search_cache = new_cache;
+        } else {
+            warnf("search: out-of-memory for search cache");
+        }
+    }
+
+    ret = hits;
+    hits = NULL;
+
+fail:
+    if (workers) {
+        for (i = 0; i < threads; i++)
+            search_worker_destroy(&workers[i]);
+        free(workers);
+    }
+    if (hits) hits_delete(hits);
+    free(job.units);
+    free(regions);
+    stats_end(ctx->stats);
+    return ret;
+}
+
+struct hits *search(struct ramfuck *ctx, enum value_type type,
+                    const char *expression)
+{
+    return search_types(ctx, &type, 1, expression);
+}
+
+struct hits *search_types(struct ramfuck *ctx, const enum value_type *types,
+                          size_t types_size, const char *expression)
+{
+    if (ctx->search_cache) {
+        search_cache_delete(ctx->search_cache);
+        ctx->search_cache = NULL;
+    }
+    if (!types_size || types_size > SEARCH_TYPES_MAX) {
+        errf("search: bad number of types %lu (max %d)",
+             (unsigned long)types_size, SEARCH_TYPES_MAX);
+        return NULL;
+    }
+    if (target_is_remote(ctx->target))
+        return remote_search(ctx, types, types_size, expression);
+    return search_regions(ctx, types, types_size, expression, NULL, NULL);
+}
+
+struct hits *search_bytes(struct ramfuck *ctx, const char *pattern)
+{
+    struct scan_pattern parsed;
+    enum value_type type = U8;
+    if (ctx->search_cache) {
+        search_cache_delete(ctx->search_cache);
+        ctx->search_cache = NULL;
+    }
+    if (!scan_pattern_parse(&parsed, pattern)) {
+        errf("search: bad byte pattern (expected up to %d hex bytes)",
+             SCAN_PATTERN_MAX);
+        return NULL;
+    }
+    if (target_is_remote(ctx->target))
+        return remote_search_bytes(ctx, pattern);
+    return search_regions(ctx, &type, 1, pattern, &parsed, NULL);
+}
+
+struct hits *rescan(struct ramfuck *ctx)
+{
+    struct search_cache *cache = ctx->search_cache;
+    struct scan_pattern pattern;
+    struct hits *hits;
+    if (!cache) {
+        errf("rescan: no search to repeat (enable target.dirty and search)");
+        return NULL;
+    }
+    ctx->search_cache = NULL;
+    if (cache->bytes)
+        scan_pattern_parse(&pattern, cache->expression);
+    hits = search_regions(ctx, cache->types, cache->types_size,
+                          cache->expression, cache->bytes ? &pattern : NULL,
+                          cache);
+    search_cache_delete(cache);
+    return hits;
+}
+
+/*
+ * Filter expression compiled for hits of one value type.
+ */
+struct filter_program {
+    enum value_type type;
+    struct symbol_table *symtab;
+    struct ast *ast;
+    struct vm_program *prog;
+    union value_data **pvalue, **ppdata;
+    struct addr_bounds bounds;
+};
+
+static void filter_program_destroy(struct filter_program *fp)
+{
+    if (fp->prog) vm_program_delete(fp->prog);
+    if (fp->ast) ast_delete(fp->ast);
+    if (fp->symtab) symbol_table_delete(fp->symtab);
+    memset(fp, 0, sizeof(struct filter_program));
+}
+
+/*
+ * Compile `expression` for hits of `type`. If `cast` is set, the result is
+ * converted to the hit type (for writing) instead of being a condition.
+ */
+static int filter_program_init(struct filter_program *fp,
+                               struct ramfuck *ctx, struct target *target,
+                               enum value_type addr_type, enum value_type type,
+                               const char *expression, addr_t *paddr,
+                               int quiet, int cast)
+{
+    struct parser parser;
+    struct ast *opt;
+    size_t addr_sym;
+
+    memset(fp, 0, sizeof(struct filter_program));
+    fp->type = type;
+    if ((fp->symtab = symbol_table_new(ctx))) {
+        size_t value_sym, prev_sym;
+        addr_sym = symbol_table_add(fp->symtab, "addr", addr_type,
+                                    (void *)paddr);
+        value_sym = symbol_table_add(fp->symtab, "value", type, NULL);
+        prev_sym = symbol_table_add(fp->symtab, "prev", type, NULL);
+        fp->pvalue = &fp->symtab->symbols[value_sym]->pdata;
+        fp->ppdata = &fp->symtab->symbols[prev_sym]->pdata;
+    } else {
+        errf("filter: error creating new symbol table");
+        return 0;
+    }
 
     parser_init(&parser);
-    parser.symtab = symtab;
+    parser.quiet = quiet;
+    parser.symtab = fp->symtab;
     parser.addr_type = addr_type;
-    parser.target = ctx->target;
-    if (!(ast = parse_expression(&parser, expression))) {
-        errf("search: %d parse errors", parser.errors);
+    parser.target = target;
+    if (!(fp->ast = parse_expression(&parser, expression))) {
+        errf("filter: %d parse errors", parser.errors);
         goto fail;
     }
-    if ((opt = ast_optimize(ast))) {
-        ast_delete(ast);
-        ast = opt;
+    if (cast) {
+        struct ast *node;
+        if (!(node = ast_cast_new((type & PTR) ? addr_type : type, fp->ast))) {
+            errf("filter: out-of-memory for typecast AST");
+            goto fail;
+        }
+        fp->ast = node;
     }
-
-    if ((hits = hits_new())) {
-        hits->addr_type = addr_type;
-        hits->value_type = value.type;
-    } else {
-        errf("search: error allocating hits container");
+    if ((opt = ast_optimize(fp->ast))) {
+        ast_delete(fp->ast);
+        fp->ast = opt;
+    }
+    ast_addr_bounds(fp->ast, fp->symtab, addr_sym, addr_type, &fp->bounds);
+    if (!(fp->prog = vm_compile(fp->ast))) {
+        errf("filter: error compiling expression");
         goto fail;
     }
+    return 1;
 
-    if (!(align = ctx->config->search.align)) {
-        if (!(align = value_sizeof(&value)))
-            align = 1;
+fail:
+    filter_program_destroy(fp);
+    return 0;
+}
+
+/*
+ * Index of the first hit at address of at least `addr` (hits are in address
+ * order).
+ */
+static size_t filter_lower_bound(const struct hits *hits, addr_t addr)
+{
+    size_t lo = 0, hi = hits->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hits_addr(hits, mid) < addr)
+            lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
+}
 
-    ramfuck_break(ctx);
-    for (region_idx = 0; region_idx < regions_size; region_idx++) {
-        const struct region *region = &regions[region_idx];
-        if (!target->read(target, region->start, region_buf, region->size))
+/* Maximum number of distinct hit types (pointer types included) */
+#define FILTER_PROGRAMS_MAX (2 * VALUE_TYPES)
+
+/*
+ * Hits [first, last) filtered by one worker. Hits of a group target are
+ * sliced at member boundaries so that members are filtered concurrently.
+ */
+struct filter_slice {
+    size_t first, last;
+    struct hits *hits;
+    int done; /* filtered without running out of memory */
+};
+
+struct filter_job {
+    struct ramfuck *ctx;
+    const struct hits *hits;
+    struct filter_slice *slices;
+    size_t slices_size, next;
+    pthread_mutex_t lock;
+    int stop;
+};
+
+/*
+ * Per-thread filter state. Programs point to the worker's own address and
+ * read dereferences through the worker's own page cache.
+ */
+struct filter_worker {
+    struct filter_job *job;
+    pthread_t thread;
+    int started;
+
+    struct target *cache;
+    struct filter_program programs[FILTER_PROGRAMS_MAX];
+    size_t programs_size;
+    struct value *values;
+    struct target_read *reads;
+    addr_t addr;
+
+    /* Statistics */
+    unsigned long bytes, read_calls, failed;
+    double read, eval;
+};
+
+static void filter_worker_destroy(struct filter_worker *w)
+{
+    free(w->reads);
+    free(w->values);
+    while (w->programs_size)
+        filter_program_destroy(&w->programs[--w->programs_size]);
+    if (w->cache) target_detach(w->cache);
+    w->cache = NULL;
+}
+
+/*
+ * Compile the expression for every type of the hits.
+ */
+static int filter_worker_init(struct filter_worker *w, struct filter_job *job,
+                              const char *expression, int quiet)
+{
+    struct ramfuck *ctx = job->ctx;
+    const struct hits *hits = job->hits;
+    size_t i, j;
+
+    memset(w, 0, sizeof(struct filter_worker));
+    w->job = job;
+
+    /* Dereferences of the expression read through a page cache */
+    if (!(w->cache = group_deref_new(ctx->target, TARGET_CACHE_PAGES)))
+        return 0;
+
+    if (!filter_program_init(&w->programs[0], ctx, w->cache, hits->addr_type,
+                             hits->value_type, expression, &w->addr, quiet, 0))
+        return 0;
+    w->programs_size = 1;
+    for (i = 0; hits->types && i < hits->size; i++) {
+        enum value_type type = hits->types[i];
+        for (j = 0; j < w->programs_size && w->programs[j].type != type; j++);
+        if (j < w->programs_size)
             continue;
-        *ppdata = (union value_data *)region_buf;
-        region_snprint(region, snprint_buf, snprint_len_max + 1);
-        fprintf(stderr, "%s\n", snprint_buf);
-
-        addr = region->start;
-        end = addr + region->size;
-        while (addr < end) {
-            if (ast_evaluate(ast, &value) && value_is_nonzero(&value)) {
-                if (!hits_add(hits, addr, type, *ppdata)) {
-                    region_idx = regions_size;
+        if (w->programs_size == FILTER_PROGRAMS_MAX) {
+            errf("filter: too many hit types");
+            return 0;
+        }
+        if (!filter_program_init(&w->programs[w->programs_size], ctx,
+                                 w->cache, hits->addr_type, type, expression,
+                                 &w->addr, 1, 0))
+            return 0;
+        w->programs_size++;
+    }
+
+    if (!(w->values = malloc(TARGET_READ_BATCH * sizeof(struct value)))
+            || !(w->reads = malloc(TARGET_READ_BATCH
+                                   * sizeof(struct target_read)))) {
+        errf("filter: out-of-memory for read buffers");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Filter the hits of a slice. Returns zero if adding a hit failed.
+ */
+static int filter_slice_run(struct filter_worker *w,
+                            struct filter_slice *slice)
+{
+    struct ramfuck *ctx = w->job->ctx;
+    struct target *target = ctx->target;
+    const struct hits *hits = w->job->hits;
+    enum value_type addr_type = hits->addr_type;
+    struct filter_program *fp = &w->programs[0];
+    struct value *values = w->values;
+    struct target_read *reads = w->reads;
+    struct value result;
+    size_t i, j, n;
+    double start;
+
+    if (slice->first < slice->last)
+        group_deref_select(w->cache, hits_addr(hits, slice->first));
+    for (i = slice->first; i < slice->last; i += n) {
+        const char *data;
+        addr_t low, high;
+        if ((n = slice->last - i) > TARGET_READ_BATCH)
+            n = TARGET_READ_BATCH;
+        low = high = hits_addr(hits, i);
+        for (j = 0; j < n; j++) {
+            enum value_type type = hits_type(hits, i + j);
+            values[j].type = type;
+            reads[j].addr = hits_addr(hits, i + j);
+            reads[j].buf = &values[j].data;
+            reads[j].len = value_type_sizeof((type & PTR) ? addr_type : type);
+            reads[j].ok = 0;
+            if (reads[j].addr < low)
+                low = reads[j].addr;
+            if (reads[j].addr + reads[j].len > high)
+                high = reads[j].addr + reads[j].len;
+        }
+
+        /* Evaluate mapped target memory in place if the batch is mapped */
+        start = stats_now();
+        if ((data = target->map(target, low, high - low))) {
+            for (j = 0; j < n; j++)
+                reads[j].ok = 1;
+        } else {
+            target_read_spans(target, reads, n, ctx->config->read.gap);
+            w->read_calls++;
+        }
+        w->read += stats_now() - start;
+
+        start = stats_now();
+        for (j = 0; j < n; j++) {
+            if (!reads[j].ok) {
+                w->failed++;
+                continue;
+            }
+            w->bytes += reads[j].len;
+            w->addr = reads[j].addr;
+            if (values[j].type != fp->type) {
+                for (fp = w->programs; fp->type != values[j].type; fp++);
+            }
+            if (data) {
+                *fp->pvalue = (union value_data *)(data + (w->addr - low));
+            } else *fp->pvalue = &values[j].data;
+            *fp->ppdata = hits_prev(hits, i + j);
+            if (vm_execute(fp->prog, &result) && value_is_nonzero(&result)) {
+                if (!hits_add(slice->hits, w->addr, fp->type, *fp->pvalue))
                     break;
-                }
             }
-            *ppdata = (union value_data *)((char *)*ppdata + align);
-            addr += align;
         }
+        w->eval += stats_now() - start;
+        if (j < n)
+            return 0;
     }
-    ramfuck_continue(ctx);
+    return 1;
+}
+
+static void *filter_worker_run(void *arg)
+{
+    struct filter_worker *w = (struct filter_worker *)arg;
+    struct filter_job *job = w->job;
+    struct filter_slice *slice;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        slice = (!job->stop && job->next < job->slices_size)
+              ? &job->slices[job->next++] : NULL;
+        pthread_mutex_unlock(&job->lock);
+        if (!slice)
+            break;
+        if (!(slice->done = filter_slice_run(w, slice))) {
+            pthread_mutex_lock(&job->lock);
+            job->stop = 1;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Split hits [first, last) to slices at member boundaries of a group target
+ * (a single slice for other targets). Returns zero if out of memory.
+ */
+static int filter_slices(struct filter_job *job, size_t first, size_t last)
+{
+    const struct hits *hits = job->hits;
+    size_t i, n;
+
+    n = 1;
+#if ADDR_BITS == 64
+    if (target_group_size(job->ctx->target) && first < last) {
+        n = group_index(hits_addr(hits, last - 1))
+          - group_index(hits_addr(hits, first)) + 1;
+    }
+#endif
+    if (!(job->slices = calloc(n, sizeof(struct filter_slice)))) {
+        errf("filter: out-of-memory for filter slices");
+        return 0;
+    }
+    job->slices_size = 0;
+    for (i = first; i < last || !job->slices_size; ) {
+        struct filter_slice *slice = &job->slices[job->slices_size++];
+        slice->first = i;
+        slice->last = last;
+#if ADDR_BITS == 64
+        if (n > 1 && i < last) {
+            addr_t next = (addr_t)(group_index(hits_addr(hits, i)) + 1)
+                        << GROUP_SHIFT;
+            if (next && hits_addr(hits, last - 1) >= next)
+                slice->last = filter_lower_bound(hits, next);
+        }
+#endif
+        i = slice->last;
+    }
+    return 1;
+}
+
+struct hits *filter(struct ramfuck *ctx, struct hits *hits,
+                    const char *expression)
+{
+    struct filter_job job;
+    struct filter_worker *workers;
+    struct hits *filtered, *ret;
+    struct addr_bounds bounds;
+    struct stats *stats;
+    size_t i, j, first, last;
+    unsigned int threads, capacity;
+
+    if (target_is_remote(ctx->target))
+        return remote_filter(ctx, hits, expression);
+
+    workers = NULL;
+    threads = 0;
+    filtered = NULL;
+    memset(&job, 0, sizeof(struct filter_job));
+    job.ctx = ctx;
+    job.hits = hits;
 
     ret = hits;
-    hits = NULL;
+    stats = ctx->stats;
+    stats_begin(stats, "filter");
+
+    /* Workers of a group target take member slices like search units */
+    capacity = target_group_size(ctx->target) ? search_threads(ctx) : 1;
+    if (!(workers = calloc(capacity, sizeof(struct filter_worker)))) {
+        errf("filter: out-of-memory for filter workers");
+        goto fail;
+    }
+    threads = 1;
+    if (!filter_worker_init(&workers[0], &job, expression, 0))
+        goto fail;
+
+    if (!(filtered = hits_new(hits->addr_type, hits->value_type))) {
+        errf("filter: error allocating filtered hits container");
+        goto fail;
+    }
+
+    /* Hits outside of the address bounds of the expression never match */
+    bounds = workers[0].programs[0].bounds;
+    for (i = 1; i < workers[0].programs_size; i++)
+        addr_bounds_union(&bounds, &workers[0].programs[i].bounds);
+    first = last = 0;
+    if (!bounds.empty && hits->size) {
+        first = filter_lower_bound(hits, bounds.min);
+        last = hits->size;
+        if (bounds.max < hits_addr(hits, hits->size - 1))
+            last = filter_lower_bound(hits, bounds.max + 1);
+    }
+    if (!filter_slices(&job, first, last))
+        goto fail;
+
+    if (job.slices_size == 1) {
+        job.slices[0].hits = filtered;
+    } else {
+        for (i = 0; i < job.slices_size; i++) {
+            if (!(job.slices[i].hits = hits_new(hits->addr_type,
+                                                hits->value_type))) {
+                errf("filter: error allocating filtered hits container");
+                goto fail;
+            }
+        }
+        for (i = 1; i < capacity && i < job.slices_size; i++) {
+            if (!filter_worker_init(&workers[i], &job, expression, 1)) {
+                filter_worker_destroy(&workers[i]);
+                break;
+            }
+            threads++;
+        }
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    if (!ramfuck_break(ctx)) {
+        pthread_mutex_destroy(&job.lock);
+        goto fail;
+    }
+    for (i = 1; i < threads; i++) {
+        workers[i].started = !pthread_create(&workers[i].thread, NULL,
+                                             filter_worker_run, &workers[i]);
+    }
+    filter_worker_run(&workers[0]);
+    for (i = 1; i < threads; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    }
+    ramfuck_continue(ctx);
+    pthread_mutex_destroy(&job.lock);
+
+    for (i = 0; i < threads; i++) {
+        stats->bytes += workers[i].bytes;
+        stats->reads += workers[i].read_calls;
+        stats->failed += workers[i].failed;
+        stats->read += workers[i].read;
+        stats->eval += workers[i].eval;
+    }
+
+    /* Concatenate the slices in member (address) order */
+    for (i = 0; job.slices_size > 1 && i < job.slices_size; i++) {
+        const struct hits *from = job.slices[i].hits;
+        for (j = 0; j < from->size; j++) {
+            if (!hits_add(filtered, hits_addr(from, j), hits_type(from, j),
+                          hits_prev(from, j)))
+                break;
+        }
+        if (j < from->size || !job.slices[i].done)
+            break;
+    }
+    stats->hits = filtered->size;
+
+    ret = filtered;
+    filtered = NULL;
 
 fail:
-    if (ast) ast_delete(ast);
-    if (symtab) symbol_table_delete(symtab);
-    if (hits) hits_delete(hits);
-    free(snprint_buf);
-    free(region_buf);
-    while (regions_size) region_destroy(&regions[--regions_size]);
-    free(regions);
+    for (i = 0; job.slices_size > 1 && i < job.slices_size; i++) {
+        if (job.slices[i].hits)
+            hits_delete(job.slices[i].hits);
+    }
+    free(job.slices);
+    if (workers) {
+        for (i = 0; i < threads; i++)
+            filter_worker_destroy(&workers[i]);
+        free(workers);
+    }
+    if (filtered) hits_delete(filtered);
+    stats_end(stats);
     return ret;
 }
 
-struct hits *filter(struct ramfuck *ctx, struct hits *hits,
-                    const char *expression)
+int poke_hits(struct ramfuck *ctx, const struct hits *hits, size_t first,
+              size_t last, const char *expression, size_t *pwritten)
 {
-    struct target *target;
+    struct target *target, *cache;
+    struct filter_program programs[FILTER_PROGRAMS_MAX], *fp;
+    size_t programs_size;
+    struct value *values, *results;
+    struct target_read *reads, *writes;
+    enum value_type addr_type, value_type;
+    struct stats *stats;
+    addr_t addr;
+    size_t i, j, k, n;
+    double start;
+    int ret = 0;
+
+    values = results = NULL;
+    reads = writes = NULL;
+    programs_size = 0;
+    *pwritten = 0;
+
+    addr_type = hits->addr_type;
+    value_type = hits->value_type;
+    stats = ctx->stats;
+    stats_begin(stats, "poke");
+
+    /* Dereferences read through a page cache invalidated by the writes */
+    if (!(cache = group_deref_new(ctx->target, TARGET_CACHE_PAGES)))
+        goto fail;
+
+    /* Compile the expression for every type of the hits */
+    if (!filter_program_init(&programs[0], ctx, cache, addr_type, value_type,
+                             expression, &addr, 0, 1))
+        goto fail;
+    programs_size = 1;
+    for (i = first; hits->types && i < last; i++) {
+        enum value_type type = hits->types[i];
+        for (j = 0; j < programs_size && programs[j].type != type; j++);
+        if (j < programs_size)
+            continue;
+        if (programs_size == FILTER_PROGRAMS_MAX) {
+            errf("poke: too many hit types");
+            goto fail;
+        }
+        if (!filter_program_init(&programs[programs_size], ctx, cache,
+                                 addr_type, type, expression, &addr, 1, 1))
+            goto fail;
+        programs_size++;
+    }
+
+    if (!(values = malloc(TARGET_READ_BATCH * sizeof(struct value)))
+            || !(results = malloc(TARGET_READ_BATCH * sizeof(struct value)))
+            || !(reads = malloc(TARGET_READ_BATCH * sizeof(struct target_read)))
+            || !(writes = malloc(TARGET_READ_BATCH * sizeof(struct target_read)))) {
+        errf("poke: out-of-memory for batch buffers");
+        goto fail;
+    }
+
+    /* Everything is written in one stop with batched reads and writes */
+    if (!ramfuck_break(ctx))
+        goto fail;
+    target = ctx->target;
+    fp = &programs[0];
+    for (i = first; i < last; i += n) {
+        if ((n = last - i) > TARGET_READ_BATCH)
+            n = TARGET_READ_BATCH;
+        for (j = 0; j < n; j++) {
+            enum value_type type = hits_type(hits, i + j);
+            values[j].type = type;
+            reads[j].addr = hits_addr(hits, i + j);
+            reads[j].buf = &values[j].data;
+            reads[j].len = value_type_sizeof((type & PTR) ? addr_type : type);
+            reads[j].ok = 0;
+        }
+        start = stats_now();
+        target_read_spans(target, reads, n, ctx->config->read.gap);
+        stats->reads++;
+        stats->read += stats_now() - start;
+
+        start = stats_now();
+        for (j = k = 0; j < n; j++) {
+            if (!reads[j].ok) {
+                stats->failed++;
+                continue;
+            }
+            stats->bytes += reads[j].len;
+            addr = reads[j].addr;
+            if (values[j].type != fp->type) {
+                for (fp = programs; fp->type != values[j].type; fp++);
+            }
+            *fp->pvalue = &values[j].data;
+            *fp->ppdata = hits_prev(hits, i + j);
+            group_deref_select(cache, addr);
+            if (!vm_execute(fp->prog, &results[k]))
+                continue;
+            writes[k].addr = addr;
+            writes[k].buf = &results[k].data;
+            writes[k].len = reads[j].len;
+            writes[k].ok = 0;
+            k++;
+        }
+        stats->eval += stats_now() - start;
+
+        if (k) {
+            cache->write_batch(cache, writes, k);
+            for (j = 0; j < k; j++) {
+                if (writes[j].ok) {
+                    (*pwritten)++;
+                } else stats->failed++;
+            }
+        }
+    }
+    ramfuck_continue(ctx);
+    stats->hits = *pwritten;
+    ret = 1;
+
+fail:
+    free(writes);
+    free(reads);
+    free(results);
+    free(values);
+    while (programs_size)
+        filter_program_destroy(&programs[--programs_size]);
+    if (cache) target_detach(cache);
+    stats_end(stats);
+    return ret;
+}
+
+/*
+ * Read `len` bytes of current memory of a snapshot span at offset `off` to
+ * *pbuf, or point *pbuf directly to the memory if the target can map it.
+ * If soft-dirty bits are `tracked` since the snapshot, pages not written
+ * since are copied from the snapshot. Target reads and read bytes are added
+ * to *preads and *pbytes.
+ */
+static int filter_snapshot_read(struct target *target, int tracked,
+                                const struct snapshot_span *span, size_t off,
+                                char **pbuf, size_t len, unsigned char *flags,
+                                unsigned long *preads, unsigned long *pbytes)
+{
+    size_t page_size = target_page_size();
+    addr_t addr = span->start + off;
+    char *buf = *pbuf;
+    const void *data;
+    size_t pos, page;
+
+    if ((data = target->map(target, addr, len))) {
+        *pbytes += len;
+        *pbuf = (char *)data;
+        return 1;
+    }
+    if (!tracked || !target->page_flags(target, addr, len, flags)) {
+        (*preads)++;
+        *pbytes += len;
+        return target->read(target, addr, buf, len);
+    }
+
+    pos = page = 0;
+    while (pos < len) {
+        size_t start = pos;
+        int dirty = flags[page] & TARGET_PAGE_SOFT_DIRTY;
+        do {
+            size_t run = page_size - (addr + pos) % page_size;
+            pos += (run < len - pos) ? run : len - pos;
+            page++;
+        } while (pos < len && !(flags[page] & TARGET_PAGE_SOFT_DIRTY) == !dirty);
+        if (!dirty) {
+            memcpy(buf + start, span->data + off + start, pos - start);
+            continue;
+        }
+        (*preads)++;
+        *pbytes += pos - start;
+        if (!target->read(target, addr + start, buf + start, pos - start))
+            return 0;
+    }
+    return 1;
+}
+
+struct hits *filter_snapshot(struct ramfuck *ctx, struct snapshot *snapshot,
+                             const char *expression)
+{
+    struct target *target, *cache;
     struct symbol_table *symtab;
     struct parser parser;
     struct ast *ast, *opt;
+    struct vm_program *prog;
     struct hits *filtered, *ret;
-    struct value value, result;
-    union value_data **ppdata;
+    struct value result;
+    union value_data **pvalue, **ppdata;
     enum value_type addr_type, value_type;
+    struct addr_bounds bounds;
+    size_t addr_sym, size, align, chunk, i;
+    unsigned char *flags;
+    struct stats *stats;
+    char *buf;
     addr_t addr;
-    size_t i;
+    double start;
+    int tracked;
 
     ast = NULL;
-    symtab = NULL;
-    filtered = NULL;
+    prog = NULL;
+    cache = NULL;
+    buf = NULL;
+    flags = NULL;
+    filtered = ret = NULL;
 
-    ret = hits;
-    addr_type = hits->addr_type;
-    value_type = hits->value_type;
+    addr_type = snapshot->addr_type;
+    value_type = snapshot->value_type;
+    stats = ctx->stats;
+    /* Bits reset since the snapshot (e.g., by search) hide writes */
+    tracked = snapshot->dirty && snapshot->dirty_clears == ctx->dirty_clears;
+    stats_begin(stats, "filter");
     if ((symtab = symbol_table_new(ctx))) {
-        size_t prev_sym;
-        symbol_table_add(symtab, "addr", addr_type, (void *)&addr);
-        symbol_table_add(symtab, "value", value_type, &value.data);
+        size_t value_sym, prev_sym;
+        addr_sym = symbol_table_add(symtab, "addr", addr_type, (void *)&addr);
+        value_sym = symbol_table_add(symtab, "value", value_type, NULL);
         prev_sym = symbol_table_add(symtab, "prev", value_type, NULL);
+        pvalue = &symtab->symbols[value_sym]->pdata;
         ppdata = &symtab->symbols[prev_sym]->pdata;
     } else {
         errf("filter: error creating new symbol table");
         goto fail;
     }
 
+    /* Dereferences of the expression read through a page cache */
+    if (!(cache = group_deref_new(ctx->target, TARGET_CACHE_PAGES)))
+        goto fail;
+
     parser_init(&parser);
     parser.symtab = symtab;
     parser.addr_type = addr_type;
-    parser.target = ctx->target;
+    parser.target = cache;
 
-    if ((filtered = hits_new())) {
-        filtered->addr_type = addr_type;
-        filtered->value_type = value_type;
-    } else {
+    if (!(filtered = hits_new(addr_type, value_type))) {
         errf("filter: error allocating filtered hits container");
         goto fail;
     }
@@ -236,32 +1974,83 @@ struct hits *filter(struct ramfuck *ctx, struct hits *hits,
         ast_delete(ast);
         ast = opt;
     }
+    ast_addr_bounds(ast, symtab, addr_sym, addr_type, &bounds);
+    if (!(prog = vm_compile(ast))) {
+        errf("filter: error compiling expression");
+        goto fail;
+    }
+
+    if (!(size = value_type_sizeof((value_type & PTR) ? addr_type
+                                                      : value_type)))
+        size = 1;
+    if (!(align = ctx->config->search.align))
+        align = size;
+    if (!(chunk = ctx->config->search.chunk - ctx->config->search.chunk % align))
+        chunk = align;
+    if (!(buf = malloc(chunk + size - 1))
+            || !(flags = malloc((chunk + size - 1) / target_page_size() + 2))) {
+        errf("filter: out-of-memory for memory buffer");
+        goto fail;
+    }
 
     if (!ramfuck_break(ctx))
         goto fail;
     target = ctx->target;
-    for (i = 0; i < hits->size; i++) {
-        size_t size;
-        addr = hits->items[i].addr;
-        value.type = hits->items[i].type;
-        size = value_type_sizeof((value.type & PTR) ? addr_type : value.type);
-        if (!target->read(target, addr, &value.data, size))
-            continue;
-
-        *ppdata = &hits->items[i].prev;
-        if (ast_evaluate(ast, &result) && value_is_nonzero(&result)) {
-            if (!hits_add(filtered, addr, value_type, &value.data))
+    for (i = 0; i < snapshot->spans_size; i++) {
+        const struct snapshot_span *span = &snapshot->spans[i];
+        size_t off, len;
+        for (off = 0; off + size <= span->size; off += chunk) {
+            size_t pos, end;
+            char *data = buf;
+            int ok;
+            if ((len = span->size - off) > chunk + size - 1)
+                len = chunk + size - 1;
+            /* Skip chunks outside of the address bounds of the expression */
+            addr = span->start + off;
+            if (bounds.empty || addr > bounds.max
+                    || addr + (len - size) < bounds.min)
+                continue;
+            group_deref_select(cache, addr);
+            start = stats_now();
+            ok = filter_snapshot_read(target, tracked, span, off, &data, len,
+                                      flags, &stats->reads, &stats->bytes);
+            stats->read += stats_now() - start;
+            if (!ok) {
+                stats->failed++;
+                continue;
+            }
+            start = stats_now();
+            end = len - (size - 1);
+            for (pos = 0; pos < end; pos += align) {
+                addr = span->start + off + pos;
+                *pvalue = (union value_data *)(data + pos);
+                *ppdata = (union value_data *)(span->data + off + pos);
+                if (vm_execute(prog, &result) && value_is_nonzero(&result)) {
+                    if (!hits_add(filtered, addr, value_type, *pvalue))
+                        break;
+                }
+            }
+            stats->eval += stats_now() - start;
+            if (pos < end) {
+                i = snapshot->spans_size;
                 break;
+            }
         }
     }
     ramfuck_continue(ctx);
+    stats->hits = filtered->size;
 
     ret = filtered;
     filtered = NULL;
 
 fail:
     if (filtered) hits_delete(filtered);
+    free(flags);
+    free(buf);
+    if (prog) vm_program_delete(prog);
     if (ast) ast_delete(ast);
     if (symtab) symbol_table_delete(symtab);
+    if (cache) target_detach(cache);
+    stats_end(stats);
     return ret;
 }
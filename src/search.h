@@ -3,14 +3,57 @@
 
 #include "ramfuck.h"
 #include "hits.h"
+#include "snapshot.h"
 
 /*
  * Search a value of type 'type' from a process specified by 'pid'.
  * Returns a hits structure representing the hits.
+ *
+ * With target.dirty enabled, soft-dirty bits of the target are cleared and
+ * the search is cached to ctx->search_cache for rescan().
  */
 struct hits *search(struct ramfuck *ctx, enum value_type type,
                     const char *expression);
 
+/* Maximum number of types searched in one pass */
+#define SEARCH_TYPES_MAX VALUE_TYPES
+
+/*
+ * Search values of several types in one pass: every chunk is read once and
+ * the expression is evaluated for each type over it. Hits carry their own
+ * types and are in address order (in order of `types` at the same address).
+ */
+struct hits *search_types(struct ramfuck *ctx, const enum value_type *types,
+                          size_t types_size, const char *expression);
+
+/*
+ * Search a byte pattern (see scan_pattern_parse()) at every search.align
+ * bytes (default 1). Hits are U8 values of the first matching byte.
+ */
+struct hits *search_bytes(struct ramfuck *ctx, const char *pattern);
+
+/*
+ * Repeat the cached search reading only the pages written since it. Hits
+ * of the clean pages are reused from the cache.
+ */
+struct hits *rescan(struct ramfuck *ctx);
+
+/*
+ * Search cached for rescan().
+ */
+struct search_cache {
+    enum value_type types[SEARCH_TYPES_MAX];
+    size_t types_size;
+    char *expression; /* or the byte pattern */
+    int bytes; /* search_bytes() */
+    struct hits *hits;
+    struct region *regions; /* searched regions (without paths) */
+    size_t regions_size;
+    unsigned long dirty_clears; /* ctx->dirty_clears after the search */
+};
+
+void search_cache_delete(struct search_cache *cache);
+
 /*
  * Filter results of a previous search.
  * Returns a filtered set of hits.
@@ -18,4 +61,21 @@ struct hits *search(struct ramfuck *ctx, enum value_type type,
 struct hits *filter(struct ramfuck *ctx, struct hits *hits,
                     const char *expression);
 
+/*
+ * Write the value of `expression` (of symbols addr, value and prev as in
+ * filter()) converted to the hit type to hits [first, last) during a single
+ * stop of the target. The number of written values is stored to *pwritten.
+ * Returns zero on error.
+ */
+int poke_hits(struct ramfuck *ctx, const struct hits *hits, size_t first,
+              size_t last, const char *expression, size_t *pwritten);
+
+/*
+ * Filter every address of a snapshot comparing the current memory (value) to
+ * the snapshotted memory (prev). Returns the matching addresses as hits, or
+ * NULL on error.
+ */
+struct hits *filter_snapshot(struct ramfuck *ctx, struct snapshot *snapshot,
+                             const char *expression);
+
 #endif
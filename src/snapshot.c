@@ -0,0 +1,160 @@
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS and MAP_NORESERVE */
+#include "snapshot.h"
+#include "config.h"
+#include "target.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static int snapshot_add_span(struct snapshot *snapshot, addr_t start,
+                             size_t size, char *data)
+{
+    struct snapshot_span *span;
+    if (snapshot->spans_size == snapshot->spans_capacity) {
+        size_t capacity = snapshot->spans_capacity
+                        ? 2 * snapshot->spans_capacity : 16;
+        struct snapshot_span *new;
+        if (!(new = realloc(snapshot->spans,
+                            sizeof(struct snapshot_span) * capacity)))
+            return 0;
+        snapshot->spans = new;
+        snapshot->spans_capacity = capacity;
+    }
+    span = &snapshot->spans[snapshot->spans_size++];
+    span->start = start;
+    span->size = size;
+    span->data = data;
+    snapshot->bytes += size;
+    return 1;
+}
+
+/*
+ * Copy region memory to its mapping in chunks. Unreadable memory splits the
+ * region to separate spans. The readable prefix of a chunk is kept and only
+ * the page it ends at is skipped before reading on from the next page.
+ */
+static int snapshot_read_region(struct snapshot *snapshot, struct target *target,
+                                struct snapshot_region *sr, size_t chunk)
+{
+    addr_t start = sr->region.start;
+    size_t page_size = target_page_size();
+    size_t off, len, got, span_off = 0, span_size = 0;
+
+    for (off = 0; off < sr->region.size; off += len) {
+        if ((len = sr->region.size - off) > chunk)
+            len = chunk;
+        got = target->read_prefix(target, start + off, sr->data + off, len);
+        if (got) {
+            if (!span_size)
+                span_off = off;
+            span_size += got;
+        }
+        if (got < len) {
+            size_t skip = page_size - (size_t)((start + off + got) % page_size);
+            if (got + skip < len)
+                len = got + skip;
+        }
+        if (got < len && span_size) {
+            if (!snapshot_add_span(snapshot, start + span_off, span_size,
+                                   sr->data + span_off))
+                return 0;
+            span_size = 0;
+        }
+    }
+    return !span_size || snapshot_add_span(snapshot, start + span_off,
+                                           span_size, sr->data + span_off);
+}
+
+struct snapshot *snapshot_new(struct ramfuck *ctx, enum value_type type)
+{
+    struct target *target = ctx->target;
+    struct snapshot *snapshot;
+    struct region *mr;
+    size_t i, capacity;
+
+    if (!(snapshot = calloc(1, sizeof(struct snapshot)))) {
+        errf("snapshot: out-of-memory for snapshot");
+        return NULL;
+    }
+    snapshot->value_type = type;
+    snapshot->addr_type = U32;
+
+    capacity = 0;
+    for (mr = target->region_first(target); mr; mr = target->region_next(mr)) {
+        struct snapshot_region *sr;
+#if ADDR_BITS == 64
+        if (snapshot->addr_type == U32 && (mr->start + mr->size-1) > UINT32_MAX)
+            snapshot->addr_type = U64;
+#endif
+        if ((mr->prot & ctx->config->search.prot) != ctx->config->search.prot
+                || mr->size != (size_t)mr->size)
+            continue;
+        if (snapshot->regions_size == capacity) {
+            struct snapshot_region *new;
+            capacity = capacity ? 2 * capacity : 16;
+            if (!(new = realloc(snapshot->regions,
+                                sizeof(struct snapshot_region) * capacity))) {
+                errf("snapshot: out-of-memory for regions");
+                while ((mr = target->region_next(mr)));
+                goto fail;
+            }
+            snapshot->regions = new;
+        }
+        sr = &snapshot->regions[snapshot->regions_size];
+        if (!region_copy(&sr->region, mr)) {
+            errf("snapshot: out-of-memory for regions");
+            while ((mr = target->region_next(mr)));
+            goto fail;
+        }
+        sr->data = mmap(NULL, mr->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (sr->data == MAP_FAILED) {
+            errf("snapshot: cannot map memory for region of %lu bytes",
+                 (unsigned long)mr->size);
+            region_destroy(&sr->region);
+            while ((mr = target->region_next(mr)));
+            goto fail;
+        }
+        snapshot->regions_size++;
+    }
+
+    ramfuck_break(ctx);
+    if (ctx->config->target.dirty
+            && !(snapshot->dirty = ramfuck_clear_soft_dirty(ctx)))
+        warnf("snapshot: clearing soft-dirty bits failed");
+    snapshot->dirty_clears = ctx->dirty_clears;
+    for (i = 0; i < snapshot->regions_size; i++) {
+        if (!snapshot_read_region(snapshot, target, &snapshot->regions[i],
+                                  ctx->config->search.chunk)) {
+            errf("snapshot: out-of-memory for spans");
+            ramfuck_continue(ctx);
+            goto fail;
+        }
+    }
+    ramfuck_continue(ctx);
+
+    if (!snapshot->spans_size) {
+        errf("snapshot: no readable memory regions");
+        goto fail;
+    }
+    return snapshot;
+
+fail:
+    snapshot_delete(snapshot);
+    return NULL;
+}
+
+void snapshot_delete(struct snapshot *snapshot)
+{
+    while (snapshot->regions_size) {
+        struct snapshot_region *sr;
+        sr = &snapshot->regions[--snapshot->regions_size];
+        munmap(sr->data, sr->region.size);
+        region_destroy(&sr->region);
+    }
+    free(snapshot->regions);
+    free(snapshot->spans);
+    free(snapshot);
+}
@@ -0,0 +1,57 @@
+/*
+ * Memory snapshots for searching values with an unknown initial value.
+ *
+ * A snapshot holds a copy of every readable span of the regions matching
+ * search.prot. filter_snapshot() then compares the current memory against
+ * the copy without creating a hit for every address first.
+ */
+
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include "defines.h"
+#include "ramfuck.h"
+#include "target.h"
+#include "value.h"
+
+#include <stddef.h>
+
+struct snapshot_region {
+    struct region region;
+    char *data; /* anonymous mapping of region size */
+};
+
+struct snapshot_span {
+    addr_t start;
+    size_t size;
+    char *data; /* points inside the mapping of the span's region */
+};
+
+struct snapshot {
+    enum value_type value_type;
+    enum value_type addr_type;
+
+    struct snapshot_region *regions;
+    size_t regions_size;
+
+    /* Contiguous readable spans of the regions in address order */
+    struct snapshot_span *spans;
+    size_t spans_size, spans_capacity;
+    size_t bytes;
+
+    /* Soft-dirty bits were cleared when the snapshot was taken */
+    int dirty;
+    unsigned long dirty_clears; /* ctx->dirty_clears after the reset */
+};
+
+/*
+ * Take a snapshot of the target memory for values of `type`.
+ */
+struct snapshot *snapshot_new(struct ramfuck *ctx, enum value_type type);
+
+/*
+ * Delete snapshot and release its memory.
+ */
+void snapshot_delete(struct snapshot *snapshot);
+
+#endif
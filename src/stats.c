@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 199309L /* for clock_gettime(2) */
+#include "stats.h"
+#include "ramfuck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double stats_now()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
+        return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct stats *stats_new()
+{
+    return calloc(1, sizeof(struct stats));
+}
+
+static void stats_clear_regions(struct stats *stats)
+{
+    while (stats->per_region_size)
+        region_destroy(&stats->per_region[--stats->per_region_size].region);
+}
+
+void stats_delete(struct stats *stats)
+{
+    stats_clear_regions(stats);
+    free(stats->per_region);
+    free(stats);
+}
+
+void stats_begin(struct stats *stats, const char *command)
+{
+    struct stats_region *per_region = stats->per_region;
+    size_t capacity = stats->per_region_capacity;
+    int is_stopped = stats->is_stopped;
+
+    stats_clear_regions(stats);
+    memset(stats, 0, sizeof(struct stats));
+    stats->per_region = per_region;
+    stats->per_region_capacity = capacity;
+    stats->command = command;
+    stats->start = stats_now();
+    if ((stats->is_stopped = is_stopped))
+        stats->stopped_at = stats->start;
+}
+
+void stats_end(struct stats *stats)
+{
+    double now = stats_now();
+    stats->total = now - stats->start;
+    if (stats->is_stopped) {
+        /* Account the ongoing stop up to now */
+        stats->stopped += now - stats->stopped_at;
+        stats->stopped_at = now;
+    }
+}
+
+void stats_stopped(struct stats *stats, double seconds)
+{
+    stats->stop += seconds;
+    stats->stops++;
+    stats->stopped_at = stats_now();
+    stats->is_stopped = 1;
+}
+
+void stats_running(struct stats *stats, double seconds)
+{
+    if (stats->is_stopped)
+        stats->stopped += stats_now() - seconds - stats->stopped_at;
+    stats->run += seconds;
+    stats->is_stopped = 0;
+}
+
+struct stats_region *stats_add_region(struct stats *stats,
+                                      const struct region *region)
+{
+    struct stats_region *sr;
+    if (stats->per_region_size == stats->per_region_capacity) {
+        size_t capacity = stats->per_region_capacity
+                        ? stats->per_region_capacity * 2 : 16;
+        if (!(sr = realloc(stats->per_region,
+                           capacity * sizeof(struct stats_region))))
+            return NULL;
+        stats->per_region = sr;
+        stats->per_region_capacity = capacity;
+    }
+    sr = &stats->per_region[stats->per_region_size];
+    memset(sr, 0, sizeof(struct stats_region));
+    if (!region_copy(&sr->region, region))
+        return NULL;
+    stats->per_region_size++;
+    return sr;
+}
+
+static double stats_rate(double amount, double seconds)
+{
+    return (seconds > 0) ? amount / seconds : 0;
+}
+
+static void stats_print_raw(const struct stats *stats, FILE *out)
+{
+    size_t i;
+    fprintf(out, "command %s\n", stats->command);
+    fprintf(out, "total %.6f\n", stats->total);
+    fprintf(out, "stopped %.6f\n", stats->stopped);
+    fprintf(out, "stop %.6f\n", stats->stop);
+    fprintf(out, "run %.6f\n", stats->run);
+    fprintf(out, "stops %lu\n", stats->stops);
+    fprintf(out, "bytes %lu\n", stats->bytes);
+    fprintf(out, "reads %lu\n", stats->reads);
+    fprintf(out, "read %.6f\n", stats->read);
+    fprintf(out, "eval %.6f\n", stats->eval);
+    fprintf(out, "hits %lu\n", stats->hits);
+    fprintf(out, "regions %lu\n", stats->regions);
+    fprintf(out, "skipped %lu\n", stats->skipped);
+    fprintf(out, "cached %lu\n", stats->cached);
+    fprintf(out, "failed %lu\n", stats->failed);
+    for (i = 0; i < stats->per_region_size; i++) {
+        const struct stats_region *sr = &stats->per_region[i];
+        fprintf(out, "region\t0x%" PRIaddr "\t%" PRIaddru "\t%lu\t%lu\t%.6f"
+                "\t%.6f\t%lu\t%d\t%d\t%d\t%s\n", sr->region.start,
+                sr->region.size, sr->bytes, sr->reads, sr->read, sr->eval,
+                sr->hits, sr->skipped, sr->cached, sr->failed,
+                sr->region.path ? sr->region.path : "");
+    }
+}
+
+void stats_print(const struct stats *stats, int raw, FILE *out)
+{
+    char *buf;
+    size_t i, size;
+
+    if (!stats->command) {
+        fputs("no statistics recorded\n", out);
+        return;
+    }
+    if (raw) {
+        stats_print_raw(stats, out);
+        return;
+    }
+
+    fprintf(out, "%s: %.6fs\n", stats->command, stats->total);
+    fprintf(out, "  stopped %.6fs in %lu stops (stop %.6fs, run %.6fs)\n",
+            stats->stopped, stats->stops, stats->stop, stats->run);
+    fprintf(out, "  read %lu bytes in %lu calls, %.6fs (%.3f MB/s)\n",
+            stats->bytes, stats->reads, stats->read,
+            stats_rate(stats->bytes, stats->read) / 1e6);
+    fprintf(out, "  eval %.6fs\n", stats->eval);
+    fprintf(out, "  hits %lu (%.0f hits/s)\n", stats->hits,
+            stats_rate(stats->hits, stats->total));
+    if (!stats->regions)
+        return;
+    fprintf(out, "  regions %lu (%lu skipped, %lu cached, %lu failed)\n",
+            stats->regions, stats->skipped, stats->cached, stats->failed);
+
+    buf = NULL;
+    size = 0;
+    for (i = 0; i < stats->per_region_size; i++) {
+        const struct stats_region *sr = &stats->per_region[i];
+        size_t len = region_snprint(&sr->region, NULL, 0);
+        if (len + 1 > size) {
+            char *new;
+            if (!(new = realloc(buf, len + 1))) {
+                errf("stats: out-of-memory for region line buffer");
+                break;
+            }
+            buf = new;
+            size = len + 1;
+        }
+        region_snprint(&sr->region, buf, size);
+        fprintf(out, "%s\n    read %lu bytes in %lu calls %.6fs,"
+                " eval %.6fs, %lu hits%s%s%s\n", buf, sr->bytes, sr->reads,
+                sr->read, sr->eval, sr->hits, sr->skipped ? ", skipped" : "",
+                sr->cached ? ", cached" : "", sr->failed ? ", failed" : "");
+    }
+    free(buf);
+}
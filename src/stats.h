@@ -0,0 +1,86 @@
+/*
+ * Per-phase statistics of the last search or filter.
+ *
+ * Times are wall-clock seconds. Reads and scanning may overlap (the search
+ * reads the next chunk while scanning the current one), so read and eval
+ * times do not add up to the total.
+ */
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include "defines.h"
+#include "target.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct stats_region {
+    struct region region;
+    unsigned long bytes;  /* bytes read from the target */
+    unsigned long reads;  /* target read calls */
+    unsigned long hits;   /* hits emitted */
+    double read, eval;    /* seconds reading and evaluating */
+    int skipped;          /* not read (non-present) */
+    int cached;           /* unchanged, hits reused from the cached search */
+    int failed;           /* reading failed */
+};
+
+struct stats {
+    const char *command;   /* NULL if nothing recorded yet */
+    double start, total;   /* start and duration of the command */
+    double stopped;        /* seconds the target was stopped */
+    double stop, run;      /* seconds in target stop() and run() */
+    double stopped_at;     /* start of the ongoing stop */
+    int is_stopped;        /* target is stopped */
+    unsigned long stops;   /* target stop() calls */
+    unsigned long bytes;   /* bytes read from the target */
+    unsigned long reads;   /* target read calls */
+    double read, eval;     /* seconds reading and evaluating */
+    unsigned long hits;    /* hits emitted */
+    unsigned long regions, skipped, cached, failed;
+    struct stats_region *per_region;
+    size_t per_region_size, per_region_capacity;
+};
+
+/*
+ * Current wall-clock time in seconds.
+ */
+double stats_now();
+
+/*
+ * (De)allocate statistics.
+ */
+struct stats *stats_new();
+void stats_delete(struct stats *stats);
+
+/*
+ * Reset statistics for recording `command` (static string).
+ */
+void stats_begin(struct stats *stats, const char *command);
+
+/*
+ * Finish recording the command.
+ */
+void stats_end(struct stats *stats);
+
+/*
+ * Record target stop() and run() calls taking `seconds`.
+ */
+void stats_stopped(struct stats *stats, double seconds);
+void stats_running(struct stats *stats, double seconds);
+
+/*
+ * Add a per-region record for `region` (copied). Returns NULL if out of
+ * memory.
+ */
+struct stats_region *stats_add_region(struct stats *stats,
+                                      const struct region *region);
+
+/*
+ * Print statistics in human-readable form or, if `raw` is set, as
+ * "key value" lines followed by a tab-separated line for every region.
+ */
+void stats_print(const struct stats *stats, int raw, FILE *out);
+
+#endif
@@ -1,25 +1,65 @@
-#define _DEFAULT_SOURCE /* for pread(3) */
+#define _GNU_SOURCE /* for pread(3) and process_vm_readv(2) */
 #include "target.h"
 #include "ramfuck.h"
+#include "group.h"
 #include "ptrace.h"
+#include "remote.h"
 
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/* Maximum number of iovecs per process_vm_readv(2) call */
+#define PROCESS_IOV_MAX 1024
+
+/* Maximum gap and span of file reads coalesced into a single pread(2) */
+#define FILE_COALESCE_GAP 4096
+#define FILE_COALESCE_SPAN (64 * 1024)
+
+/*
+ * Parsed /proc/pid/maps. Paths of the regions point to the `paths` arena.
+ */
+struct process_maps {
+    struct region *regions;
+    size_t size;
+    char *paths;
+    unsigned long stops;   /* process->stops when parsed */
+    int stopped;           /* parsed while the process was stopped */
+    int valid;
+};
 
 struct target_process {
     struct target base;
     pid_t pid;
     int mem_fd;
+    int pagemap_fd;
+    uint64_t zero_pfn; /* page frame of the shared zero page (0 if unknown) */
+    enum target_stop mode;
+    int attached; /* ptrace attached */
+    int stopped;  /* stopped by stop() */
+    unsigned long stops; /* number of stop() calls */
+    struct process_maps maps;
+    unsigned int iterators; /* ongoing region iterations */
 };
 
+static void process_maps_clear(struct process_maps *maps)
+{
+    free(maps->regions);
+    free(maps->paths);
+    memset(maps, 0, sizeof(struct process_maps));
+}
+
 static int pread_buffer(int fd, off_t offset, void *buf, size_t len)
 {
     int errnold = errno;
@@ -40,6 +80,28 @@ static int pread_buffer(int fd, off_t offset, void *buf, size_t len)
     return !len;
 }
 
+/*
+ * Read the readable prefix of `len` bytes at `addr` a page at a time (if the
+ * whole range cannot be read at once).
+ */
+static size_t read_prefix_pages(struct target *target, addr_t addr, void *buf,
+                                size_t len)
+{
+    size_t page_size = target_page_size();
+    size_t off = 0;
+    if (target->read(target, addr, buf, len))
+        return len;
+    while (off < len) {
+        size_t run = page_size - (size_t)((addr + off) % page_size);
+        if (run > len - off)
+            run = len - off;
+        if (!target->read(target, addr + off, (char *)buf + off, run))
+            break;
+        off += run;
+    }
+    return off;
+}
+
 static int pwrite_buffer(int fd, off_t offset, void *buf, size_t len)
 {
     int errnold = errno;
@@ -64,6 +126,12 @@ static int process_detach(struct target *target)
 {
     struct target_process *process = (struct target_process *)target;
     int rc = 1;
+    if (process->attached) {
+        if (!process->stopped)
+            ptrace_break(process->pid);
+        ptrace_detach(process->pid);
+        process->attached = process->stopped = 0;
+    }
     if (process->pid) {
         process->pid = 0;
     } else rc = 0;
@@ -71,70 +139,316 @@ static int process_detach(struct target *target)
         close(process->mem_fd);
         process->mem_fd = -1;
     } else rc = 0;
+    if (process->pagemap_fd != -1) {
+        close(process->pagemap_fd);
+        process->pagemap_fd = -1;
+    }
+    process_maps_clear(&process->maps);
     free(process);
     return rc;
 }
 
+/*
+ * Request the process to stop. Returns 0 on error, 1 if the stop must be
+ * finished with process_stop_wait(), or 2 if the process was not stopped.
+ */
+static int process_stop_request(struct target_process *process)
+{
+    switch (process->mode) {
+    case TARGET_STOP_NONE:
+        return 2;
+    case TARGET_STOP_SESSION:
+        if (process->attached)
+            return ptrace_break_request(process->pid);
+        /* fall through */
+    case TARGET_STOP_DETACH:
+        break;
+    }
+    return ptrace_attach_request(process->pid);
+}
+
+static int process_stop_wait(struct target_process *process)
+{
+    if (!ptrace_wait_stopped(process->pid))
+        return 0;
+    process->attached = 1;
+    process->stopped = 1;
+    process->stops++;
+    return 1;
+}
+
 int process_stop(struct target *target)
 {
     struct target_process *process = (struct target_process *)target;
-    return ptrace_attach(process->pid);
+    int rc = process_stop_request(process);
+    return rc == 2 || (rc && process_stop_wait(process));
 }
 
 int process_run(struct target *target)
 {
     struct target_process *process = (struct target_process *)target;
-    return ptrace_detach(process->pid);
+    if (!process->stopped)
+        return 1;
+    if (process->mode == TARGET_STOP_SESSION) {
+        if (!ptrace_continue(process->pid, 0))
+            return 0;
+    } else {
+        if (!ptrace_detach(process->pid))
+            return 0;
+        process->attached = 0;
+    }
+    process->stopped = 0;
+    return 1;
+}
+
+/*
+ * Signals stop a traced process until they are passed on, so a running
+ * session must be serviced even while nothing is read from the process.
+ */
+static int process_idle(struct target *target)
+{
+    struct target_process *process = (struct target_process *)target;
+    if (!process->attached || process->stopped)
+        return 0;
+    return ptrace_service(process->pid);
+}
+
+static int process_stop_mode(struct target *target, enum target_stop mode)
+{
+    struct target_process *process = (struct target_process *)target;
+    if (process->mode != mode) {
+        /* Leave the running ptrace session */
+        if (process->attached && !process->stopped) {
+            if (!ptrace_break(process->pid) || !ptrace_detach(process->pid))
+                return 0;
+            process->attached = 0;
+        }
+        process->mode = mode;
+    }
+    return 1;
 }
 
 struct process_region_iter {
     struct region region;
-    char pathbuf[4096];
-    FILE* fd;
+    struct target_process *process;
+    size_t index;
 };
 
+/*
+ * Read whole file at `path` to a nul-terminated buffer (NULL on error).
+ */
+static char *process_read_file(const char *path, size_t *plen)
+{
+    char *buf, *new;
+    size_t len, size;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return NULL;
+    len = 0;
+    size = 64 * 1024;
+    if ((buf = malloc(size))) {
+        for (;;) {
+            ssize_t ret;
+            if (len + 1 == size) {
+                if (!(new = realloc(buf, size * 2))) {
+                    free(buf);
+                    buf = NULL;
+                    break;
+                }
+                buf = new;
+                size *= 2;
+            }
+            if ((ret = read(fd, buf + len, size - 1 - len)) > 0) {
+                len += ret;
+            } else if (ret == 0) {
+                buf[len] = '\0';
+                *plen = len;
+                break;
+            } else if (errno != EINTR) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+        }
+    }
+    close(fd);
+    return buf;
+}
+
+/*
+ * Parse a hex number at *pp. Returns zero if there are no digits and -1 if
+ * the value does not fit in ADDR_BITS.
+ */
+static int process_maps_hex(char **pp, addr_t *out)
+{
+    char *p = *pp;
+    addr_t value = 0;
+    int digits = 0;
+    for (;; p++) {
+        int x;
+        if (*p >= '0' && *p <= '9') x = *p - '0';
+        else if (*p >= 'a' && *p <= 'f') x = *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F') x = *p - 'A' + 10;
+        else break;
+        if (value >> (ADDR_BITS - 4))
+            return -1;
+        value = (value << 4) | x;
+        digits++;
+    }
+    *pp = p;
+    *out = value;
+    return digits > 0;
+}
+
+/*
+ * Skip a field and the spaces following it.
+ */
+static char *process_maps_skip(char *p)
+{
+    while (*p && *p != ' ' && *p != '\n') p++;
+    while (*p == ' ') p++;
+    return p;
+}
+
 /*
  * /proc/pid/maps format:
  * address           perms offset  dev   inode   pathname
  * 00400000-00580000 r-xp 00000000 fe:01 4858009 /usr/lib/nethack/nethack
+ *
+ * The file is read with a single buffer. Paths are first terminated in the
+ * buffer (consecutive equal paths shared) and then packed to the arena.
  */
-static struct region *process_region_iter_next(struct region *it)
+static int process_maps_parse(struct target_process *process)
 {
-    if (it) {
-        char range[256];
+    struct process_maps *maps = &process->maps;
+    char filename[128], *buf, *p, *prev, *packed, *arena;
+    struct region *regions, *new;
+    size_t len, lines, size, paths_len, i;
+    int ok;
+
+    if (process->pid > 0) {
+        sprintf(filename, "/proc/%lu/maps", (unsigned long)process->pid);
+    } else {
+        memcpy(filename, "/proc/self/maps", sizeof("/proc/self/maps"));
+    }
+    if (!(buf = process_read_file(filename, &len))) {
+        errf("target: error reading %s", filename);
+        return 0;
+    }
+
+    for (lines = 1, p = buf; (p = strchr(p, '\n')); p++, lines++);
+    if (!(regions = malloc(sizeof(struct region) * lines))) {
+        errf("target: out-of-memory for memory regions");
+        free(buf);
+        return 0;
+    }
+
+    size = paths_len = 0;
+    prev = NULL;
+    for (p = buf; *p; ) {
+        struct region *mr = &regions[size];
         addr_t start, end;
-        if (fscanf(((struct process_region_iter *)it)->fd, "%255[^ ]", range)) {
-            char *p = strchr(range, '-');
-            if (p && strlen(p+1 + strspn(p+1, "0")) * 4 <= ADDR_BITS) {
-                char perms[4];
-                *((struct process_region_iter *)it)->pathbuf = '\0';
-                if (sscanf(range, "%" SCNaddr "-%" SCNaddr, &start, &end) == 2
-                 && fscanf(((struct process_region_iter *)it)->fd,
-                           " %c%c%c%c %*[^ ] %*[^ ] %*[^ ]%*[ ]%4095[^\n]",
-                           &perms[0], &perms[1], &perms[2], &perms[3],
-                           ((struct process_region_iter *)it)->pathbuf) >= 4) {
-                    it->start = start;
-                    it->size = end - start;
-                    it->prot = 0;
-                    if (perms[0] == 'r') it->prot |= MEM_READ;
-                    if (perms[1] == 'w') it->prot |= MEM_WRITE;
-                    if (perms[2] == 'x') it->prot |= MEM_EXECUTE;
-                    it->path = ((struct process_region_iter *)it)->pathbuf;
-                    it->path += isspace(*it->path);
-                    if (!*it->path)
-                        it->path = NULL;
-                    return it;
-                } else {
-                    errf("target: invalid /proc/pid/maps format");
-                }
-            } else if (p) {
+        char *path;
+        if ((ok = process_maps_hex(&p, &start)) <= 0 || *p++ != '-'
+                || (ok = process_maps_hex(&p, &end)) <= 0 || *p++ != ' '
+                || !p[0] || !p[1] || !p[2] || !p[3]) {
+            if (ok < 0) {
                 warnf("target: process memory addresses exceed supported "
                       "%u bits", (unsigned int)ADDR_BITS);
+            } else {
+                errf("target: invalid /proc/pid/maps format");
             }
+            break;
+        }
+        mr->start = start;
+        mr->size = end - start;
+        mr->prot = 0;
+        if (p[0] == 'r') mr->prot |= MEM_READ;
+        if (p[1] == 'w') mr->prot |= MEM_WRITE;
+        if (p[2] == 'x') mr->prot |= MEM_EXECUTE;
+        p = process_maps_skip(p);  /* perms */
+        p = process_maps_skip(p);  /* offset */
+        p = process_maps_skip(p);  /* dev */
+        p = process_maps_skip(p);  /* inode */
+        for (path = p; *p && *p != '\n'; p++);
+        if (*p) *p++ = '\0';
+        if (!*path) {
+            mr->path = NULL;
+        } else if (prev && !strcmp(prev, path)) {
+            mr->path = prev;
+        } else {
+            mr->path = prev = path;
+            paths_len += strlen(path) + 1;
+        }
+        size++;
+    }
+
+    /* Pack the paths to the arena */
+    if (!(arena = malloc(paths_len ? paths_len : 1))) {
+        errf("target: out-of-memory for memory region paths");
+        free(regions);
+        free(buf);
+        return 0;
+    }
+    prev = packed = NULL;
+    for (i = 0, p = arena; i < size; i++) {
+        if (regions[i].path && regions[i].path != prev) {
+            size_t n = strlen(regions[i].path) + 1;
+            prev = regions[i].path;
+            memcpy(p, prev, n);
+            regions[i].path = packed = p;
+            p += n;
+        } else if (regions[i].path) {
+            regions[i].path = packed;
+        }
+    }
+    free(buf);
+    if (size < lines && (new = realloc(regions,
+                                       sizeof(struct region) * size))) {
+        regions = new;
+    }
+
+    process_maps_clear(maps);
+    maps->regions = regions;
+    maps->size = size;
+    maps->paths = arena;
+    maps->valid = 1;
+    return 1;
+}
+
+/*
+ * Reparse maps unless the parsed table is still up-to-date. The table is
+ * fresh only for the rest of the stop during which it was parsed; mappings of
+ * a running process may change at any time (mprotect, munmap, mremap).
+ */
+static int process_maps_update(struct target_process *process)
+{
+    struct process_maps *maps = &process->maps;
+
+    if (maps->valid && maps->stopped && process->stopped
+            && maps->stops == process->stops)
+        return 1;
+    if (!process_maps_parse(process))
+        return 0;
+    /* Mappings won't change before the process is continued */
+    maps->stops = process->stops;
+    maps->stopped = process->stopped;
+    return 1;
+}
+
+static struct region *process_region_iter_next(struct region *it)
+{
+    struct process_region_iter *iter = (struct process_region_iter *)it;
+    if (iter) {
+        struct process_maps *maps = &iter->process->maps;
+        if (iter->index < maps->size) {
+            memcpy(&iter->region, &maps->regions[iter->index++],
+                   sizeof(struct region));
+            return &iter->region;
         }
-        fclose(((struct process_region_iter *)it)->fd);
-        free(it);
-        it = NULL;
+        iter->process->iterators--;
+        free(iter);
     }
     return NULL;
 }
@@ -143,23 +457,33 @@ static struct region *process_region_iter_first(struct target *target)
 {
     struct process_region_iter *it;
     struct target_process *process = (struct target_process *)target;
-    if ((it = malloc(sizeof(struct process_region_iter)))) {
-        char filename[128];
-        it->region.path = it->pathbuf;
-
-        if (process->pid > 0) {
-            sprintf(filename, "/proc/%lu/maps", (unsigned long)process->pid);
-        } else {
-            memcpy(filename, "/proc/self/maps", sizeof("/proc/self/maps"));
-        }
 
-        if (!(it->fd = fopen(filename, "r"))) {
-            errf("target: error opening %s", filename);
-            free(it);
-            it = NULL;
-        }
+    /* Regions of ongoing iterations must stay valid */
+    if (!process->iterators && !process_maps_update(process)
+            && !process->maps.valid)
+        return NULL;
+    if (!(it = malloc(sizeof(struct process_region_iter)))) {
+        errf("target: out-of-memory for region iterator");
+        return NULL;
     }
-    return it ? process_region_iter_next((struct region *)it) : NULL;
+    it->process = process;
+    it->index = 0;
+    process->iterators++;
+    return process_region_iter_next((struct region *)it);
+}
+
+static int process_refresh(struct target *target)
+{
+    struct target_process *process = (struct target_process *)target;
+    if (process->iterators)
+        return 0;
+    process->maps.valid = 0;
+    return process_maps_update(process);
+}
+
+static const void *process_map(struct target *target, addr_t addr, size_t len)
+{
+    return NULL;
 }
 
 static int process_ptrace_read(struct target_process *process,
@@ -177,26 +501,294 @@ static int process_pread_buffer(struct target_process *process,
         && pread_buffer(process->mem_fd, addr, buf, len);
 }
 
+static int process_vm_read(struct target_process *process,
+                           addr_t addr, void *buf, size_t len)
+{
+    struct iovec local, remote;
+    if (addr != (uintptr_t)addr)
+        return 0;
+    local.iov_base = buf;
+    local.iov_len = len;
+    remote.iov_base = (void *)(uintptr_t)addr;
+    remote.iov_len = len;
+    return process_vm_readv(process->pid, &local, 1, &remote, 1, 0)
+        == (ssize_t)len;
+}
+
+/*
+ * Reads of all sizes are a single process_vm_readv(2). /proc/pid/mem and
+ * ptrace (one syscall per word) are fallbacks, e.g., for memory that cannot
+ * be read with process_vm_readv(2).
+ */
 static int process_read(struct target *target,
                         addr_t addr, void *buf, size_t len)
 {
     struct target_process *process = (struct target_process *)target;
-    if (len <= sizeof(long)) {
-        return process_ptrace_read(process, addr, buf, len)
-            || process_pread_buffer(process, addr, buf, len);
+    if (process_vm_read(process, addr, buf, len))
+        return 1;
+    if (!process->stopped) {
+        /* Not ptrace-stopped, so read without ptrace */
+        return process_pread_buffer(process, addr, buf, len);
     }
     return process_pread_buffer(process, addr, buf, len)
         || process_ptrace_read(process, addr, buf, len);
 }
 
+/*
+ * process_vm_readv(2) stops at the first page that cannot be read, which
+ * gives the readable prefix in one syscall.
+ */
+static size_t process_read_prefix(struct target *target,
+                                  addr_t addr, void *buf, size_t len)
+{
+    struct target_process *process = (struct target_process *)target;
+    struct iovec local, remote;
+    ssize_t ret;
+    if (addr == (uintptr_t)addr) {
+        local.iov_base = buf;
+        local.iov_len = len;
+        remote.iov_base = (void *)(uintptr_t)addr;
+        remote.iov_len = len;
+        if ((ret = process_vm_readv(process->pid, &local, 1, &remote, 1, 0)) > 0)
+            return (size_t)ret;
+    }
+    return read_prefix_pages(target, addr, buf, len);
+}
+
+/*
+ * Read batch with process_vm_readv(2). The kernel stops at the first remote
+ * iovec that cannot be read, so that element is read with process_read() and
+ * the batch continues from the next one.
+ */
+static int process_read_batch(struct target *target,
+                              struct target_read *reads, size_t n)
+{
+    struct target_process *process = (struct target_process *)target;
+    struct iovec local[PROCESS_IOV_MAX], remote[PROCESS_IOV_MAX];
+    size_t i, j, count;
+    int rc = 1;
+
+    i = 0;
+    while (i < n) {
+        ssize_t ret;
+        size_t bytes;
+        for (count = 0; count < PROCESS_IOV_MAX && i + count < n; count++) {
+            struct target_read *read = &reads[i + count];
+            if (read->addr != (uintptr_t)read->addr)
+                break;
+            local[count].iov_base = read->buf;
+            local[count].iov_len = read->len;
+            remote[count].iov_base = (void *)(uintptr_t)read->addr;
+            remote[count].iov_len = read->len;
+        }
+
+        ret = count ? process_vm_readv(process->pid, local, count,
+                                       remote, count, 0) : -1;
+        bytes = (ret > 0) ? (size_t)ret : 0;
+        for (j = 0; j < count && bytes >= reads[i + j].len; j++) {
+            bytes -= reads[i + j].len;
+            reads[i + j].ok = 1;
+        }
+        i += j;
+
+        /* Fall back to regular reads for the failed element */
+        if (i < n) {
+            struct target_read *read = &reads[i++];
+            if (!(read->ok = process_read(target, read->addr, read->buf,
+                                          read->len)))
+                rc = 0;
+        }
+    }
+    return rc;
+}
+
+/*
+ * Get the page frame number of the shared zero page (0 if unknown). Reading
+ * untouched private anonymous memory maps the zero page, which pagemap shows
+ * present although the memory just reads as zeros. Page frame numbers are
+ * only visible with CAP_SYS_ADMIN.
+ */
+static uint64_t process_zero_pfn()
+{
+    size_t page_size = target_page_size();
+    uint64_t entry, pfn = 0;
+    volatile char *p;
+    int fd;
+
+    p = mmap(NULL, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    if (!p[0] && (fd = open("/proc/self/pagemap", O_RDONLY)) != -1) {
+        off_t offset = (off_t)((uintptr_t)p / page_size * sizeof(uint64_t));
+        if (pread_buffer(fd, offset, &entry, sizeof(uint64_t))
+                && (entry & (UINT64_C(1) << 63)))
+            pfn = entry & ((UINT64_C(1) << 55) - 1);
+        close(fd);
+    }
+    munmap((void *)p, page_size);
+    return pfn;
+}
+
+/*
+ * /proc/pid/pagemap has a 64-bit entry for every virtual page:
+ * bit 63 page present, bit 62 page swapped, bit 55 pte is soft-dirty and
+ * bits 0-54 page frame number (if present).
+ */
+static int process_page_flags(struct target *target, addr_t addr, size_t len,
+                              unsigned char *flags)
+{
+    struct target_process *process = (struct target_process *)target;
+    uint64_t entries[512];
+    size_t page_size = target_page_size();
+    addr_t page = addr / page_size;
+    size_t i, n, pages;
+
+    if (process->pagemap_fd == -1 || !len)
+        return 0;
+    pages = (addr + len - 1) / page_size - page + 1;
+    while (pages > 0) {
+        off_t offset = (off_t)page * sizeof(uint64_t);
+        if (offset / sizeof(uint64_t) != page)
+            return 0;
+        n = (pages < sizeof(entries)/sizeof(*entries))
+          ? pages : sizeof(entries)/sizeof(*entries);
+        if (!pread_buffer(process->pagemap_fd, offset, entries,
+                          n * sizeof(uint64_t)))
+            return 0;
+        for (i = 0; i < n; i++) {
+            uint64_t entry = entries[i];
+            *flags = 0;
+            if ((entry & (UINT64_C(1) << 63)) && (!process->zero_pfn
+                    || (entry & ((UINT64_C(1) << 55) - 1)) != process->zero_pfn))
+                *flags |= TARGET_PAGE_PRESENT;
+            if (entry & (UINT64_C(1) << 62)) *flags |= TARGET_PAGE_SWAPPED;
+            if (entry & (UINT64_C(1) << 55)) *flags |= TARGET_PAGE_SOFT_DIRTY;
+            flags++;
+        }
+        page += n;
+        pages -= n;
+    }
+    return 1;
+}
+
+/*
+ * Check if the kernel tracks soft-dirty pages (CONFIG_MEM_SOFT_DIRTY). Newly
+ * written pages are soft-dirty if it does; otherwise the bit always reads as
+ * zero and every page would look clean.
+ */
+static int process_soft_dirty_supported()
+{
+    static int supported = -1;
+    size_t page_size = target_page_size();
+    uint64_t entry;
+    volatile char *p;
+    int fd;
+
+    if (supported != -1)
+        return supported;
+    supported = 0;
+    p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    p[0] = 1;
+    if ((fd = open("/proc/self/pagemap", O_RDONLY)) != -1) {
+        off_t offset = (off_t)((uintptr_t)p / page_size * sizeof(uint64_t));
+        if (pread_buffer(fd, offset, &entry, sizeof(uint64_t))
+                && (entry & (UINT64_C(1) << 63)))
+            supported = (entry & (UINT64_C(1) << 55)) != 0;
+        close(fd);
+    }
+    munmap((void *)p, page_size);
+    return supported;
+}
+
+/*
+ * Writing 4 to /proc/pid/clear_refs clears the soft-dirty bits of all pages.
+ */
+static int process_clear_soft_dirty(struct target *target)
+{
+    struct target_process *process = (struct target_process *)target;
+    char path[128];
+    int fd, ok;
+
+    if (!process_soft_dirty_supported())
+        return 0;
+    sprintf(path, "/proc/%lu/clear_refs", (unsigned long)process->pid);
+    if ((fd = open(path, O_WRONLY)) == -1)
+        return 0;
+    ok = write(fd, "4", 1) == 1;
+    close(fd);
+    return ok;
+}
+
 static int process_write(struct target *target, addr_t addr, void *buf,
                          size_t len)
 {
+    struct target_process *process = (struct target_process *)target;
+    struct iovec local, remote;
+
+    /* process_vm_writev(2) cannot write read-only memory unlike the others */
     if ((uintptr_t)addr == addr) {
-        struct target_process *process = (struct target_process *)target;
-        return ptrace_write(process->pid, (void *)(uintptr_t)addr, buf, len);
+        local.iov_base = buf;
+        local.iov_len = len;
+        remote.iov_base = (void *)(uintptr_t)addr;
+        remote.iov_len = len;
+        if (process_vm_writev(process->pid, &local, 1, &remote, 1, 0)
+                == (ssize_t)len)
+            return 1;
     }
-    return 0;
+    if (process->stopped && (uintptr_t)addr == addr
+            && ptrace_write(process->pid, (void *)(uintptr_t)addr, buf, len))
+        return 1;
+    return process->mem_fd != -1 && addr == (off_t)addr
+        && pwrite_buffer(process->mem_fd, addr, buf, len);
+}
+
+/*
+ * Write batch with process_vm_writev(2). Elements that cannot be written so
+ * (e.g., read-only memory) are written with process_write().
+ */
+static int process_write_batch(struct target *target,
+                               struct target_read *writes, size_t n)
+{
+    struct target_process *process = (struct target_process *)target;
+    struct iovec local[PROCESS_IOV_MAX], remote[PROCESS_IOV_MAX];
+    size_t i, j, count;
+    int rc = 1;
+
+    i = 0;
+    while (i < n) {
+        ssize_t ret;
+        size_t bytes;
+        for (count = 0; count < PROCESS_IOV_MAX && i + count < n; count++) {
+            struct target_read *write = &writes[i + count];
+            if (write->addr != (uintptr_t)write->addr)
+                break;
+            local[count].iov_base = write->buf;
+            local[count].iov_len = write->len;
+            remote[count].iov_base = (void *)(uintptr_t)write->addr;
+            remote[count].iov_len = write->len;
+        }
+
+        ret = count ? process_vm_writev(process->pid, local, count,
+                                        remote, count, 0) : -1;
+        bytes = (ret > 0) ? (size_t)ret : 0;
+        for (j = 0; j < count && bytes >= writes[i + j].len; j++) {
+            bytes -= writes[i + j].len;
+            writes[i + j].ok = 1;
+        }
+        i += j;
+
+        /* Fall back to a regular write for the failed element */
+        if (i < n) {
+            struct target_read *write = &writes[i++];
+            if (!(write->ok = process_write(target, write->addr, write->buf,
+                                            write->len)))
+                rc = 0;
+        }
+    }
+    return rc;
 }
 
 static struct target *target_attach_pid(pid_t pid)
@@ -208,7 +800,16 @@ static struct target *target_attach_pid(pid_t pid)
         process_region_iter_first,
         process_region_iter_next,
         process_read,
-        process_write
+        process_write,
+        process_read_prefix,
+        process_read_batch,
+        process_write_batch,
+        process_stop_mode,
+        process_page_flags,
+        process_clear_soft_dirty,
+        process_refresh,
+        process_map,
+        process_idle
     };
 
     struct target_process *process;
@@ -217,11 +818,19 @@ static struct target *target_attach_pid(pid_t pid)
             char mem_path[128];
             memcpy(process, &process_init, sizeof(struct target));
             process->pid = pid;
+            process->mode = TARGET_STOP_DETACH;
+            process->attached = process->stopped = 0;
+            process->stops = 0;
+            memset(&process->maps, 0, sizeof(struct process_maps));
+            process->iterators = 0;
             sprintf(mem_path, "/proc/%lu/mem", (unsigned long)pid);
             if ((process->mem_fd = open(mem_path, O_RDWR)) == -1) {
                 if ((process->mem_fd = open(mem_path, O_RDONLY)) == -1)
                     warnf("target: open(%s) failed", mem_path);
             }
+            sprintf(mem_path, "/proc/%lu/pagemap", (unsigned long)pid);
+            process->pagemap_fd = open(mem_path, O_RDONLY);
+            process->zero_pfn = process_zero_pfn();
         } else {
             errf("target: out-of-memory for process target instance");
         }
@@ -238,11 +847,16 @@ struct target_file {
     int rw;
     off_t size;
     char *path;
+    char *data; /* read-only mapping of the file or NULL */
 };
 
 static int file_detach(struct target *target)
 {
     struct target_file *file = (struct target_file *)target;
+    if (file->data) {
+        munmap(file->data, file->size);
+        file->data = NULL;
+    }
     if (file->fd != -1) {
         close(file->fd);
         file->fd = -1;
@@ -265,28 +879,60 @@ int file_run(struct target *target)
     return 1;
 }
 
+static int file_stop_mode(struct target *target, enum target_stop mode)
+{
+    return 1;
+}
+
+static int file_idle(struct target *target)
+{
+    return 0;
+}
+
+static int file_page_flags(struct target *target, addr_t addr, size_t len,
+                           unsigned char *flags)
+{
+    return 0;
+}
+
+static int file_clear_soft_dirty(struct target *target)
+{
+    return 0;
+}
+
+static int file_refresh(struct target *target)
+{
+    return 1;
+}
+
+static const void *file_map(struct target *target, addr_t addr, size_t len)
+{
+    struct target_file *file = (struct target_file *)target;
+    if (file->data && addr < (addr_t)file->size
+            && len <= (addr_t)file->size - addr) {
+        size_t page = target_page_size();
+        size_t start = (size_t)addr & ~(page - 1);
+        madvise(file->data + start, (size_t)addr + len - start, MADV_WILLNEED);
+        return file->data + (size_t)addr;
+    }
+    return NULL;
+}
+
 static struct region *file_region_first(struct target *target)
 {
     struct region *it;
     if ((it = malloc(sizeof(struct region)))) {
-        size_t size;
         struct target_file *file = (struct target_file *)target;
         it->start = 0;
         it->size = file->size;
         it->prot = file->rw ? (MEM_READ|MEM_WRITE) : MEM_READ;
-        if ((size = strlen(file->path)) && ++size) {
-            if ((it->path = malloc(size)))
-                memcpy(it->path, file->path, size);
-        } else {
-            it->path = NULL;
-        }
+        it->path = *file->path ? file->path : NULL;
     }
     return it;
 }
 
 static struct region *file_region_next(struct region *it)
 {
-    free(it->path);
     free(it);
     return NULL;
 }
@@ -297,12 +943,69 @@ static int file_read(struct target *target, addr_t addr, void *buf, size_t len)
     return addr == (off_t)addr && pread_buffer(file->fd, addr, buf, len);
 }
 
+/*
+ * Read batch with preads of nearby elements coalesced to a single read.
+ */
+static int file_read_batch(struct target *target,
+                           struct target_read *reads, size_t n)
+{
+    struct target_file *file = (struct target_file *)target;
+    char span[FILE_COALESCE_SPAN];
+    size_t i, j, k;
+    int rc = 1;
+
+    for (i = 0; i < n; i = j) {
+        addr_t start = reads[i].addr;
+        addr_t end = start + reads[i].len;
+
+        /* Extend the span while the next element starts soon after it */
+        for (j = i + 1; j < n; j++) {
+            addr_t next_end = reads[j].addr + reads[j].len;
+            if (reads[j].addr < start || reads[j].addr > end + FILE_COALESCE_GAP
+                    || (next_end > end ? next_end : end) - start
+                       > FILE_COALESCE_SPAN)
+                break;
+            if (next_end > end)
+                end = next_end;
+        }
+
+        if (j - i > 1 && (off_t)(end - start) <= file->size - (off_t)start
+                && file_read(target, start, span, end - start)) {
+            for (k = i; k < j; k++) {
+                memcpy(reads[k].buf, span + (reads[k].addr - start),
+                       reads[k].len);
+                reads[k].ok = 1;
+            }
+        } else {
+            for (k = i; k < j; k++) {
+                if (!(reads[k].ok = file_read(target, reads[k].addr,
+                                              reads[k].buf, reads[k].len)))
+                    rc = 0;
+            }
+        }
+    }
+    return rc;
+}
+
 static int file_write(struct target *target, addr_t addr, void *buf, size_t len)
 {
     struct target_file *file = (struct target_file *)target;
     return addr == (off_t)addr && pwrite_buffer(file->fd, addr, buf, len);
 }
 
+static int file_write_batch(struct target *target,
+                            struct target_read *writes, size_t n)
+{
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < n; i++) {
+        if (!(writes[i].ok = file_write(target, writes[i].addr, writes[i].buf,
+                                        writes[i].len)))
+            rc = 0;
+    }
+    return rc;
+}
+
 static struct target *target_attach_file(const char *path)
 {
     static const struct target file_init = {
@@ -312,7 +1015,16 @@ static struct target *target_attach_file(const char *path)
         file_region_first,
         file_region_next,
         file_read,
-        file_write
+        file_write,
+        read_prefix_pages,
+        file_read_batch,
+        file_write_batch,
+        file_stop_mode,
+        file_page_flags,
+        file_clear_soft_dirty,
+        file_refresh,
+        file_map,
+        file_idle
     };
     int fd, rw;
     if ((rw = (fd = open(path, O_RDWR)) != -1) || (fd = open(path, O_RDONLY))) {
@@ -324,6 +1036,14 @@ static struct target *target_attach_file(const char *path)
                 file->fd = fd;
                 file->rw = rw;
                 file->size = sz;
+                file->data = NULL;
+                if (sz == (off_t)(size_t)sz) {
+                    void *data = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+                    if (data != MAP_FAILED) {
+                        madvise(data, sz, MADV_SEQUENTIAL);
+                        file->data = data;
+                    }
+                }
                 if ((sz = strlen(path)) && ++sz) {
                     if ((file->path = malloc(sz)))
                         memcpy(file->path, path, sz);
@@ -346,16 +1066,737 @@ static struct target *target_attach_file(const char *path)
     return NULL;
 }
 
-struct target *target_attach(const char *uri)
-{
-    if (!memcmp(uri, "pid://", 6)) {
-        char *end;
+/*
+ * ELF core dump target. PT_LOAD segments with data in the core are served
+ * from a read-only mapping of the core file at their original addresses, and
+ * the NT_FILE note gives the paths of file-backed segments. The target is
+ * read-only.
+ */
+struct target_core {
+    struct target base;
+    int fd;
+    size_t size;
+    char *data;             /* read-only mapping of the core file */
+    struct region *regions; /* in address order (paths point to data) */
+    size_t *offsets;        /* file offset of every region */
+    size_t regions_size;
+};
+
+struct core_region_iter {
+    struct region region;
+    struct target_core *core;
+    size_t index;
+};
+
+static int core_detach(struct target *target)
+{
+    struct target_core *core = (struct target_core *)target;
+    if (core->data)
+        munmap(core->data, core->size);
+    if (core->fd != -1)
+        close(core->fd);
+    free(core->offsets);
+    free(core->regions);
+    free(core);
+    return 1;
+}
+
+static int core_stop(struct target *target)
+{
+    return 1;
+}
+
+static int core_run(struct target *target)
+{
+    return 1;
+}
+
+static int core_idle(struct target *target)
+{
+    return 0;
+}
+
+static struct region *core_region_next(struct region *it)
+{
+    struct core_region_iter *iter = (struct core_region_iter *)it;
+    if (iter) {
+        struct target_core *core = iter->core;
+        if (iter->index < core->regions_size) {
+            memcpy(&iter->region, &core->regions[iter->index++],
+                   sizeof(struct region));
+            return &iter->region;
+        }
+        free(iter);
+    }
+    return NULL;
+}
+
+static struct region *core_region_first(struct target *target)
+{
+    struct core_region_iter *it;
+    if (!(it = malloc(sizeof(struct core_region_iter)))) {
+        errf("target: out-of-memory for region iterator");
+        return NULL;
+    }
+    it->core = (struct target_core *)target;
+    it->index = 0;
+    return core_region_next((struct region *)it);
+}
+
+/*
+ * Index of the region containing `addr`, or regions_size if none does.
+ */
+static size_t core_find(const struct target_core *core, addr_t addr)
+{
+    size_t lo = 0, hi = core->regions_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct region *mr = &core->regions[mid];
+        if (addr < mr->start) {
+            hi = mid;
+        } else if (addr - mr->start >= mr->size) {
+            lo = mid + 1;
+        } else return mid;
+    }
+    return core->regions_size;
+}
+
+static const void *core_map(struct target *target, addr_t addr, size_t len)
+{
+    struct target_core *core = (struct target_core *)target;
+    size_t i = core_find(core, addr);
+    if (i < core->regions_size
+            && len <= core->regions[i].size - (addr - core->regions[i].start))
+        return core->data + core->offsets[i] + (addr - core->regions[i].start);
+    return NULL;
+}
+
+/*
+ * Copy the readable prefix of `len` bytes at `addr` (possibly spanning
+ * adjacent segments).
+ */
+static size_t core_read_prefix(struct target *target, addr_t addr, void *buf,
+                               size_t len)
+{
+    struct target_core *core = (struct target_core *)target;
+    size_t i, off = 0;
+    for (i = core_find(core, addr); off < len && i < core->regions_size; i++) {
+        const struct region *mr = &core->regions[i];
+        addr_t at = addr + off;
+        size_t run;
+        if (at < mr->start || at - mr->start >= mr->size)
+            break;
+        run = (size_t)(mr->size - (at - mr->start));
+        if (run > len - off)
+            run = len - off;
+        memcpy((char *)buf + off, core->data + core->offsets[i]
+                                  + (at - mr->start), run);
+        off += run;
+    }
+    return off;
+}
+
+static int core_read(struct target *target, addr_t addr, void *buf, size_t len)
+{
+    return core_read_prefix(target, addr, buf, len) == len;
+}
+
+static int core_write(struct target *target, addr_t addr, void *buf, size_t len)
+{
+    return 0;
+}
+
+static int core_read_batch(struct target *target,
+                           struct target_read *reads, size_t n)
+{
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < n; i++) {
+        if (!(reads[i].ok = core_read(target, reads[i].addr, reads[i].buf,
+                                      reads[i].len)))
+            rc = 0;
+    }
+    return rc;
+}
+
+static int core_write_batch(struct target *target,
+                            struct target_read *writes, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        writes[i].ok = 0;
+    return !n;
+}
+
+static int core_stop_mode(struct target *target, enum target_stop mode)
+{
+    return 1;
+}
+
+static int core_page_flags(struct target *target, addr_t addr, size_t len,
+                           unsigned char *flags)
+{
+    return 0;
+}
+
+static int core_clear_soft_dirty(struct target *target)
+{
+    return 0;
+}
+
+static int core_refresh(struct target *target)
+{
+    return 1;
+}
+
+/* Program header and note fields common to 32- and 64-bit cores */
+struct core_phdr {
+    uint32_t type, flags;
+    uint64_t offset, vaddr, filesz;
+};
+
+static int core_phdr_get(const struct target_core *core, size_t i,
+                         struct core_phdr *phdr)
+{
+    if (core->data[EI_CLASS] == ELFCLASS64) {
+        const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)core->data;
+        Elf64_Phdr ph;
+        memcpy(&ph, core->data + ehdr->e_phoff + i * ehdr->e_phentsize,
+               sizeof(Elf64_Phdr));
+        phdr->type = ph.p_type;
+        phdr->flags = ph.p_flags;
+        phdr->offset = ph.p_offset;
+        phdr->vaddr = ph.p_vaddr;
+        phdr->filesz = ph.p_filesz;
+    } else {
+        const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)core->data;
+        Elf32_Phdr ph;
+        memcpy(&ph, core->data + ehdr->e_phoff + i * ehdr->e_phentsize,
+               sizeof(Elf32_Phdr));
+        phdr->type = ph.p_type;
+        phdr->flags = ph.p_flags;
+        phdr->offset = ph.p_offset;
+        phdr->vaddr = ph.p_vaddr;
+        phdr->filesz = ph.p_filesz;
+    }
+    return phdr->offset <= core->size;
+}
+
+/*
+ * Read a word of the ELF class of the core.
+ */
+static uint64_t core_word(const struct target_core *core, const char *p)
+{
+    if (core->data[EI_CLASS] == ELFCLASS64) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(uint64_t));
+        return word;
+    } else {
+        uint32_t word;
+        memcpy(&word, p, sizeof(uint32_t));
+        return word;
+    }
+}
+
+/*
+ * NT_FILE: count and page size words, count (start, end, file offset in
+ * pages) word triples and count NUL-terminated paths. Paths are assigned to
+ * the regions starting within the mapped files.
+ */
+static void core_parse_files(struct target_core *core, const char *desc,
+                             size_t size)
+{
+    size_t word = (core->data[EI_CLASS] == ELFCLASS64) ? 8 : 4;
+    const char *path, *end = desc + size;
+    uint64_t count, i;
+    size_t j;
+
+    if (size < 2 * word)
+        return;
+    count = core_word(core, desc);
+    if (count > (size - 2 * word) / (3 * word))
+        return;
+    path = desc + 2 * word + count * 3 * word;
+    for (i = 0; i < count; i++) {
+        const char *triple = desc + 2 * word + i * 3 * word;
+        uint64_t start = core_word(core, triple);
+        uint64_t stop = core_word(core, triple + word);
+        const char *nul = memchr(path, '\0', end - path);
+        if (!nul)
+            return;
+        for (j = core_find(core, start); j < core->regions_size; j++) {
+            struct region *mr = &core->regions[j];
+            if (mr->start < start || mr->start >= stop)
+                break;
+            mr->path = (char *)path;
+        }
+        path = nul + 1;
+    }
+}
+
+static void core_parse_notes(struct target_core *core, const char *notes,
+                             size_t size)
+{
+    size_t off = 0;
+    while (size - off >= 3 * sizeof(uint32_t)) {
+        uint32_t hdr[3];
+        size_t name, desc;
+        memcpy(hdr, notes + off, sizeof(hdr));
+        name = off + sizeof(hdr);
+        desc = name + ((hdr[0] + 3) & ~(size_t)3);
+        if (desc > size || hdr[1] > size - desc)
+            return;
+        if (hdr[2] == NT_FILE && hdr[0] == 5 && !memcmp(notes + name, "CORE", 5))
+            core_parse_files(core, notes + desc, hdr[1]);
+        off = desc + ((hdr[1] + 3) & ~(size_t)3);
+    }
+}
+
+static int core_region_compare(const void *a, const void *b)
+{
+    const struct region *x = (const struct region *)a;
+    const struct region *y = (const struct region *)b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Parse PT_LOAD segments with data in the core into regions and the paths
+ * of the NT_FILE note of PT_NOTE segments.
+ */
+static int core_parse(struct target_core *core, const char *path)
+{
+    static const uint16_t endian = 1;
+    const unsigned char *ident = (const unsigned char *)core->data;
+    struct core_phdr phdr;
+    size_t phoff, phnum, phentsize, i, n;
+
+    if (core->size < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG)
+            || (ident[EI_CLASS] != ELFCLASS64 && ident[EI_CLASS] != ELFCLASS32)
+            || ident[EI_DATA] != (*(const char *)&endian ? ELFDATA2LSB
+                                                         : ELFDATA2MSB)) {
+        errf("target: %s is not a native-endian ELF file", path);
+        return 0;
+    }
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        Elf64_Ehdr ehdr;
+        if (core->size < sizeof(Elf64_Ehdr)) {
+            errf("target: %s is not an ELF core dump (truncated)", path);
+            return 0;
+        }
+        memcpy(&ehdr, core->data, sizeof(Elf64_Ehdr));
+        if (ehdr.e_type != ET_CORE || ehdr.e_phentsize < sizeof(Elf64_Phdr)) {
+            errf("target: %s is not an ELF core dump", path);
+            return 0;
+        }
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        if (phnum == PN_XNUM) {
+            /* The count of 65535+ headers is in sh_info of section 0 */
+            Elf64_Shdr shdr;
+            if (!ehdr.e_shoff || ehdr.e_shoff > core->size
+                    || ehdr.e_shentsize < sizeof(Elf64_Shdr)
+                    || core->size - ehdr.e_shoff < sizeof(Elf64_Shdr)) {
+                errf("target: truncated section headers in %s", path);
+                return 0;
+            }
+            memcpy(&shdr, (const char *)core->data + ehdr.e_shoff,
+                   sizeof(Elf64_Shdr));
+            phnum = shdr.sh_info;
+        }
+    } else {
+        Elf32_Ehdr ehdr;
+        if (core->size < sizeof(Elf32_Ehdr)) {
+            errf("target: %s is not an ELF core dump (truncated)", path);
+            return 0;
+        }
+        memcpy(&ehdr, core->data, sizeof(Elf32_Ehdr));
+        if (ehdr.e_type != ET_CORE || ehdr.e_phentsize < sizeof(Elf32_Phdr)) {
+            errf("target: %s is not an ELF core dump", path);
+            return 0;
+        }
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        if (phnum == PN_XNUM) {
+            /* The count of 65535+ headers is in sh_info of section 0 */
+            Elf32_Shdr shdr;
+            if (!ehdr.e_shoff || ehdr.e_shoff > core->size
+                    || ehdr.e_shentsize < sizeof(Elf32_Shdr)
+                    || core->size - ehdr.e_shoff < sizeof(Elf32_Shdr)) {
+                errf("target: truncated section headers in %s", path);
+                return 0;
+            }
+            memcpy(&shdr, (const char *)core->data + ehdr.e_shoff,
+                   sizeof(Elf32_Shdr));
+            phnum = shdr.sh_info;
+        }
+    }
+    if (phoff > core->size || phnum > (core->size - phoff) / phentsize) {
+        errf("target: truncated program headers in %s", path);
+        return 0;
+    }
+
+    if (!(core->regions = malloc(phnum * sizeof(struct region) + 1))
+            || !(core->offsets = malloc(phnum * sizeof(size_t) + 1))) {
+        errf("target: out-of-memory for core segments");
+        return 0;
+    }
+    for (i = n = 0; i < phnum; i++) {
+        uint64_t size;
+        if (!core_phdr_get(core, i, &phdr) || phdr.type != PT_LOAD)
+            continue;
+        /* Truncated cores keep the segment data they have */
+        size = phdr.filesz;
+        if (size > core->size - phdr.offset)
+            size = core->size - phdr.offset;
+        if (!size || (addr_t)phdr.vaddr != phdr.vaddr
+                || (addr_t)(phdr.vaddr + size - 1) < (addr_t)phdr.vaddr)
+            continue;
+        core->regions[n].start = (addr_t)phdr.vaddr;
+        core->regions[n].size = (addr_t)size;
+        core->regions[n].prot = (phdr.flags & PF_R ? MEM_READ : 0)
+                              | (phdr.flags & PF_W ? MEM_WRITE : 0)
+                              | (phdr.flags & PF_X ? MEM_EXECUTE : 0);
+        core->regions[n].path = NULL;
+        /* Offsets are sorted with the regions below */
+        core->offsets[n] = (size_t)phdr.offset;
+        n++;
+    }
+    core->regions_size = n;
+
+    /* Sort by address keeping the offsets with their regions */
+    for (i = 1; i < n; i++) {
+        if (core->regions[i - 1].start > core->regions[i].start)
+            break;
+    }
+    if (i < n) {
+        struct {
+            struct region region;
+            size_t offset;
+        } *sorted;
+        if (!(sorted = malloc(n * sizeof(*sorted)))) {
+            errf("target: out-of-memory for core segments");
+            return 0;
+        }
+        for (i = 0; i < n; i++) {
+            sorted[i].region = core->regions[i];
+            sorted[i].offset = core->offsets[i];
+        }
+        qsort(sorted, n, sizeof(*sorted), core_region_compare);
+        for (i = 0; i < n; i++) {
+            core->regions[i] = sorted[i].region;
+            core->offsets[i] = sorted[i].offset;
+        }
+        free(sorted);
+    }
+
+    for (i = 0; i < phnum; i++) {
+        if (core_phdr_get(core, i, &phdr) && phdr.type == PT_NOTE
+                && phdr.filesz <= core->size - phdr.offset)
+            core_parse_notes(core, core->data + phdr.offset,
+                             (size_t)phdr.filesz);
+    }
+    return 1;
+}
+
+static struct target *target_attach_core(const char *path)
+{
+    static const struct target core_init = {
+        core_detach,
+        core_stop,
+        core_run,
+        core_region_first,
+        core_region_next,
+        core_read,
+        core_write,
+        core_read_prefix,
+        core_read_batch,
+        core_write_batch,
+        core_stop_mode,
+        core_page_flags,
+        core_clear_soft_dirty,
+        core_refresh,
+        core_map,
+        core_idle
+    };
+    struct target_core *core;
+    off_t sz;
+
+    if (!(core = calloc(1, sizeof(struct target_core)))) {
+        errf("target: out-of-memory for core target instance");
+        return NULL;
+    }
+    memcpy(core, &core_init, sizeof(struct target));
+    if ((core->fd = open(path, O_RDONLY)) == -1) {
+        errf("target: error opening core file %s", path);
+        core_detach((struct target *)core);
+        return NULL;
+    }
+    if ((sz = lseek(core->fd, 0, SEEK_END)) <= 0 || sz != (off_t)(size_t)sz) {
+        errf("target: error determining file size of %s", path);
+        core_detach((struct target *)core);
+        return NULL;
+    }
+    core->size = (size_t)sz;
+    core->data = mmap(NULL, core->size, PROT_READ, MAP_PRIVATE, core->fd, 0);
+    if (core->data == MAP_FAILED) {
+        errf("target: error mapping core file %s", path);
+        core->data = NULL;
+        core_detach((struct target *)core);
+        return NULL;
+    }
+    if (!core_parse(core, path)) {
+        core_detach((struct target *)core);
+        return NULL;
+    }
+    return (struct target *)core;
+}
+
+/*
+ * Target wrapper caching reads of the wrapped target in a direct-mapped
+ * cache of whole pages.
+ */
+struct target_cache {
+    struct target base;
+    struct target *target;
+    size_t page_size;
+    size_t pages;  /* number of slots (power of two) */
+    addr_t *tags;  /* page address + 1 of each slot (0 if empty) */
+    char *data;    /* page data of the slots (allocated on first read) */
+};
+
+static int cache_detach(struct target *target)
+{
+    struct target_cache *cache = (struct target_cache *)target;
+    free(cache->data);
+    free(cache->tags);
+    free(cache);
+    return 1;
+}
+
+static int cache_stop(struct target *target)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->stop(wrapped);
+}
+
+static int cache_run(struct target *target)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->run(wrapped);
+}
+
+static struct region *cache_region_first(struct target *target)
+{
+    /* Iterate the regions of the wrapped target instead */
+    return NULL;
+}
+
+static struct region *cache_region_next(struct region *it)
+{
+    return NULL;
+}
+
+/*
+ * Get the cached page at `page` (page-aligned), reading it on a miss.
+ * Returns NULL if the whole page cannot be read.
+ */
+static const char *cache_page(struct target_cache *cache, addr_t page)
+{
+    size_t slot = (size_t)(page / cache->page_size) & (cache->pages - 1);
+    char *data;
+    if (!cache->data
+            && !(cache->data = malloc(cache->pages * cache->page_size)))
+        return NULL;
+    data = cache->data + slot * cache->page_size;
+    if (cache->tags[slot] != page + 1) {
+        struct target *wrapped = cache->target;
+        cache->tags[slot] = 0;
+        if (!wrapped->read(wrapped, page, data, cache->page_size))
+            return NULL;
+        cache->tags[slot] = page + 1;
+    }
+    return data;
+}
+
+static int cache_read(struct target *target, addr_t addr, void *buf,
+                      size_t len)
+{
+    struct target_cache *cache = (struct target_cache *)target;
+    struct target *wrapped = cache->target;
+    const void *mapped;
+    size_t off = 0;
+
+    if ((mapped = wrapped->map(wrapped, addr, len))) {
+        memcpy(buf, mapped, len);
+        return 1;
+    }
+    while (off < len) {
+        addr_t at = addr + off;
+        size_t page_off = (size_t)(at % cache->page_size);
+        size_t run = cache->page_size - page_off;
+        const char *data;
+        if (run > len - off)
+            run = len - off;
+        if (!(data = cache_page(cache, at - page_off))) {
+            /* Read uncached if the page is only partially accessible */
+            return wrapped->read(wrapped, at, (char *)buf + off, len - off);
+        }
+        memcpy((char *)buf + off, data + page_off, run);
+        off += run;
+    }
+    return 1;
+}
+
+/*
+ * Drop the cached pages overlapping `len` bytes at `addr`.
+ */
+static void cache_invalidate(struct target_cache *cache, addr_t addr,
+                             size_t len)
+{
+    addr_t page = addr - addr % cache->page_size;
+    while (len) {
+        size_t slot = (size_t)(page / cache->page_size) & (cache->pages - 1);
+        if (cache->tags[slot] == page + 1)
+            cache->tags[slot] = 0;
+        if (addr + (len - 1) - page < cache->page_size)
+            break;
+        page += cache->page_size;
+    }
+}
+
+static int cache_write(struct target *target, addr_t addr, void *buf,
+                       size_t len)
+{
+    struct target_cache *cache = (struct target_cache *)target;
+    struct target *wrapped = cache->target;
+    cache_invalidate(cache, addr, len);
+    return wrapped->write(wrapped, addr, buf, len);
+}
+
+static size_t cache_read_prefix(struct target *target, addr_t addr,
+                                void *buf, size_t len)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    if (cache_read(target, addr, buf, len))
+        return len;
+    return wrapped->read_prefix(wrapped, addr, buf, len);
+}
+
+static int cache_read_batch(struct target *target,
+                            struct target_read *reads, size_t n)
+{
+    size_t i;
+    int rc = 1;
+    for (i = 0; i < n; i++) {
+        if (!(reads[i].ok = cache_read(target, reads[i].addr, reads[i].buf,
+                                       reads[i].len)))
+            rc = 0;
+    }
+    return rc;
+}
+
+static int cache_write_batch(struct target *target,
+                             struct target_read *writes, size_t n)
+{
+    struct target_cache *cache = (struct target_cache *)target;
+    struct target *wrapped = cache->target;
+    size_t i;
+    for (i = 0; i < n; i++)
+        cache_invalidate(cache, writes[i].addr, writes[i].len);
+    return wrapped->write_batch(wrapped, writes, n);
+}
+
+static int cache_stop_mode(struct target *target, enum target_stop mode)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->stop_mode(wrapped, mode);
+}
+
+static int cache_page_flags(struct target *target, addr_t addr, size_t len,
+                            unsigned char *flags)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->page_flags(wrapped, addr, len, flags);
+}
+
+static int cache_clear_soft_dirty(struct target *target)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->clear_soft_dirty(wrapped);
+}
+
+static int cache_refresh(struct target *target)
+{
+    struct target_cache *cache = (struct target_cache *)target;
+    memset(cache->tags, 0, sizeof(addr_t) * cache->pages);
+    return cache->target->refresh(cache->target);
+}
+
+static const void *cache_map(struct target *target, addr_t addr, size_t len)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->map(wrapped, addr, len);
+}
+
+static int cache_idle(struct target *target)
+{
+    struct target *wrapped = ((struct target_cache *)target)->target;
+    return wrapped->idle(wrapped);
+}
+
+struct target *target_cache_new(struct target *target, size_t pages)
+{
+    static const struct target cache_init = {
+        cache_detach,
+        cache_stop,
+        cache_run,
+        cache_region_first,
+        cache_region_next,
+        cache_read,
+        cache_write,
+        cache_read_prefix,
+        cache_read_batch,
+        cache_write_batch,
+        cache_stop_mode,
+        cache_page_flags,
+        cache_clear_soft_dirty,
+        cache_refresh,
+        cache_map,
+        cache_idle
+    };
+    struct target_cache *cache;
+    if ((cache = malloc(sizeof(struct target_cache)))) {
+        memcpy(cache, &cache_init, sizeof(struct target));
+        cache->target = target;
+        cache->page_size = target_page_size();
+        for (cache->pages = 1; cache->pages < pages; cache->pages *= 2);
+        cache->data = NULL;
+        if ((cache->tags = calloc(cache->pages, sizeof(addr_t))))
+            return (struct target *)cache;
+        free(cache);
+    }
+    errf("target: out-of-memory for target read cache");
+    return NULL;
+}
+
+struct target *target_attach(const char *uri)
+{
+    if (!memcmp(uri, "pid://", 6)) {
+        char *end;
         unsigned long pid;
         if ((pid = strtoul(uri+6, &end, 10)) && !*end && pid == (pid_t)pid)
             return target_attach_pid(pid);
         errf("target: invalid pid uri (%s)", uri);
     } else if (!memcmp(uri, "file://", 7)) {
         return target_attach_file(uri + 7);
+    } else if (!memcmp(uri, "core://", 7)) {
+        return target_attach_core(uri + 7);
+    } else if (!memcmp(uri, "group://", 8)) {
+        return target_attach_group(uri + 8);
+    } else if (!memcmp(uri, "tcp://", 6)) {
+        return target_attach_remote(uri + 6);
     } else {
         char *end;
         unsigned long pid;
@@ -374,6 +1815,94 @@ void target_detach(struct target *target)
     target->detach(target);
 }
 
+int target_stop_all(struct target **targets, size_t n, int *stopped)
+{
+    size_t i;
+    int rc = 1;
+
+    for (i = 0; i < n; i++) {
+        if (targets[i]->stop == process_stop) {
+            struct target_process *process;
+            process = (struct target_process *)targets[i];
+            /* 1 until waited for below */
+            stopped[i] = process_stop_request(process);
+        } else stopped[i] = targets[i]->stop(targets[i]) ? 2 : 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (stopped[i] == 1) {
+            struct target_process *process;
+            process = (struct target_process *)targets[i];
+            stopped[i] = process_stop_wait(process);
+        }
+        stopped[i] = !!stopped[i];
+        rc &= stopped[i];
+    }
+    return rc;
+}
+
+size_t target_page_size()
+{
+    static size_t page_size;
+    if (!page_size) {
+        long ret = sysconf(_SC_PAGESIZE);
+        page_size = (ret > 0) ? (size_t)ret : 4096;
+    }
+    return page_size;
+}
+
+int target_read_spans(struct target *target, struct target_read *reads,
+                      size_t n, size_t gap)
+{
+    char *span;
+    size_t i, j, k, pending;
+    int rc = 1;
+
+    if (!gap || n < 2 || !(span = malloc(TARGET_SPAN_MAX)))
+        return target->read_batch(target, reads, n);
+
+    for (i = 0; i < n; i = j) {
+        addr_t start = reads[i].addr;
+        addr_t end = start + reads[i].len;
+
+        for (j = i + 1; j < n; j++) {
+            addr_t next_end = reads[j].addr + reads[j].len;
+            if (reads[j].addr < start || reads[j].addr > end + gap
+                    || (next_end > end ? next_end : end) - start
+                       > TARGET_SPAN_MAX)
+                break;
+            if (next_end > end)
+                end = next_end;
+        }
+
+        if (j - i > 1 && target->read(target, start, span, end - start)) {
+            for (k = i; k < j; k++) {
+                memcpy(reads[k].buf, span + (reads[k].addr - start),
+                       reads[k].len);
+                reads[k].ok = 1;
+            }
+        } else {
+            for (k = i; k < j; k++)
+                reads[k].ok = -1;
+        }
+    }
+    free(span);
+
+    /* Batch read runs of remaining elements */
+    for (i = 0; i < n; i = j) {
+        for (pending = 0, j = i; j < n && reads[j].ok == -1; j++)
+            pending++;
+        if (pending) {
+            for (k = i; k < j; k++)
+                reads[k].ok = 0;
+            if (!target->read_batch(target, &reads[i], pending))
+                rc = 0;
+        } else {
+            j++;
+        }
+    }
+    return rc;
+}
+
 size_t region_snprint(const struct region *mr, char *out, size_t size)
 {
     char suffix;
@@ -5,6 +5,14 @@
 #include <sys/types.h>
 
 struct region;
+struct target_read;
+
+/* How stop() and run() pause and resume the target */
+enum target_stop {
+    TARGET_STOP_DETACH = 0, /* attach on stop, detach on run */
+    TARGET_STOP_SESSION,    /* stay attached, stop with signals */
+    TARGET_STOP_NONE        /* never stop (reads may be torn) */
+};
 
 struct target {
     /* Detach target */
@@ -14,15 +22,112 @@ struct target {
     int (*stop)(struct target *);
     int (*run)(struct target *);
 
-    /* Iterate memory regions (iterate till the end to prevent memory leaks!) */
+    /*
+     * Iterate memory regions (iterate till the end to prevent memory leaks!)
+     * Paths of the iterated regions stay valid until region_first() is called
+     * after all iterations have ended.
+     */
     struct region *(*region_first)(struct target *);
     struct region *(*region_next)(struct region *);
 
     /* Read/write target memory */
     int (*read)(struct target *, addr_t addr, void *buf, size_t len);
     int (*write)(struct target *, addr_t addr, void *buf, size_t len);
+
+    /*
+     * Read up to `len` bytes at `addr` stopping at the first unreadable page.
+     * Returns the length of the read (readable) prefix.
+     */
+    size_t (*read_prefix)(struct target *, addr_t addr, void *buf, size_t len);
+
+    /*
+     * Read many (possibly non-contiguous) memory areas at once. Returns zero
+     * if any of the reads failed; `ok` of each element tells which did.
+     */
+    int (*read_batch)(struct target *, struct target_read *reads, size_t n);
+
+    /*
+     * Write many memory areas at once from the buffers of the elements.
+     * Returns like read_batch().
+     */
+    int (*write_batch)(struct target *, struct target_read *writes, size_t n);
+
+    /* Set the stop mode (called only while the target is running) */
+    int (*stop_mode)(struct target *, enum target_stop mode);
+
+    /*
+     * Get TARGET_PAGE_* flags of each page (of target_page_size() bytes)
+     * overlapping `len` bytes at `addr`. Returns zero if unsupported.
+     */
+    int (*page_flags)(struct target *, addr_t addr, size_t len,
+                      unsigned char *flags);
+
+    /* Reset soft-dirty flags of all pages. Returns zero if unsupported. */
+    int (*clear_soft_dirty)(struct target *);
+
+    /*
+     * Discard cached target state (e.g., the parsed memory regions) so that
+     * it is read again. Fails during region iterations.
+     */
+    int (*refresh)(struct target *);
+
+    /*
+     * Get a direct pointer to `len` bytes of target memory at `addr` (valid
+     * until detach) or NULL if the memory cannot be accessed without copying.
+     */
+    const void *(*map)(struct target *, addr_t addr, size_t len);
+
+    /*
+     * Handle pending events of the running target while ramfuck waits for
+     * input (e.g., pass on the signals stopping a ptrace session). Returns
+     * nonzero if the target needs to be called again while waiting.
+     */
+    int (*idle)(struct target *);
 };
 
+/* Page flags */
+#define TARGET_PAGE_PRESENT    1 /* page is resident (not the zero page) */
+#define TARGET_PAGE_SWAPPED    2 /* page is swapped out */
+#define TARGET_PAGE_SOFT_DIRTY 4 /* page written since soft-dirty reset */
+
+/* Size of pages reported by page_flags() */
+size_t target_page_size();
+
+/* Element of a batched read */
+struct target_read {
+    addr_t addr;
+    void *buf;
+    size_t len;
+    int ok;
+};
+
+/* Suggested maximum number of elements passed to a single read_batch() */
+#define TARGET_READ_BATCH 1024
+
+/* Maximum size of a span read by target_read_spans() */
+#define TARGET_SPAN_MAX (64 * 1024)
+
+/*
+ * Read elements (in ascending address order) by coalescing neighbours at most
+ * `gap` bytes apart to single span reads. Elements not coalesced, or in spans
+ * failing to read, are read with read_batch(). Returns like read_batch().
+ */
+int target_read_spans(struct target *target, struct target_read *reads,
+                      size_t n, size_t gap);
+
+
+/*
+ * Wrap `target` to a target caching reads of whole pages in a direct-mapped
+ * cache of (at least) `pages` pages. Writes invalidate the cached pages and
+ * the other operations, except region iteration, are forwarded. The cache
+ * is not coherent with target memory, so use it only while the target is
+ * stopped (e.g., for one search). target_detach() of the wrapper does not
+ * detach the wrapped target.
+ */
+struct target *target_cache_new(struct target *target, size_t pages);
+
+/* Default number of pages cached by target read caches */
+#define TARGET_CACHE_PAGES 64
 
 /* Create target instance for URI */
 struct target *target_attach(const char *uri);
@@ -30,6 +135,13 @@ struct target *target_attach(const char *uri);
 /* Destroy target instance */
 void target_detach(struct target *target);
 
+/*
+ * Stop `n` targets with overlapping stop windows: every process is asked to
+ * stop before waiting for any of them. stopped[i] tells which targets were
+ * stopped. Returns zero if any stop failed.
+ */
+int target_stop_all(struct target **targets, size_t n, int *stopped);
+
 /* Memory region */
 struct region {
     addr_t start;
@@ -90,6 +90,29 @@ int value_is_zero(const struct value *dest)
     return 1;
 }
 
+int value_type_is_valid(enum value_type type)
+{
+    switch (type & ~PTR)
+    {
+    case 0:
+        return type == PTR;
+
+    case S8: case U8:
+    case S16: case U16:
+    case S32: case U32:
+    #ifndef NO_64BIT_VALUES
+    case S64: case U64:
+    #endif
+    #ifndef NO_FLOAT_VALUES
+    case F32: case F64:
+    #endif
+        return 1;
+
+    default: break;
+    }
+    return 0;
+}
+
 const char *value_type_to_string(enum value_type type)
 {
     switch (type)
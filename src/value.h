@@ -166,6 +166,11 @@ int value_init_f64(struct value *dest, double value);
 int value_is_zero(const struct value *dest);
 #define value_is_nonzero(dest) (!value_is_zero((dest)))
 
+/*
+ * Check whether `type` is a value type or a pointer to one (including void*).
+ */
+int value_type_is_valid(enum value_type type);
+
 /*
  * Return a constant string representing a value type.
  */
@@ -0,0 +1,324 @@
+#include "vm.h"
+#include "ramfuck.h"
+#include "symbol.h"
+#include "target.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static struct vm_insn *vm_emit(struct vm_program *prog, enum vm_opcode op,
+                               enum value_type type, unsigned int dst)
+{
+    struct vm_insn *insn;
+    if (prog->size == prog->capacity) {
+        size_t capacity = prog->capacity ? 2*prog->capacity : 16;
+        struct vm_insn *new;
+        if (!(new = realloc(prog->insns, capacity * sizeof(struct vm_insn))))
+            return NULL;
+        prog->insns = new;
+        prog->capacity = capacity;
+    }
+    insn = &prog->insns[prog->size++];
+    memset(insn, 0, sizeof(struct vm_insn));
+    insn->op = op;
+    insn->type = type;
+    insn->dst = insn->a = dst;
+    insn->b = dst + 1;
+    if (prog->nregs < dst + 1)
+        prog->nregs = dst + 1;
+    return insn;
+}
+
+static int (*cast_op(enum value_type from, enum value_type to))
+    (struct value *, struct value *)
+{
+    const struct value_operations *ops = value_type_ops(from);
+    switch (to) {
+    case S8: return ops->cast_to_s8;
+    case U8: return ops->cast_to_u8;
+    case S16: return ops->cast_to_s16;
+    case U16: return ops->cast_to_u16;
+    case S32: return ops->cast_to_s32;
+    case U32: return ops->cast_to_u32;
+#ifndef NO_64BIT_VALUES
+    case S64: return ops->cast_to_s64;
+    case U64: return ops->cast_to_u64;
+#endif
+#ifndef NO_FLOAT_VALUES
+    case F32: return ops->cast_to_f32;
+    case F64: return ops->cast_to_f64;
+#endif
+    default: break;
+    }
+    return NULL;
+}
+
+static int (*unary_op(enum ast_type node_type, enum value_type type))
+    (struct value *, struct value *)
+{
+    const struct value_operations *ops = value_type_ops(type);
+    switch (node_type) {
+    case AST_NEG: return ops->neg;
+    case AST_NOT: return ops->not;
+    case AST_COMPL: return ops->compl;
+    default: break;
+    }
+    return NULL;
+}
+
+static int (*binary_op(enum ast_type node_type, enum value_type type))
+    (struct value *, struct value *, struct value *)
+{
+    const struct value_operations *ops = value_type_ops(type);
+    switch (node_type) {
+    case AST_ADD: return ops->add;
+    case AST_SUB: return ops->sub;
+    case AST_MUL: return ops->mul;
+    case AST_DIV: return ops->div;
+    case AST_MOD: return ops->mod;
+    case AST_AND: return ops->and;
+    case AST_XOR: return ops->xor;
+    case AST_OR: return ops->or;
+    case AST_SHL: return ops->shl;
+    case AST_SHR: return ops->shr;
+    case AST_EQ: return ops->eq;
+    case AST_NEQ: return ops->neq;
+    case AST_LT: return ops->lt;
+    case AST_GT: return ops->gt;
+    case AST_LE: return ops->le;
+    case AST_GE: return ops->ge;
+    default: break;
+    }
+    return NULL;
+}
+
+/*
+ * Compile `ast` so that its result is stored to register `dst`. Registers
+ * above `dst` are free for temporaries, so the register index equals the
+ * depth of the evaluation stack.
+ */
+static int vm_compile_node(struct vm_program *prog, struct ast *ast,
+                           unsigned int dst)
+{
+    struct vm_insn *insn;
+    struct ast *child, *left, *right;
+    size_t at;
+
+    switch (ast->node_type) {
+    case AST_VALUE:
+        if (!(insn = vm_emit(prog, VM_CONST, ast->value_type, dst)))
+            return 0;
+        insn->u.value = ((struct ast_value *)ast)->value;
+        return 1;
+
+    case AST_VAR:
+        if (!(insn = vm_emit(prog, VM_VAR, ast->value_type, dst)))
+            return 0;
+        insn->u.var.symbol = ((struct ast_var *)ast)->symtab->symbols[
+            ((struct ast_var *)ast)->sym];
+        insn->u.var.size = ((struct ast_var *)ast)->size;
+        return 1;
+
+    case AST_CAST:
+        child = ((struct ast_unary *)ast)->child;
+        if (!vm_compile_node(prog, child, dst))
+            return 0;
+        if ((ast->value_type & PTR)) {
+            if (!(insn = vm_emit(prog, VM_PTRCAST, ast->value_type, dst)))
+                return 0;
+            insn->u.assign = value_type_ops(child->value_type)->assign;
+        } else {
+            if (!(insn = vm_emit(prog, VM_CAST, ast->value_type, dst)))
+                return 0;
+            if (!(insn->u.unary = cast_op(child->value_type, ast->value_type)))
+                insn->u.unary = value_type_ops(ast->value_type)->assign;
+        }
+        return 1;
+
+    case AST_DEREF:
+        child = ((struct ast_unary *)ast)->child;
+        if (!vm_compile_node(prog, child, dst))
+            return 0;
+        if (!(insn = vm_emit(prog, VM_DEREF, ast->value_type, dst)))
+            return 0;
+        insn->u.target = ((struct ast_deref *)ast)->target;
+        return 1;
+
+    case AST_NEG: case AST_NOT: case AST_COMPL:
+        child = ((struct ast_unary *)ast)->child;
+        if (!vm_compile_node(prog, child, dst))
+            return 0;
+        if (!(insn = vm_emit(prog, VM_UNARY, ast->value_type, dst)))
+            return 0;
+        insn->u.unary = unary_op(ast->node_type, child->value_type);
+        return 1;
+
+    case AST_AND_COND: case AST_OR_COND:
+        left = ((struct ast_binary *)ast)->left;
+        right = ((struct ast_binary *)ast)->right;
+        if (!vm_compile_node(prog, left, dst))
+            return 0;
+        at = prog->size;
+        if (!vm_emit(prog, (ast->node_type == AST_AND_COND) ? VM_JZ : VM_JNZ,
+                     S32, dst))
+            return 0;
+        if (!vm_compile_node(prog, right, dst)
+                || !vm_emit(prog, VM_BOOL, S32, dst))
+            return 0;
+        prog->insns[at].u.jump = prog->size;
+        return 1;
+
+    default:
+        if (ast->node_type < AST_ADD || ast->node_type >= AST_TYPES)
+            break;
+        left = ((struct ast_binary *)ast)->left;
+        right = ((struct ast_binary *)ast)->right;
+        if (!vm_compile_node(prog, left, dst))
+            return 0;
+        if (right->node_type == AST_VALUE) {
+            if (!(insn = vm_emit(prog, VM_BINARY_K, ast->value_type, dst)))
+                return 0;
+            insn->k = ((struct ast_value *)right)->value;
+        } else {
+            if (!vm_compile_node(prog, right, dst + 1))
+                return 0;
+            if (!(insn = vm_emit(prog, VM_BINARY, ast->value_type, dst)))
+                return 0;
+        }
+        insn->u.binary = binary_op(ast->node_type, left->value_type);
+        return 1;
+    }
+
+    errf("vm: unsupported AST node type %d", (int)ast->node_type);
+    return 0;
+}
+
+struct vm_program *vm_compile(struct ast *ast)
+{
+    struct vm_program *prog;
+    if (!(prog = calloc(1, sizeof(struct vm_program)))) {
+        errf("vm: out-of-memory for program");
+        return NULL;
+    }
+    if (!vm_compile_node(prog, ast, 0)
+            || !(prog->regs = calloc(prog->nregs, sizeof(struct value)))) {
+        errf("vm: compiling expression failed");
+        vm_program_delete(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+void vm_program_delete(struct vm_program *prog)
+{
+    free(prog->insns);
+    free(prog->regs);
+    free(prog);
+}
+
+/* Same as value_is_zero() for values of 1, 2, 4 or 8 bytes */
+#ifndef NO_64BIT_VALUES
+# define vm_is_zero(v) ((value_sizeof(v) == 4) ? !(v)->data.u32 \
+                      : (value_sizeof(v) == 8) ? !(v)->data.u64 \
+                      : (value_sizeof(v) == 1) ? !(v)->data.u8 \
+                      : (value_sizeof(v) == 2) ? !(v)->data.u16 \
+                      : value_is_zero((v)))
+#else
+# define vm_is_zero(v) ((value_sizeof(v) == 4) ? !(v)->data.u32 \
+                      : (value_sizeof(v) == 1) ? !(v)->data.u8 \
+                      : (value_sizeof(v) == 2) ? !(v)->data.u16 \
+                      : value_is_zero((v)))
+#endif
+
+int vm_execute(struct vm_program *prog, struct value *out)
+{
+    struct value *r = prog->regs;
+    const struct vm_insn *insn = prog->insns;
+    const struct vm_insn *end = prog->insns + prog->size;
+
+    while (insn < end) {
+        struct value *dst = &r[insn->dst];
+        switch (insn->op) {
+        case VM_CONST:
+            *dst = insn->u.value;
+            break;
+
+        case VM_VAR: {
+            const void *src = insn->u.var.symbol->pdata;
+            dst->type = insn->type;
+            switch (insn->u.var.size) {
+            case 1: memcpy(&dst->data, src, 1); break;
+            case 2: memcpy(&dst->data, src, 2); break;
+            case 4: memcpy(&dst->data, src, 4); break;
+            case 8: memcpy(&dst->data, src, 8); break;
+            default: memcpy(&dst->data, src, insn->u.var.size); break;
+            }
+            break;
+        }
+
+        case VM_CAST:
+            if (!insn->u.unary(&r[insn->a], dst))
+                return 0;
+            break;
+
+        case VM_PTRCAST:
+            if (!insn->u.assign(dst, &r[insn->a]))
+                return 0;
+            dst->type = insn->type;
+            break;
+
+        case VM_DEREF: {
+#if ADDR_BITS == 64
+            addr_t addr = (dst->type == U64) ? dst->data.u64 : dst->data.u32;
+#else
+            addr_t addr = dst->data.u32;
+#endif
+            struct target *target = insn->u.target;
+            dst->type = insn->type;
+            if (!target->read(target, addr, &dst->data,
+                              value_type_sizeof(insn->type)))
+                return 0;
+            break;
+        }
+
+        case VM_UNARY:
+            if (!insn->u.unary(&r[insn->a], dst))
+                return 0;
+            break;
+
+        case VM_BINARY:
+            if (!insn->u.binary(&r[insn->a], &r[insn->b], dst))
+                return 0;
+            break;
+
+        case VM_BINARY_K:
+            if (!insn->u.binary(&r[insn->a], (struct value *)&insn->k, dst))
+                return 0;
+            break;
+
+        case VM_JZ:
+            if (vm_is_zero(dst)) {
+                value_init_s32(dst, 0);
+                insn = prog->insns + insn->u.jump;
+                continue;
+            }
+            break;
+
+        case VM_JNZ:
+            if (!vm_is_zero(dst)) {
+                value_init_s32(dst, 1);
+                insn = prog->insns + insn->u.jump;
+                continue;
+            }
+            break;
+
+        case VM_BOOL:
+            value_init_s32(dst, !vm_is_zero(dst));
+            break;
+        }
+        insn++;
+    }
+
+    *out = r[0];
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * Flat bytecode for evaluating expressions.
+ *
+ * An optimized AST is lowered to a linear array of instructions operating on
+ * a small register file. Value operations are resolved at compile time from
+ * the static node types (the parser has already inserted implicit casts), so
+ * executing the program does not walk the tree or dispatch on value types.
+ */
+
+#ifndef VM_H_INCLUDED
+#define VM_H_INCLUDED
+
+#include "ast.h"
+#include "value.h"
+
+#include <stddef.h>
+
+enum vm_opcode {
+    VM_CONST,    /* r[dst] = constant */
+    VM_VAR,      /* r[dst] = *symbol */
+    VM_CAST,     /* r[dst] = (type)r[a] */
+    VM_PTRCAST,  /* r[dst] = (type *)r[a] */
+    VM_DEREF,    /* r[dst] = *(type *)r[a] */
+    VM_UNARY,    /* r[dst] = op r[a] */
+    VM_BINARY,   /* r[dst] = r[a] op r[b] */
+    VM_BINARY_K, /* r[dst] = r[a] op constant */
+    VM_JZ,       /* if (!r[dst]) { r[dst] = 0; goto jump; } */
+    VM_JNZ,      /* if (r[dst]) { r[dst] = 1; goto jump; } */
+    VM_BOOL      /* r[dst] = !!r[dst] */
+};
+
+struct vm_insn {
+    enum vm_opcode op;
+    enum value_type type;
+    unsigned int dst, a, b;
+    struct value k; /* constant right-hand operand of VM_BINARY_K */
+    union {
+        struct value value;
+        struct {
+            struct symbol *symbol;
+            size_t size;
+        } var;
+        int (*assign)(struct value *, struct value *);
+        int (*unary)(struct value *, struct value *);
+        int (*binary)(struct value *, struct value *, struct value *);
+        struct target *target;
+        size_t jump;
+    } u;
+};
+
+struct vm_program {
+    struct vm_insn *insns;
+    size_t size, capacity;
+    struct value *regs;
+    unsigned int nregs;
+};
+
+/*
+ * Compile an AST to a program.
+ *
+ * The AST may be deleted after compiling, but the symbols and target objects
+ * referenced by it must outlive the program.
+ */
+struct vm_program *vm_compile(struct ast *ast);
+
+/*
+ * Delete a compiled program.
+ */
+void vm_program_delete(struct vm_program *prog);
+
+/*
+ * Execute program and store result to pointed value.
+ *
+ * Returns zero if the evaluation failed (e.g., dereferencing failed).
+ */
+int vm_execute(struct vm_program *prog, struct value *out);
+
+#endif
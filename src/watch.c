@@ -0,0 +1,409 @@
+#define _DEFAULT_SOURCE /* for clock_gettime(2) */
+#include "watch.h"
+
+#include "ast.h"
+#include "config.h"
+#include "opt.h"
+#include "parse.h"
+#include "stats.h"
+#include "symbol.h"
+#include "target.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Maximum number of distinct hit types (pointer types included) */
+#define WATCH_PROGRAMS_MAX (2 * VALUE_TYPES)
+
+/*
+ * Expression compiled for hits of one value type.
+ */
+struct watch_program {
+    enum value_type type;
+    struct symbol_table *symtab;
+    struct ast *ast;
+    struct vm_program *prog;
+    union value_data **pvalue, **pprev;
+};
+
+struct watch_programs {
+    struct watch_program programs[WATCH_PROGRAMS_MAX];
+    size_t size;
+    addr_t addr;
+    struct watch_hit counters; /* counters of the evaluated hit */
+};
+
+static void watch_program_destroy(struct watch_program *wp)
+{
+    if (wp->prog) vm_program_delete(wp->prog);
+    if (wp->ast) ast_delete(wp->ast);
+    if (wp->symtab) symbol_table_delete(wp->symtab);
+    memset(wp, 0, sizeof(struct watch_program));
+}
+
+static void watch_programs_destroy(struct watch_programs *wps)
+{
+    while (wps->size)
+        watch_program_destroy(&wps->programs[--wps->size]);
+}
+
+/*
+ * Compile `expression` for every type of `hits` (optionally with the counter
+ * symbols samples, changes and matches).
+ */
+static int watch_programs_init(struct watch_programs *wps, struct ramfuck *ctx,
+                               const struct hits *hits, const char *expression,
+                               int counters)
+{
+    size_t i, j;
+
+    memset(wps, 0, sizeof(struct watch_programs));
+    for (i = 0; i == 0 || (hits->types && i < hits->size); i++) {
+        enum value_type type = hits->types ? hits->types[i] : hits->value_type;
+        struct watch_program *wp;
+        struct parser parser;
+        struct ast *opt;
+        size_t value_sym, prev_sym;
+
+        for (j = 0; j < wps->size && wps->programs[j].type != type; j++);
+        if (j < wps->size)
+            continue;
+        if (wps->size == WATCH_PROGRAMS_MAX) {
+            errf("watch: too many hit types");
+            goto fail;
+        }
+
+        wp = &wps->programs[wps->size++];
+        wp->type = type;
+        if (!(wp->symtab = symbol_table_new(ctx))) {
+            errf("watch: error creating new symbol table");
+            goto fail;
+        }
+        symbol_table_add(wp->symtab, "addr", hits->addr_type,
+                         (void *)&wps->addr);
+        value_sym = symbol_table_add(wp->symtab, "value", type, NULL);
+        prev_sym = symbol_table_add(wp->symtab, "prev", type, NULL);
+        wp->pvalue = &wp->symtab->symbols[value_sym]->pdata;
+        wp->pprev = &wp->symtab->symbols[prev_sym]->pdata;
+        if (counters) {
+            symbol_table_add(wp->symtab, "samples", U32,
+                             (void *)&wps->counters.samples);
+            symbol_table_add(wp->symtab, "changes", U32,
+                             (void *)&wps->counters.changes);
+            symbol_table_add(wp->symtab, "matches", U32,
+                             (void *)&wps->counters.matches);
+        }
+
+        parser_init(&parser);
+        parser.quiet = wps->size > 1;
+        parser.symtab = wp->symtab;
+        parser.addr_type = hits->addr_type;
+        parser.target = ctx->target;
+        if (!(wp->ast = parse_expression(&parser, expression))) {
+            errf("watch: %d parse errors", parser.errors);
+            goto fail;
+        }
+        if ((opt = ast_optimize(wp->ast))) {
+            ast_delete(wp->ast);
+            wp->ast = opt;
+        }
+        if (!(wp->prog = vm_compile(wp->ast))) {
+            errf("watch: error compiling expression");
+            goto fail;
+        }
+    }
+    return 1;
+
+fail:
+    watch_programs_destroy(wps);
+    return 0;
+}
+
+static struct watch_program *watch_program(struct watch_programs *wps,
+                                           enum value_type type)
+{
+    struct watch_program *wp;
+    for (wp = wps->programs; wp->type != type; wp++);
+    return wp;
+}
+
+static int watch_evaluate(struct watch_programs *wps, addr_t addr,
+                          enum value_type type, union value_data *value,
+                          union value_data *prev)
+{
+    struct watch_program *wp = watch_program(wps, type);
+    struct value result;
+    wps->addr = addr;
+    *wp->pvalue = value;
+    *wp->pprev = prev;
+    return vm_execute(wp->prog, &result) && value_is_nonzero(&result);
+}
+
+static size_t watch_value_size(const struct hits *hits, enum value_type type)
+{
+    return value_type_sizeof((type & PTR) ? hits->addr_type : type);
+}
+
+/*
+ * Latest sample of the i'th hit (or its value if it has not been sampled).
+ */
+static union value_data *watch_latest(struct watch *watch, size_t i)
+{
+    struct watch_hit *hit = &watch->stats[i];
+    if (!hit->samples)
+        return hits_prev(watch->hits, i);
+    return &hit->values[(hit->samples - 1) % WATCH_HISTORY];
+}
+
+/*
+ * Record samples of a batch of `n` hits starting from the i'th hit.
+ */
+static void watch_record(struct watch *watch, struct watch_programs *wps,
+                         size_t i, const struct target_read *reads,
+                         union value_data *values, size_t n)
+{
+    size_t j;
+    for (j = 0; j < n; j++) {
+        struct watch_hit *hit = &watch->stats[i + j];
+        enum value_type type = hits_type(watch->hits, i + j);
+        union value_data *prev = watch_latest(watch, i + j);
+        if (!reads[j].ok) {
+            watch->failed++;
+            continue;
+        }
+        if (hit->samples && memcmp(prev, &values[j], reads[j].len))
+            hit->changes++;
+        if (watch_evaluate(wps, reads[j].addr, type, &values[j], prev))
+            hit->matches++;
+        hit->values[hit->samples % WATCH_HISTORY] = values[j];
+        hit->samples++;
+    }
+}
+
+/*
+ * Sample every hit once. The lock is held for each batch (released between
+ * batches) so that watch_filter() can narrow the hits during a round.
+ */
+static void watch_sample(struct watch *watch, struct watch_programs *wps,
+                         struct target_read *reads, union value_data *values)
+{
+    struct target *target = watch->ctx->target;
+    size_t i, j, n;
+
+    for (i = 0; i < watch->hits->size && !watch->quit; i += n) {
+        if ((n = watch->hits->size - i) > TARGET_READ_BATCH)
+            n = TARGET_READ_BATCH;
+        for (j = 0; j < n; j++) {
+            enum value_type type = hits_type(watch->hits, i + j);
+            memset(&values[j], 0, sizeof(union value_data));
+            reads[j].addr = hits_addr(watch->hits, i + j);
+            reads[j].buf = &values[j];
+            reads[j].len = watch_value_size(watch->hits, type);
+            reads[j].ok = 0;
+        }
+        target->read_batch(target, reads, n);
+        watch_record(watch, wps, i, reads, values, n);
+
+        pthread_mutex_unlock(&watch->lock);
+        pthread_mutex_lock(&watch->lock);
+    }
+}
+
+struct watch_thread {
+    struct watch *watch;
+    struct watch_programs programs;
+};
+
+static void *watch_run(void *arg)
+{
+    struct watch_thread *thread = (struct watch_thread *)arg;
+    struct watch *watch = thread->watch;
+    struct target_read *reads;
+    union value_data *values;
+
+    reads = malloc(TARGET_READ_BATCH * sizeof(struct target_read));
+    values = malloc(TARGET_READ_BATCH * sizeof(union value_data));
+
+    pthread_mutex_lock(&watch->lock);
+    while (reads && values && !watch->quit) {
+        struct timespec deadline;
+        double start = stats_now();
+        watch_sample(watch, &thread->programs, reads, values);
+        watch->elapsed += stats_now() - start;
+        watch->rounds++;
+
+        /* Sleep until the next round (or until stopped) */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += watch->interval / 1000;
+        deadline.tv_nsec += (long)(watch->interval % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!watch->quit && pthread_cond_timedwait(&watch->cond,
+                                                      &watch->lock,
+                                                      &deadline) != ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&watch->lock);
+
+    free(values);
+    free(reads);
+    watch_programs_destroy(&thread->programs);
+    free(thread);
+    return NULL;
+}
+
+static void watch_delete(struct watch *watch)
+{
+    free(watch->expression);
+    free(watch->stats);
+    if (watch->hits) hits_delete(watch->hits);
+    free(watch);
+}
+
+struct watch *watch_start(struct ramfuck *ctx, const struct hits *hits,
+                          const char *expression, unsigned long interval)
+{
+    struct watch *watch;
+    struct watch_thread *thread;
+    size_t len = strlen(expression) + 1;
+
+    if (!(watch = calloc(1, sizeof(struct watch)))) {
+        errf("watch: out-of-memory for watch");
+        return NULL;
+    }
+    watch->ctx = ctx;
+    watch->interval = interval;
+    if (!(watch->expression = malloc(len))
+            || !(watch->hits = hits_copy(hits))
+            || !(watch->stats = calloc(hits->size ? hits->size : 1,
+                                       sizeof(struct watch_hit)))
+            || !(thread = malloc(sizeof(struct watch_thread)))) {
+        errf("watch: out-of-memory for watched hits");
+        watch_delete(watch);
+        return NULL;
+    }
+    memcpy(watch->expression, expression, len);
+
+    thread->watch = watch;
+    if (!watch_programs_init(&thread->programs, ctx, watch->hits, expression,
+                             0)) {
+        free(thread);
+        watch_delete(watch);
+        return NULL;
+    }
+
+    pthread_mutex_init(&watch->lock, NULL);
+    pthread_cond_init(&watch->cond, NULL);
+    if (pthread_create(&watch->thread, NULL, watch_run, thread)) {
+        errf("watch: error starting sampling thread");
+        pthread_cond_destroy(&watch->cond);
+        pthread_mutex_destroy(&watch->lock);
+        watch_programs_destroy(&thread->programs);
+        free(thread);
+        watch_delete(watch);
+        return NULL;
+    }
+    return watch;
+}
+
+void watch_stop(struct watch *watch)
+{
+    pthread_mutex_lock(&watch->lock);
+    watch->quit = 1;
+    pthread_cond_broadcast(&watch->cond);
+    pthread_mutex_unlock(&watch->lock);
+    pthread_join(watch->thread, NULL);
+    pthread_cond_destroy(&watch->cond);
+    pthread_mutex_destroy(&watch->lock);
+    watch_delete(watch);
+}
+
+struct hits *watch_filter(struct watch *watch, const char *expression)
+{
+    struct watch_programs wps;
+    struct hits *hits, *filtered, *remaining;
+    size_t i, k;
+
+    hits = watch->hits;
+    if (!watch_programs_init(&wps, watch->ctx, hits, expression, 1))
+        return NULL;
+    filtered = hits_new(hits->addr_type, hits->value_type);
+    remaining = hits_new(hits->addr_type, hits->value_type);
+    if (!filtered || !remaining) {
+        errf("watch: error allocating filtered hits container");
+        goto fail;
+    }
+
+    pthread_mutex_lock(&watch->lock);
+    for (i = k = 0; i < hits->size; i++) {
+        addr_t addr = hits_addr(hits, i);
+        enum value_type type = hits_type(hits, i);
+        union value_data *value = watch_latest(watch, i);
+        wps.counters = watch->stats[i];
+        if (!watch_evaluate(&wps, addr, type, value, hits_prev(hits, i)))
+            continue;
+        if (!hits_add(filtered, addr, type, value)
+                || !hits_add(remaining, addr, type, hits_prev(hits, i))) {
+            errf("watch: out-of-memory for filtered hits");
+            pthread_mutex_unlock(&watch->lock);
+            goto fail;
+        }
+        watch->stats[k++] = watch->stats[i];
+    }
+    watch->hits = remaining;
+    pthread_mutex_unlock(&watch->lock);
+
+    hits_delete(hits);
+    watch_programs_destroy(&wps);
+    return filtered;
+
+fail:
+    if (remaining) hits_delete(remaining);
+    if (filtered) hits_delete(filtered);
+    watch_programs_destroy(&wps);
+    return NULL;
+}
+
+void watch_print(struct watch *watch, int all, FILE *out)
+{
+    size_t (*to_string)(const struct value *, char *, size_t)
+        = (watch->ctx->config->cli.base == 16) ? value_to_hexstring
+                                               : value_to_string;
+    size_t i;
+
+    pthread_mutex_lock(&watch->lock);
+    fprintf(out, "watching %lu hits every %lums for '%s': %lu rounds",
+            (unsigned long)watch->hits->size, watch->interval,
+            watch->expression, watch->rounds);
+    if (watch->rounds) {
+        fprintf(out, " (%.3fms per round)",
+                watch->elapsed * 1000 / watch->rounds);
+    }
+    fprintf(out, ", %lu failed reads\n", watch->failed);
+
+    for (i = 0; all && i < watch->hits->size; i++) {
+        const struct watch_hit *hit = &watch->stats[i];
+        enum value_type type = hits_type(watch->hits, i);
+        uint32_t first, j;
+        fprintf(out, "%lu. *(%s *)0x%08" PRIaddr " samples=%lu changes=%lu"
+                " matches=%lu:", (unsigned long)i+1, value_type_to_string(type),
+                hits_addr(watch->hits, i), (unsigned long)hit->samples,
+                (unsigned long)hit->changes, (unsigned long)hit->matches);
+        first = (hit->samples > WATCH_HISTORY) ? hit->samples - WATCH_HISTORY
+                                               : 0;
+        for (j = first; j < hit->samples; j++) {
+            struct value value;
+            char buf[64];
+            value.type = (type & PTR) ? watch->hits->addr_type : type;
+            value.data = hit->values[j % WATCH_HISTORY];
+            to_string(&value, buf, sizeof(buf));
+            fprintf(out, " %s", buf);
+        }
+        fputc('\n', out);
+    }
+    pthread_mutex_unlock(&watch->lock);
+}
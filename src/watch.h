@@ -0,0 +1,81 @@
+/*
+ * Background sampling of hits.
+ *
+ * A watch samples a copy of the hits at a fixed interval on a background
+ * thread with batched reads (process_vm_readv(2) for processes) without
+ * stopping the target. Every hit has a ring buffer of its most recent
+ * samples and counters of changes between samples and of samples for which
+ * the watch expression was true. watch_filter() narrows the hits afterwards
+ * by these statistics.
+ */
+
+#ifndef WATCH_H_INCLUDED
+#define WATCH_H_INCLUDED
+
+#include "defines.h"
+#include "hits.h"
+#include "ramfuck.h"
+#include "value.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Number of recent samples kept of every hit */
+#define WATCH_HISTORY 8
+
+/* Default sampling interval in milliseconds */
+#define WATCH_INTERVAL 100
+
+struct watch_hit {
+    union value_data values[WATCH_HISTORY]; /* ring buffer of samples */
+    uint32_t samples;  /* successful samples */
+    uint32_t changes;  /* samples differing from the previous one */
+    uint32_t matches;  /* samples for which the expression was true */
+};
+
+struct watch {
+    struct ramfuck *ctx;
+    struct hits *hits;       /* copy of the watched hits */
+    struct watch_hit *stats; /* statistics of every hit */
+    char *expression;
+    unsigned long interval;  /* milliseconds */
+    unsigned long rounds;    /* completed sampling rounds */
+    unsigned long failed;    /* failed reads */
+    double elapsed;          /* seconds spent sampling */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int quit;
+};
+
+/*
+ * Start sampling a copy of `hits` every `interval` milliseconds counting the
+ * samples for which `expression` (of symbols addr, value and prev, the
+ * previous sample) is true. Returns NULL on error.
+ */
+struct watch *watch_start(struct ramfuck *ctx, const struct hits *hits,
+                          const char *expression, unsigned long interval);
+
+/*
+ * Stop sampling and delete the watch.
+ */
+void watch_stop(struct watch *watch);
+
+/*
+ * Filter the watched hits by `expression` of their statistics (symbols addr,
+ * value (the latest sample), prev (the hit value), samples, changes and
+ * matches). The watch continues with the remaining hits. Returns the
+ * remaining hits with their latest samples as values, or NULL on error.
+ */
+struct hits *watch_filter(struct watch *watch, const char *expression);
+
+/*
+ * Print the status of the watch and, if `all` is set, the recent samples of
+ * every hit (oldest first).
+ */
+void watch_print(struct watch *watch, int all, FILE *out);
+
+#endif